@@ -10,6 +10,8 @@
 
 #include <iostream>
 #include <map>
+#include <thread>
+#include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <IL/il.h>
 
@@ -20,20 +22,31 @@ using namespace std;
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include "assimp_extras.h"
+#include "skeleton.h"
+#include "anim_sampler.h"
+#include "anim_bake.h"
+#include "anim_compress.h"
+#include "skinning.h"
+#include "thread_pool.h"
+#include "options.h"
+#include "scene_cache.h"
+#include "asset_loader.h"
+#include "mesh_lod.h"
+#include "bone_bounds.h"
+#include "render_queue.h"
+#include "headless.h"
+#include "frame_stats.h"
+#include "frame_clock.h"
+#include "crowd.h"
+#include "frame_arena.h"
 
 // CONSTANTS
 #define TO_RAD (3.14159265f/180.0f)
 #define FLOOR_SIZE 10
 #define TILE_SIZE 1
+#define FIELD_OF_VIEW 35   // Vertical, in degrees
 #define MOVE_SPEED 0.03
 
-struct meshInit {
-    int mNumVertices;
-    aiVector3D* mVertices;
-    aiVector3D* mNormals;
-};
-meshInit* initData;
-
 struct EyePos {
     float angle = 0.0;
     float rad = 3.0;
@@ -50,10 +63,38 @@ struct Position {
 const aiScene *scene = NULL;
 aiVector3D scene_min, scene_max, scene_center;
 std::map<int, int> texIdMap;
+Skeleton skeleton;                  // Compiled joint hierarchy driven by the animation
+std::vector<int> channelJoints;     // Joint index for each animation channel
+AnimSampler animSampler;            // Key cursors for the animation
+BakedClip bakedClip;                // Pre-sampled animation, if baking is enabled
+CompressedClip compressedClip;      // Compressed animation keys, if compression is enabled
+CompressedSampler compressedSampler;
+std::vector<JointPose> pose;        // Pose of each animation channel for the current frame
+std::vector<BonePalette> bonePalettes;  // Skinning matrices for each mesh
+std::vector<SkinMesh> skinMeshes;   // Bind pose and packed bone influences for each mesh
+std::vector<std::vector<SkinChunk> > skinChunks;  // Vertex ranges skinned in parallel, per level of detail
+std::vector<MeshLod> meshLods;      // Levels of detail of each mesh, if --lod is given
+BoneBounds boneBounds;              // Per-bone boxes the animated bound of the model is taken from
+ViewerOptions options;
+ThreadPool* skinPool = NULL;
+std::vector<TextureImage> textureImages;  // Decoded by loadModel, uploaded by loadGLTextures
+RenderQueue renderQueue;   // Material table and mesh batches of the model
+FrameStats frameStats;
+FrameAllocCheck allocCheck;  // Steady-state frames must not allocate (with FRAME_ALLOC_CHECK)
+bool hudVisible = false;   // Toggled with 'h'
+StartupTimes startupTimes;
+SkinMode skinMode = SKIN_MODE_LINEAR;  // Toggled with 'd'
+Crowd crowd;               // Drawn instead of the single model if --crowd is given
 
 int tDuration;  // Animation duration in ticks
-int currTick = 0;
-float timeStep = 30.0;  // Animation time step in ms
+double animTime = 0;    // Playback time in ticks
+double poseTime = -1;   // animTime the model and the crowd are posed at, -1 if they need posing
+bool modelSkinned = false;  // Whether the meshes are skinned in the pose of poseTime
+bool modelVisible = true;   // Whether the model was in view at the last frame
+bool boundsValid = false;
+int modelLod = 0;       // Level of detail the single model is skinned and drawn at
+FrameClock frameClock;
+float timeStep = 30.0;  // Animation time step in ms (playback speed: one tick per timeStep)
 
 //------------Modify the following as needed----------------------
 float materialCol[4] = {0.5, 0.9, 0.9, 1};   //Default material colour (not used if model's colour is available)
@@ -61,181 +102,107 @@ bool replaceCol = false;                       //Change to 'true' to set the mod
 float lightPosn[4] = {0, 50, 50, 1};         //Default light's position
 bool twoSidedLight = false;                       //Change to 'true' to enable two-sided lighting
 
+string makePathRelative(char* path) {
+    string filename = strrchr(path, '/');
+    string relative = "./models/ArmyPilot" + filename;
+    return relative;
+}
+
 //-------Loads model data from file and creates a scene object----------
 bool loadModel(const char *fileName) {
-    scene = aiImportFile(fileName, aiProcessPreset_TargetRealtime_MaxQuality);
+    LoadClock::time_point start = LoadClock::now();
+    skinPool = new ThreadPool(options.numThreads);
+    scene = importScene(fileName, aiProcessPreset_TargetRealtime_MaxQuality, options.useCache);
     if (scene == NULL) exit(1);
+    startupTimes.modelImport = msSince(start);
+
+    LoadClock::time_point decodeStart = LoadClock::now();
+    textureImages = decodeSceneTextures(scene, makePathRelative, *skinPool);
+    startupTimes.textureDecode = msSince(decodeStart);
     printSceneInfo(scene);
 //    printMeshInfo(scene);
 //    printTreeInfo(scene->mRootNode);
 //    printBoneInfo(scene);
 //    printAnimInfo(scene);  //WARNING:  This may generate a lengthy output if the model has animation data
 
+    LoadClock::time_point setupStart = LoadClock::now();
     tDuration = scene->mAnimations[0]->mDuration;
-    initData = new meshInit[scene->mNumMeshes];
+    buildSkeleton(&skeleton, scene->mRootNode);
+    channelJoints = mapChannelsToJoints(skeleton, scene->mAnimations[0]);
+    initAnimSampler(&animSampler, scene->mAnimations[0]);
+    if (options.lod) {
+        buildSceneLods(&meshLods, scene, *skinPool);   // Reorders the vertices, so it comes first
+        printLodInfo(meshLods, scene);
+    }
+    bonePalettes.resize(scene->mNumMeshes);
+    skinMeshes.resize(scene->mNumMeshes);
     for (int meshId = 0; meshId < scene->mNumMeshes; meshId++) {
-        aiMesh* mesh = scene->mMeshes[meshId];
-        meshInit* initDataMesh = (initData + meshId);
-        initDataMesh->mNumVertices = mesh->mNumVertices;
-        initDataMesh->mVertices = new aiVector3D[mesh->mNumVertices];
-        initDataMesh->mNormals = new aiVector3D[mesh->mNumVertices];
-
-        for (int vertId = 0; vertId < mesh->mNumVertices; vertId++) {
-            initDataMesh->mVertices[vertId] = mesh->mVertices[vertId];
-            initDataMesh->mNormals[vertId] = mesh->mNormals[vertId];
-        }
+        buildBonePalette(&bonePalettes[meshId], skeleton, scene->mMeshes[meshId]);
+        buildSkinMesh(&skinMeshes[meshId], scene->mMeshes[meshId]);
     }
-
-    return true;
-}
-
-string makePathRelative(char* path) {
-    string filename = strrchr(path, '/');
-    string relative = "./models/ArmyPilot" + filename;
-    return relative;
-}
-
-//-------------Loads texture files using DevIL library-------------------------------
-void loadGLTextures(const aiScene *scene) {
-    /* initialization of DevIL */
-    ilInit();
-    if (scene->HasTextures()) {
-        std::cout << "Support for meshes with embedded textures is not implemented" << endl;
-        return;
+    skinChunks = buildLodSkinChunks(skinMeshes, meshLods);
+    buildBoneBounds(&boneBounds, skinMeshes, bonePalettes);
+    cout << "Skinning kernel: " << skinKernelName(skinKernel) << ", " << skinPool->size() << " thread(s), "
+         << skinChunks[0].size() << " chunks" << endl;
+
+    pose.resize(scene->mAnimations[0]->mNumChannels);
+    if (options.bakeRate > 0) {
+        bakeClip(&bakedClip, scene->mAnimations[0], options.bakeRate, *skinPool);
+        cout << "Baked " << bakedClip.numFrames << " frames x " << bakedClip.numChannels << " channels: "
+             << bakedClipBytes(bakedClip) / 1024.0 << " KB" << endl;
+    } else if (options.compress) {
+        size_t rawBytes = rawClipBytes(scene->mAnimations[0]);
+        compressClip(&compressedClip, scene->mAnimations[0]);
+        initCompressedSampler(&compressedSampler, &compressedClip);
+        releaseAnimationKeys(scene, 0);
+        cout << "Compressed animation: " << rawBytes / 1024.0 << " KB -> " << compressedClipBytes(compressedClip) / 1024.0
+             << " KB (" << (rawClipBytes(scene->mAnimations[0]) + compressedClipBytes(compressedClip)) / 1024.0
+             << " KB resident with the raw keys released)" << endl;
     }
 
-    /* scan scene's materials for textures */
-    /* Simplified version: Retrieves only the first texture with index 0 if present*/
-    for (unsigned int m = 0; m < scene->mNumMaterials; ++m) {
-        aiString path;  // filename
-
-        if (scene->mMaterials[m]->GetTexture(aiTextureType_DIFFUSE, 0, &path) == AI_SUCCESS) {
-            glEnable(GL_TEXTURE_2D);
-            ILuint imageId;
-            GLuint texId;
-            ilGenImages(1, &imageId);
-            glGenTextures(1, &texId);
-            texIdMap[m] = texId;   //store tex ID against material id in a hash map
-            ilBindImage(imageId); /* Binding of DevIL image name */
-            ilEnable(IL_ORIGIN_SET);
-            ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
-
-            string relativePath = makePathRelative(path.data);
-            char imagePath[relativePath.size() + 1];
-            strcpy(imagePath, relativePath.c_str());
-
-            if (ilLoadImage((ILstring) imagePath))   //if success
-            {
-                /* Convert image to RGBA */
-                ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE);
-
-                /* Create and load textures to OpenGL */
-                glBindTexture(GL_TEXTURE_2D, texId);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ilGetInteger(IL_IMAGE_WIDTH),
-                             ilGetInteger(IL_IMAGE_HEIGHT), 0, GL_RGBA, GL_UNSIGNED_BYTE,
-                             ilGetData());
-                glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-                cout << "Texture:" << imagePath << " successfully loaded." << endl;
-                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-                glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-                glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
-                glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
-            } else {
-                cout << "Couldn't load Image: " << imagePath << endl;
-            }
-            glDisable(GL_TEXTURE_2D);
-        }
-    }  //loop for material
+    startupTimes.setup = msSince(setupStart);
 
+    return true;
 }
 
-// ------A recursive function to traverse scene graph and render each mesh----------
-void render(const aiScene *sc, const aiNode *nd) {
-    aiMatrix4x4 m = nd->mTransformation;
-    aiMesh *mesh;
-    aiFace *face;
-    aiMaterial *mtl;
-    GLuint texId;
-    aiColor4D diffuse;
-    int meshIndex, materialIndex;
-
-    aiTransposeMatrix4(&m);   //Convert to column-major order
-    glPushMatrix();
-    glMultMatrixf((float *) &m);   //Multiply by the transformation matrix for this node
-
-    // Draw all meshes assigned to this node
-    for (int n = 0; n < nd->mNumMeshes; n++) {
-        meshIndex = nd->mMeshes[n];          //Get the mesh indices from the current node
-        mesh = scene->mMeshes[meshIndex];    //Using mesh index, get the mesh object
-
-        materialIndex = mesh->mMaterialIndex;  //Get material index attached to the mesh
-
-        if (mesh->HasTextureCoords(0)) {
-            glEnable(GL_TEXTURE_2D);
-            texId = texIdMap[materialIndex];
-            glBindTexture(GL_TEXTURE_2D, texId);
+//-------------Uploads the textures decoded by loadModel to OpenGL-------------------------------
+void loadGLTextures(const std::vector<TextureImage> &images) {
+    LoadClock::time_point start = LoadClock::now();
+    for (int i = 0; i < images.size(); i++) {
+        const TextureImage &image = images[i];
+        if (!image.ok) {
+            cout << "Couldn't load Image: " << image.path << endl;
+            continue;
         }
 
-        mtl = sc->mMaterials[materialIndex];
-        if (replaceCol)
-            glColor4fv(materialCol);   //User-defined colour
-        else if (AI_SUCCESS ==
-                 aiGetMaterialColor(mtl, AI_MATKEY_COLOR_DIFFUSE, &diffuse))  //Get material colour from model
-            glColor4f(diffuse.r, diffuse.g, diffuse.b, 1.0);
-        else
-            glColor4fv(materialCol);   //Default material colour
-
-
-        //Get the polygons from each mesh and draw them
-        for (int k = 0; k < mesh->mNumFaces; k++) {
-            face = &mesh->mFaces[k];
-            GLenum face_mode;
-
-            switch (face->mNumIndices) {
-                case 1:
-                    face_mode = GL_POINTS;
-                    break;
-                case 2:
-                    face_mode = GL_LINES;
-                    break;
-                case 3:
-                    face_mode = GL_TRIANGLES;
-                    break;
-                default:
-                    face_mode = GL_POLYGON;
-                    break;
-            }
-
-            glBegin(face_mode);
-
-            for (int i = 0; i < face->mNumIndices; i++) {
-                int vertexIndex = face->mIndices[i];
-
-                if (mesh->HasTextureCoords(0))
-                    glTexCoord2f(mesh->mTextureCoords[0][vertexIndex].x, mesh->mTextureCoords[0][vertexIndex].y);
-
-                if (mesh->HasVertexColors(0))
-                    glColor4fv((GLfloat *) &mesh->mColors[0][vertexIndex]);
-
-                //Assign texture coordinates here
-
-                if (mesh->HasNormals())
-                    glNormal3fv(&mesh->mNormals[vertexIndex].x);
-
-                glVertex3fv(&mesh->mVertices[vertexIndex].x);
-            }
-
-            glEnd();
-        }
+        glEnable(GL_TEXTURE_2D);
+        GLuint texId;
+        glGenTextures(1, &texId);
+        texIdMap[image.materialId] = texId;   //store tex ID against material id in a hash map
+
+        /* Create and load textures to OpenGL */
+        glBindTexture(GL_TEXTURE_2D, texId);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     &image.rgba[0]);
+        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+        cout << "Texture:" << image.path << " successfully loaded." << endl;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+        glDisable(GL_TEXTURE_2D);
     }
+    startupTimes.textureUpload = msSince(start);
+}
 
-    // Draw all children
-    for (int i = 0; i < nd->mNumChildren; i++)
-        render(sc, nd->mChildren[i]);
-
-    glPopMatrix();
+//-------Fits the viewport and the projection to the window or surface----------
+void reshape(int width, int height) {
+    glViewport(0, 0, width, height);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(FIELD_OF_VIEW, (double) width / max(height, 1), 0.01, 1000.0);
 }
 
 //--------------------OpenGL initialization------------------------
@@ -257,122 +224,190 @@ void initialise() {
     glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, white);
     glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 50);
     glColor4fv(materialCol);
+    initFrameStats(&frameStats, FRAME_STATS_FRAMES, options.stats);
+    LoadClock::time_point startupStart = LoadClock::now();
     loadModel("./models/ArmyPilot/ArmyPilot.x");            //<<<-------------Specify input file name here
-    loadGLTextures(scene);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(35, 1, 0.01, 1000.0);
+    loadGLTextures(textureImages);
+    textureImages.clear();   // Staging buffers are no longer needed
+    buildRenderQueue(&renderQueue, scene, texIdMap, materialCol, meshLods);
+    updateRenderQueue(scene, renderQueue);
+    if (options.crowdSize > 0) {
+        initCrowd(&crowd, scene, skeleton, skinMeshes, bonePalettes, skinChunks, boneBounds, renderQueue);
+        addCrowdClip(&crowd, scene->mAnimations[0], -1, &bakedClip, &compressedClip);
+        for (int a = 1; a < scene->mNumAnimations; a++) addCrowdClip(&crowd, scene->mAnimations[a]);
+        if (!options.cpuSkinning && enableCrowdGpuSkinning(&crowd))
+            cout << "Crowd skinning: vertex shader, one instanced draw per batch" << endl;
+        crowd.skinCache.budgetBytes = (size_t) max(options.skinCacheMB, 0) << 20;
+        spawnCrowd(&crowd, options.crowdSize, FLOOR_SIZE, options.crowdPhases);
+    }
+    startupTimes.total = msSince(startupStart);
+    printStartupTimes(startupTimes);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    reshape(viewport[2], viewport[3]);
 }
 
-void updateNodeMatrices(int tick) {
-    int index;
-    aiAnimation* anim = scene->mAnimations[0];
-    aiMatrix4x4 matPos, matRot, matProd;
-    aiMatrix3x3 matRot3;
+void updateNodeMatrices(double time) {
     aiNode* nd;
 
-    for (int i = 0; i < anim->mNumChannels; i++) {
-        matPos = aiMatrix4x4();
-        matRot = aiMatrix4x4();
-        aiNodeAnim* ndAnim = anim->mChannels[i];
-
-        index = ndAnim->mNumPositionKeys > 1 ? tick : 0;
-        aiVector3D posn = ndAnim->mPositionKeys[index].mValue;
-        matPos.Translation(posn, matPos);
+    double animTick = wrapAnimTime(time, tDuration);
+    if (bakedClip.numFrames > 0)
+        evaluateBakedPose(bakedClip, animTick, &pose[0]);
+    else if (compressedSampler.clip != NULL)
+        samplePose(&compressedSampler, animTick, &pose[0]);
+    else
+        samplePose(&animSampler, animTick, &pose[0]);
+
+    for (int i = 0; i < pose.size(); i++) {
+        if (channelJoints[i] < 0) continue;
+        nd = skeleton.nodes[channelJoints[i]];
+        nd->mTransformation = poseMatrix(pose[i]);
+    }
 
-        index = ndAnim->mNumRotationKeys > 1 ? tick : 0;
-        aiQuaternion rotn = ndAnim->mRotationKeys[index].mValue;
-        matRot3 = rotn.GetMatrix();
-        matRot = aiMatrix4x4(matRot3);
+    updateGlobalTransforms(&skeleton);
+    for (int meshId = 0; meshId < scene->mNumMeshes; meshId++)
+        updateBonePalette(&bonePalettes[meshId], skeleton);
+}
 
-        matProd = matPos * matRot;
-        nd = scene->mRootNode->FindNode(ndAnim->mNodeName);
-        nd->mTransformation = matProd;
-    }
+void transformVertices() {
+    skinMeshesParallel(*skinPool, skinChunks[modelLod], skinMeshes, bonePalettes, scene, skinMode);
+    updateRenderQueue(scene, renderQueue, modelLod);
 }
 
-aiMatrix4x4 addIgnoreIdentity(aiMatrix4x4 m1, aiMatrix4x4 m2) {
-    if (m1 == aiMatrix4x4()) {
-        return m2;
-    } else if (m2 == aiMatrix4x4()) {
-        return m1;
-    } else {
-        return m1 + m2;
-    }
+aiVector3D eyePosition() {
+    return aiVector3D(modelPos.x + eyePos.rad * sin(eyePos.angle * TO_RAD), eyePos.height,
+                      modelPos.z + eyePos.rad * cos(eyePos.angle * TO_RAD));
 }
 
-void transformVertices() {
-    for (int meshId = 0; meshId < scene->mNumMeshes; meshId++) {
-        aiMesh* mesh = scene->mMeshes[meshId];
-
-        // Declare and initialise sum arrays for vertex blending
-        aiMatrix4x4 vertexSums[mesh->mNumVertices];
-        aiMatrix4x4 normalSums[mesh->mNumVertices];
-        for (int i = 0; i < mesh->mNumVertices; i++) {
-            vertexSums[i] = aiMatrix4x4();
-            normalSums[i] = aiMatrix4x4();
-        }
+// Stands the model up, scales it to fit into a unit box and centres it
+void applyModelTransform() {
+    glTranslatef(0, -0.06, 0);
+    glRotatef(90, 1, 0, 0);          //First, rotate the model about x-axis if needed.
+
+    // scale the whole asset to fit into our view frustum
+    float tmp = scene_max.x - scene_min.x;
+    tmp = aisgl_max(scene_max.y - scene_min.y, tmp);
+    tmp = aisgl_max(scene_max.z - scene_min.z, tmp);
+    tmp = 1.f / tmp;
+    glScalef(tmp, tmp, tmp);
 
-        for (int boneId = 0; boneId < mesh->mNumBones; boneId++) {
-            aiBone* bone = mesh->mBones[boneId];
-            aiNode* node = scene->mRootNode->FindNode(bone->mName);
-            aiMatrix4x4 matrixProduct = bone->mOffsetMatrix;
+    float xc = (scene_min.x + scene_max.x) * 0.5;
+    float yc = (scene_min.y + scene_max.y) * 0.5;
+    float zc = (scene_min.z + scene_max.z) * 0.5;
+    // center the model
+    glTranslatef(-xc, -yc, -zc);
 
-            while (node != NULL) {
-                matrixProduct = node->mTransformation * matrixProduct;
-                node = node->mParent;
-            }
+    glRotatef(-13, 0, 1, 0);
+}
 
-            aiMatrix4x4 normalMatrix = aiMatrix4x4(matrixProduct);
-            normalMatrix.Inverse().Transpose();
-
-            for (int weightId = 0; weightId < bone->mNumWeights; weightId++) {
-                int vertexId = bone->mWeights[weightId].mVertexId;
-                vertexSums[vertexId] = addIgnoreIdentity(
-                        vertexSums[vertexId],
-                        matrixProduct * bone->mWeights[weightId].mWeight);
-                normalSums[vertexId] = addIgnoreIdentity(
-                        normalSums[vertexId],
-                        normalMatrix * bone->mWeights[weightId].mWeight);
-            }
-        }
+// Camera of the frame, looking at the model
+void applyViewTransform() {
+    aiVector3D eye = eyePosition();
+    gluLookAt(eye.x, eye.y, eye.z,
+            modelPos.x, modelPos.y, modelPos.z,
+            0, 1, 0);
+}
 
-        for (int vertexId = 0; vertexId < mesh->mNumVertices; vertexId++) {
-            aiVector3D vertex = (initData + meshId)->mVertices[vertexId];
-            aiVector3D normal = (initData + meshId)->mNormals[vertexId];
+// Camera the levels of detail are picked for. The model transformation
+// scales a character to one unit. Without --lod, level 0 is always picked.
+LodView currentLodView() {
+    LodView view;
+    if (meshLods.empty()) return view;
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    view.eye = eyePosition();
+    view.pixelsPerUnit = lodPixelsPerUnit(FIELD_OF_VIEW, viewport[3]);
+    return view;
+}
 
-            mesh->mVertices[vertexId] = vertexSums[vertexId] * vertex;
-            mesh->mNormals[vertexId] = normalSums[vertexId] * normal;
-        }
-    }
+// What the model and the crowd must be in view of to be skinned and drawn.
+// The model transformation needs the bounding box, so nothing is culled
+// until it is known.
+CullView currentCullView() {
+    CullView view;
+    if (!options.culling || !boundsValid) return view;
+    view.enabled = true;
+    view.frustum = glViewFrustum(applyViewTransform);
+    view.model = glTransformOf(applyModelTransform);
+    return view;
 }
 
-//----Timer callback for continuous rotation of the model about y-axis----
-void update(int value) {
-    updateNodeMatrices(currTick);
-    transformVertices();
-    if (currTick == 0) {
+// Whether the model is in view, with its bound taken from the bone
+// palettes of the current pose
+bool modelInView(const CullView &view) {
+    if (!view.enabled) return true;
+    BoundingBox bounds = posedModelBounds(boneBounds, renderQueue, bonePalettes, NULL);
+    return characterInView(view, bounds, aiVector3D(modelPos.x, modelPos.y, modelPos.z), 0.0f);
+}
+
+// Advances the animation and the model by elapsedMs of playback time.
+// The model is posed only if the time changed, and skinned only if it is in
+// view and its pose or level of detail changed. A crowd still poses the
+// single model once, for the bounding box that scales every instance; that
+// first pose is always skinned in full.
+void advanceFrame(double elapsedMs) {
+    FrameAllocScope allocScope(allocCheck, "update");
+    double ticks = elapsedMs / timeStep;
+    animTime += ticks;
+    LodView view = currentLodView();
+    CullView cullView = currentCullView();
+    bool singleModel = crowd.instances.empty() || !boundsValid;
+    int lod = crowd.instances.empty() && boundsValid ? selectLod(view, aiVector3D(modelPos.x, modelPos.y, modelPos.z)) : 0;
+    if (animTime != poseTime) {
+        if (singleModel) {
+            StageTimer timer(frameStats, STAGE_POSE);
+            updateNodeMatrices(animTime);
+            modelSkinned = false;
+        }
+        if (!crowd.instances.empty()) {
+            StageTimer timer(frameStats, STAGE_SKIN);
+            crowd.lodView = view;
+            crowd.cullView = cullView;
+            updateCrowd(&crowd, animTime, *skinPool, skinMode);
+        }
+        poseTime = animTime;
+    }
+    if (singleModel) {
+        StageTimer timer(frameStats, STAGE_BOUNDS);
+        modelVisible = modelInView(cullView);
+    }
+    if (singleModel && modelVisible && (!modelSkinned || lod != modelLod)) {
+        StageTimer timer(frameStats, STAGE_SKIN);
+        modelLod = lod;
+        transformVertices();
+        modelSkinned = true;
+    }
+    if (!boundsValid) {
+        StageTimer timer(frameStats, STAGE_BOUNDS);
         get_bounding_box(scene, &scene_min, &scene_max);
+        boundsValid = true;
     }
 
-    if (currTick >= tDuration) {
-        currTick = 0;
-    } else {
-        currTick++;
+    if (crowd.instances.empty()) {
+        modelPos.x += MOVE_SPEED * ticks;
+        if (modelPos.x > FLOOR_SIZE + TILE_SIZE) {
+            modelPos.x = -FLOOR_SIZE;
+        }
     }
+}
 
-    modelPos.x += MOVE_SPEED;
-    if (modelPos.x > FLOOR_SIZE + TILE_SIZE) {
-        modelPos.x = -FLOOR_SIZE;
-    }
+// Headless frames advance by one tick each, so their content doesn't depend on speed
+void advanceFixedStep() {
+    advanceFrame(timeStep);
+}
 
-    glutTimerFunc(timeStep, update, 0);
+//----Idle callback: advances by the wall-clock time since the previous frame----
+void idle() {
+    double elapsedMs = frameClockStep(&frameClock);
+    advanceFrame(elapsedMs);
+    if (!crowd.instances.empty()) reportCrowdFrame(&crowd, elapsedMs);
     glutPostRedisplay();
 }
 
 void special(int key, int x, int y) {
     const float CHANGE_VIEW_ANGLE = 2.0;
     const float RAD_INCR = 0.5;
+    restartFrameAllocCheck(&allocCheck);
 
     switch (key) {
         case GLUT_KEY_LEFT:
@@ -394,6 +429,7 @@ void special(int key, int x, int y) {
 
 void keyboard(unsigned char key, int x, int y) {
     const float MOVE_DISTANCE = 0.5;
+    restartFrameAllocCheck(&allocCheck);
 
     switch (key) {
         case ' ':
@@ -402,6 +438,30 @@ void keyboard(unsigned char key, int x, int y) {
         case 'x':
             eyePos.height -= MOVE_DISTANCE;
             break;
+        case 'd':
+            skinMode = skinMode == SKIN_MODE_LINEAR ? SKIN_MODE_DUAL_QUAT : SKIN_MODE_LINEAR;
+            poseTime = -1;
+            cout << "Skinning mode: " << skinModeName(skinMode) << endl;
+            break;
+        case 'b':
+            benchmarkSkinModes(*skinPool, skinChunks[0], skinMeshes, bonePalettes, scene, skinMode);
+            break;
+        case 'h':
+            hudVisible = !hudVisible;
+            setFrameStatsEnabled(&frameStats, hudVisible || options.stats);
+            break;
+        case 'p':
+            if (writeFrameStatsCsv(frameStats, "frame_stats.csv"))
+                cout << "Wrote " << frameStats.count << " frames to frame_stats.csv" << endl;
+            break;
+        case '+':
+        case '-':
+            if (!crowd.instances.empty()) {
+                int size = (int) crowd.instances.size();
+                spawnCrowd(&crowd, key == '+' ? size * 2 : max(size / 2, 1), FLOOR_SIZE, options.crowdPhases);
+                poseTime = -1;
+            }
+            break;
     }
 
     glutPostRedisplay();
@@ -436,59 +496,82 @@ void drawFloor() {
 //------The main display function---------
 //----The model is first drawn using a display list so that all GL commands are
 //    stored for subsequent display updates.
-void display() {
+void drawFrame() {
+    FrameAllocScope allocScope(allocCheck, "display");
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
-    gluLookAt(modelPos.x + eyePos.rad * sin(eyePos.angle * TO_RAD), eyePos.height, modelPos.z + eyePos.rad * cos(eyePos.angle * TO_RAD),
-            modelPos.x, modelPos.y, modelPos.z,
-            0, 1, 0);
+    applyViewTransform();
     glLightfv(GL_LIGHT0, GL_POSITION, lightPosn);
 
-    drawFloor();
-
-    glPushMatrix();
-    glTranslatef(modelPos.x, modelPos.y, modelPos.z);
-    glTranslatef(0, -0.06, 0);
-    glRotatef(90, 1, 0, 0);          //First, rotate the model about x-axis if needed.
-
-    // scale the whole asset to fit into our view frustum
-    float tmp = scene_max.x - scene_min.x;
-    tmp = aisgl_max(scene_max.y - scene_min.y, tmp);
-    tmp = aisgl_max(scene_max.z - scene_min.z, tmp);
-    tmp = 1.f / tmp;
-    glScalef(tmp, tmp, tmp);
+    {
+        StageTimer timer(frameStats, STAGE_FLOOR);
+        drawFloor();
+    }
 
-    float xc = (scene_min.x + scene_max.x) * 0.5;
-    float yc = (scene_min.y + scene_max.y) * 0.5;
-    float zc = (scene_min.z + scene_max.z) * 0.5;
-    // center the model
-    glTranslatef(-xc, -yc, -zc);
+    {
+        StageTimer timer(frameStats, STAGE_MODEL);
+        if (crowd.instances.empty() && modelVisible) {
+            glPushMatrix();
+            glTranslatef(modelPos.x, modelPos.y, modelPos.z);
+            applyModelTransform();
+            drawRenderQueue(renderQueue, false, replaceCol ? materialCol : NULL, modelLod);
+            glPopMatrix();
+        } else if (!crowd.instances.empty()) {
+            drawCrowd(&crowd, false, replaceCol ? materialCol : NULL, applyModelTransform, NULL);
+        }
+    }
 
-    glRotatef(-13, 0, 1, 0);
-    render(scene, scene->mRootNode);
-    glPopMatrix();
+    if (hudVisible) drawFrameStatsHud(frameStats, glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+    commitFrameStats(&frameStats);
+}
 
+void display() {
+    drawFrame();
     glutSwapBuffers();
 }
 
 
 int main(int argc, char **argv) {
-    glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH);
-    glutInitWindowSize(600, 600);
-    glutCreateWindow("Model Loader");
-    glutInitContextVersion(4, 2);
-    glutInitContextProfile(GLUT_CORE_PROFILE);
-
-    initialise();
-    glutDisplayFunc(display);
-    glutTimerFunc(timeStep, update, 0);
-    glutKeyboardFunc(keyboard);
-    glutSpecialFunc(special);
-    glutMainLoop();
-
-    aiReleaseImport(scene);
+    int status = 0;
+    if (headlessRequested(argc, argv)) {
+        options = parseOptions(argc, argv);
+        HeadlessContext context;
+        if (!createHeadlessContext(&context, options.width, options.height)) return 1;
+        initialise();
+        status = runHeadless(options, advanceFixedStep, drawFrame);
+        if (options.stats && writeFrameStatsCsv(frameStats, "frame_stats.csv"))
+            cout << "Wrote the last " << frameStats.count << " frames to frame_stats.csv" << endl;
+        releaseCrowd(&crowd);
+        destroyHeadlessContext(&context);
+    } else {
+        glutInit(&argc, argv);
+        options = parseOptions(argc, argv);
+        glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH);
+        glutInitWindowSize(600, 600);
+        glutCreateWindow("Model Loader");
+        if (glewInit() != GLEW_OK) {
+            cout << "Could not initialise GLEW" << endl;
+            return 1;
+        }
+        glutInitContextVersion(4, 2);
+        glutInitContextProfile(GLUT_CORE_PROFILE);
+
+        if (!setSwapInterval(options.unthrottled ? 0 : 1))
+            cout << "Swap interval control is not available; frame rate follows the driver default" << endl;
+
+        initialise();
+        glutDisplayFunc(display);
+        glutReshapeFunc(reshape);
+        glutIdleFunc(idle);
+        glutKeyboardFunc(keyboard);
+        glutSpecialFunc(special);
+        glutMainLoop();
+    }
+
+    delete skinPool;
+    releaseScene(scene);
+    return status;
 }
 
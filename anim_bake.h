@@ -0,0 +1,99 @@
+// ----------------------------------------------------------------------------
+// Baked animation clips
+//
+// A looping clip can be sampled once at load time at a fixed rate into one
+// contiguous buffer of joint poses indexed by [frame][channel]. Evaluating a
+// pose at runtime is then a copy of one frame, or a blend of two adjacent
+// frames, with no key searches. Each frame starts on a cache line so a pose
+// read touches only the lines of that frame.
+//-----------------------------------------------------------------------------
+
+#ifndef ANIM_BAKE_H
+#define ANIM_BAKE_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "anim_sampler.h"
+#include "thread_pool.h"
+
+#define BAKE_ALIGNMENT 64
+
+struct BakedClip {
+    int numFrames = 0;         // 0 if the clip is not baked
+    int numChannels = 0;
+    int frameStride = 0;       // Poses per frame, padded to a whole number of cache lines
+    double samplesPerTick = 0;
+    std::vector<unsigned char> storage;  // Over-allocated so frames can be aligned inside it
+};
+
+// ----------------------------------------------------------------------------
+JointPose *bakedFrame(BakedClip &clip, int frame) {
+    uintptr_t base = ((uintptr_t) &clip.storage[0] + BAKE_ALIGNMENT - 1) & ~(uintptr_t) (BAKE_ALIGNMENT - 1);
+    return (JointPose *) base + frame * clip.frameStride;
+}
+
+// ----------------------------------------------------------------------------
+size_t bakedClipBytes(const BakedClip &clip) {
+    return clip.storage.size();
+}
+
+// ----------------------------------------------------------------------------
+// Samples every channel of anim at samplesPerTick over [0, mDuration].
+// Channels are independent, so they are baked in parallel.
+void bakeClip(BakedClip *clip, const aiAnimation *anim, double samplesPerTick, ThreadPool &pool) {
+    clip->numChannels = anim->mNumChannels;
+    clip->samplesPerTick = samplesPerTick;
+    clip->numFrames = (int) std::floor(anim->mDuration * samplesPerTick) + 1;
+
+    // Smallest pose count that is a whole number of cache lines
+    int posesPerBlock = 1;
+    while (posesPerBlock * sizeof(JointPose) % BAKE_ALIGNMENT != 0) posesPerBlock++;
+    clip->frameStride = (clip->numChannels + posesPerBlock - 1) / posesPerBlock * posesPerBlock;
+    clip->storage.assign(clip->numFrames * clip->frameStride * sizeof(JointPose) + BAKE_ALIGNMENT, 0);
+
+    AnimSampler sampler;
+    initAnimSampler(&sampler, anim);
+    pool.parallelFor(clip->numChannels, [&](int channelId) {
+        for (int f = 0; f < clip->numFrames; f++) {
+            double time = f / samplesPerTick;
+            JointPose &pose = bakedFrame(*clip, f)[channelId];
+            pose.position = samplePosition(&sampler, channelId, time);
+            pose.rotation = sampleRotation(&sampler, channelId, time);
+            pose.scale = sampleScaling(&sampler, channelId, time);
+        }
+    });
+}
+
+// ----------------------------------------------------------------------------
+// Evaluates the pose at time (in ticks, within [0, mDuration]) into pose
+void evaluateBakedPose(BakedClip &clip, double time, JointPose *pose) {
+    double frame = time * clip.samplesPerTick;
+    int f0 = (int) std::floor(frame);
+    if (f0 < 0) f0 = 0;
+    if (f0 >= clip.numFrames - 1) {
+        f0 = clip.numFrames - 1;
+        frame = f0;
+    }
+    const JointPose *a = bakedFrame(clip, f0);
+    float t = (float) (frame - f0);
+    if (t <= 0.0f) {
+        memcpy(pose, a, clip.numChannels * sizeof(JointPose));
+        return;
+    }
+
+    // Adjacent frames are close together, so a normalised lerp is enough for rotations
+    const JointPose *b = bakedFrame(clip, f0 + 1);
+    for (int i = 0; i < clip.numChannels; i++) {
+        const aiQuaternion &qa = a[i].rotation, &qb = b[i].rotation;
+        float tb = qa.w * qb.w + qa.x * qb.x + qa.y * qb.y + qa.z * qb.z < 0.0f ? -t : t;
+        aiQuaternion q(qa.w * (1.0f - t) + qb.w * tb, qa.x * (1.0f - t) + qb.x * tb,
+                       qa.y * (1.0f - t) + qb.y * tb, qa.z * (1.0f - t) + qb.z * tb);
+        pose[i].rotation = q.Normalize();
+        pose[i].position = a[i].position + (b[i].position - a[i].position) * t;
+        pose[i].scale = a[i].scale + (b[i].scale - a[i].scale) * t;
+    }
+}
+
+#endif
@@ -0,0 +1,292 @@
+// ----------------------------------------------------------------------------
+// Compressed animation clips
+//
+// Raw assimp keys take 24 bytes each (a double time and three or four floats)
+// and mocap clips keep a key per frame even on joints that barely move. A
+// compressed clip stores, per channel:
+//   - only the keys needed to reproduce the others within a tolerance under
+//     the sampler's own interpolation (lerp / slerp),
+//   - rotations as 48-bit "smallest three" quaternions: the index of the
+//     largest component and the other three in 15 bits each,
+//   - positions as 16 bits per component relative to the channel's range,
+//   - float key times.
+// Both key types are 12 bytes. Keys are decoded on the fly while sampling,
+// using the same cursors and interpolation as anim_sampler.h. Key reduction
+// looks at most CLIP_REDUCE_WINDOW keys ahead of the last kept key, so it
+// stays linear in the length of long mocap channels.
+// The raw keys are only a saving once released: the viewers drop them with
+// releaseAnimationKeys (scene_cache.h) after compressing.
+//-----------------------------------------------------------------------------
+
+#ifndef ANIM_COMPRESS_H
+#define ANIM_COMPRESS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "anim_sampler.h"
+
+#define CLIP_POSITION_TOLERANCE 1e-4f  // Position error, as a fraction of the clip's largest channel range
+#define CLIP_ROTATION_TOLERANCE 1e-3f  // Rotation error in radians
+#define CLIP_REDUCE_WINDOW 64          // Most keys dropped between two kept keys
+
+struct PackedVectorKey {
+    float mTime;
+    uint16_t value[3];   // Position relative to the channel's range
+};
+
+struct PackedQuatKey {
+    float mTime;
+    uint16_t value[3];   // Smallest three quaternion
+};
+
+struct CompressedChannel {
+    aiVector3D positionMin, positionRange;
+    std::vector<PackedVectorKey> positionKeys;
+    std::vector<PackedQuatKey> rotationKeys;
+    std::vector<aiVectorKey> scalingKeys;   // Almost always a single key, so kept as is
+};
+
+struct CompressedClip {
+    double duration = 0;
+    std::vector<CompressedChannel> channels;
+};
+
+struct CompressedSampler {
+    const CompressedClip *clip = NULL;
+    std::vector<ChannelCursor> cursors;  // One per channel of clip
+};
+
+// ----------------------------------------------------------------------------
+// Smallest three encoding: bits 0-1 hold the index of the largest component
+// (which is made positive and recovered from the unit length), bits 2-46 the
+// other three components, 15 bits each, mapped from [-1/sqrt(2), 1/sqrt(2)]
+void packQuaternion(aiQuaternion q, uint16_t *out) {
+    q.Normalize();
+    float c[4] = {q.w, q.x, q.y, q.z};
+    int largest = 0;
+    for (int i = 1; i < 4; i++)
+        if (std::fabs(c[i]) > std::fabs(c[largest])) largest = i;
+    float sign = c[largest] < 0.0f ? -1.0f : 1.0f;
+
+    uint64_t bits = largest;
+    int shift = 2;
+    for (int i = 0; i < 4; i++) {
+        if (i == largest) continue;
+        float v = (sign * c[i] * 0.70710678f + 0.5f) * 32767.0f;
+        uint64_t q15 = v <= 0.0f ? 0 : v >= 32767.0f ? 32767 : (uint64_t) (v + 0.5f);
+        bits |= q15 << shift;
+        shift += 15;
+    }
+    out[0] = (uint16_t) bits;
+    out[1] = (uint16_t) (bits >> 16);
+    out[2] = (uint16_t) (bits >> 32);
+}
+
+// ----------------------------------------------------------------------------
+aiQuaternion unpackQuaternion(const uint16_t *in) {
+    uint64_t bits = (uint64_t) in[0] | (uint64_t) in[1] << 16 | (uint64_t) in[2] << 32;
+    int largest = (int) (bits & 3);
+    float c[4], sumSq = 0.0f;
+    int shift = 2;
+    for (int i = 0; i < 4; i++) {
+        if (i == largest) continue;
+        c[i] = (((bits >> shift) & 32767) / 32767.0f - 0.5f) * 1.41421356f;
+        sumSq += c[i] * c[i];
+        shift += 15;
+    }
+    c[largest] = std::sqrt(std::max(0.0f, 1.0f - sumSq));
+    return aiQuaternion(c[0], c[1], c[2], c[3]);
+}
+
+// ----------------------------------------------------------------------------
+void packPosition(const aiVector3D &v, const aiVector3D &min, const aiVector3D &range, uint16_t *out) {
+    for (int i = 0; i < 3; i++) {
+        float t = range[i] > 0.0f ? (v[i] - min[i]) / range[i] : 0.0f;
+        out[i] = (uint16_t) (std::min(std::max(t, 0.0f), 1.0f) * 65535.0f + 0.5f);
+    }
+}
+
+// ----------------------------------------------------------------------------
+aiVector3D unpackPosition(const uint16_t *in, const aiVector3D &min, const aiVector3D &range) {
+    return aiVector3D(min.x + in[0] * (range.x / 65535.0f), min.y + in[1] * (range.y / 65535.0f),
+                      min.z + in[2] * (range.z / 65535.0f));
+}
+
+// ----------------------------------------------------------------------------
+// Value of the interpolation between keys a and b at time, as the sampler computes it
+aiVector3D interpolateKeys(const aiVectorKey &a, const aiVectorKey &b, double time) {
+    if (b.mTime <= a.mTime) return a.mValue;
+    return a.mValue + (b.mValue - a.mValue) * (float) ((time - a.mTime) / (b.mTime - a.mTime));
+}
+
+aiQuaternion interpolateKeys(const aiQuatKey &a, const aiQuatKey &b, double time) {
+    if (b.mTime <= a.mTime) return a.mValue;
+    aiQuaternion q;
+    aiQuaternion::Interpolate(q, a.mValue, b.mValue, (float) ((time - a.mTime) / (b.mTime - a.mTime)));
+    return q;
+}
+
+// ----------------------------------------------------------------------------
+float valueError(const aiVector3D &a, const aiVector3D &b) {
+    return (a - b).Length();
+}
+
+// Angle between two rotations, from the chord between them (which, unlike the
+// dot product, stays precise for the small angles compared here)
+float valueError(aiQuaternion a, aiQuaternion b) {
+    a.Normalize();
+    b.Normalize();
+    float sign = a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z < 0.0f ? -1.0f : 1.0f;
+    float dw = a.w - sign * b.w, dx = a.x - sign * b.x, dy = a.y - sign * b.y, dz = a.z - sign * b.z;
+    float chord = std::sqrt(dw * dw + dx * dx + dy * dy + dz * dz);
+    return 4.0f * std::asin(std::min(0.5f * chord, 1.0f));
+}
+
+// ----------------------------------------------------------------------------
+// Returns the indices of the keys to keep: the first and last, plus each key
+// where interpolating from the previous kept key no longer reproduces every
+// key in between within tolerance, or that is CLIP_REDUCE_WINDOW keys past it
+template <typename Key>
+std::vector<int> reduceKeys(const Key *keys, int numKeys, float tolerance) {
+    std::vector<int> kept(1, 0);
+
+    // A channel that holds still needs only one key
+    bool constant = true;
+    for (int k = 1; k < numKeys && constant; k++)
+        constant = valueError(keys[0].mValue, keys[k].mValue) <= tolerance;
+    if (constant) return kept;
+
+    int anchor = 0;
+    for (int end = 2; end < numKeys; end++) {
+        bool fits = end - anchor <= CLIP_REDUCE_WINDOW;
+        for (int k = anchor + 1; k < end && fits; k++)
+            fits = valueError(interpolateKeys(keys[anchor], keys[end], keys[k].mTime), keys[k].mValue) <= tolerance;
+        if (!fits) {
+            anchor = end - 1;
+            kept.push_back(anchor);
+        }
+    }
+    kept.push_back(numKeys - 1);
+    return kept;
+}
+
+// ----------------------------------------------------------------------------
+void compressClip(CompressedClip *clip, const aiAnimation *anim) {
+    clip->duration = anim->mDuration;
+    clip->channels.resize(anim->mNumChannels);
+
+    // Position tolerance scales with the clip's largest channel range
+    float maxRange = 0.0f;
+    for (int i = 0; i < anim->mNumChannels; i++) {
+        const aiNodeAnim *ch = anim->mChannels[i];
+        if (ch->mNumPositionKeys == 0) continue;
+        aiVector3D lo = ch->mPositionKeys[0].mValue, hi = lo;
+        for (int k = 1; k < ch->mNumPositionKeys; k++) {
+            const aiVector3D &v = ch->mPositionKeys[k].mValue;
+            lo = aiVector3D(std::min(lo.x, v.x), std::min(lo.y, v.y), std::min(lo.z, v.z));
+            hi = aiVector3D(std::max(hi.x, v.x), std::max(hi.y, v.y), std::max(hi.z, v.z));
+        }
+        clip->channels[i].positionMin = lo;
+        clip->channels[i].positionRange = hi - lo;
+        maxRange = std::max(maxRange, (hi - lo).Length());
+    }
+    float positionTolerance = CLIP_POSITION_TOLERANCE * maxRange;
+
+    for (int i = 0; i < anim->mNumChannels; i++) {
+        const aiNodeAnim *ch = anim->mChannels[i];
+        CompressedChannel &out = clip->channels[i];
+
+        std::vector<int> kept = reduceKeys(ch->mPositionKeys, ch->mNumPositionKeys, positionTolerance);
+        out.positionKeys.resize(ch->mNumPositionKeys > 0 ? kept.size() : 0);
+        for (int k = 0; k < out.positionKeys.size(); k++) {
+            const aiVectorKey &key = ch->mPositionKeys[kept[k]];
+            out.positionKeys[k].mTime = (float) key.mTime;
+            packPosition(key.mValue, out.positionMin, out.positionRange, out.positionKeys[k].value);
+        }
+
+        kept = reduceKeys(ch->mRotationKeys, ch->mNumRotationKeys, CLIP_ROTATION_TOLERANCE);
+        out.rotationKeys.resize(ch->mNumRotationKeys > 0 ? kept.size() : 0);
+        for (int k = 0; k < out.rotationKeys.size(); k++) {
+            const aiQuatKey &key = ch->mRotationKeys[kept[k]];
+            out.rotationKeys[k].mTime = (float) key.mTime;
+            packQuaternion(key.mValue, out.rotationKeys[k].value);
+        }
+
+        kept = reduceKeys(ch->mScalingKeys, ch->mNumScalingKeys, positionTolerance);
+        out.scalingKeys.resize(ch->mNumScalingKeys > 0 ? kept.size() : 0);
+        for (int k = 0; k < out.scalingKeys.size(); k++)
+            out.scalingKeys[k] = ch->mScalingKeys[kept[k]];
+    }
+}
+
+// ----------------------------------------------------------------------------
+size_t rawClipBytes(const aiAnimation *anim) {
+    size_t bytes = 0;
+    for (int i = 0; i < anim->mNumChannels; i++) {
+        const aiNodeAnim *ch = anim->mChannels[i];
+        bytes += sizeof(aiNodeAnim) + (ch->mNumPositionKeys + ch->mNumScalingKeys) * sizeof(aiVectorKey)
+                 + ch->mNumRotationKeys * sizeof(aiQuatKey);
+    }
+    return bytes;
+}
+
+// ----------------------------------------------------------------------------
+size_t compressedClipBytes(const CompressedClip &clip) {
+    size_t bytes = 0;
+    for (int i = 0; i < clip.channels.size(); i++) {
+        const CompressedChannel &ch = clip.channels[i];
+        bytes += sizeof(CompressedChannel) + ch.positionKeys.size() * sizeof(PackedVectorKey)
+                 + ch.rotationKeys.size() * sizeof(PackedQuatKey) + ch.scalingKeys.size() * sizeof(aiVectorKey);
+    }
+    return bytes;
+}
+
+// ----------------------------------------------------------------------------
+void initCompressedSampler(CompressedSampler *sampler, const CompressedClip *clip) {
+    sampler->clip = clip;
+    sampler->cursors.assign(clip->channels.size(), ChannelCursor());
+}
+
+// ----------------------------------------------------------------------------
+// Samples every channel of the compressed clip into pose (one entry per channel)
+void samplePose(CompressedSampler *sampler, double time, JointPose *pose) {
+    for (int i = 0; i < sampler->clip->channels.size(); i++) {
+        const CompressedChannel &ch = sampler->clip->channels[i];
+        ChannelCursor &cursor = sampler->cursors[i];
+
+        int n = (int) ch.positionKeys.size();
+        if (n == 0) {
+            pose[i].position = aiVector3D(0.0f, 0.0f, 0.0f);
+        } else {
+            const PackedVectorKey *keys = &ch.positionKeys[0];
+            int k = findKey(keys, n, time, &cursor.position);
+            pose[i].position = unpackPosition(keys[k].value, ch.positionMin, ch.positionRange);
+            if (k + 1 < n) {
+                aiVector3D next = unpackPosition(keys[k + 1].value, ch.positionMin, ch.positionRange);
+                pose[i].position += (next - pose[i].position) * keyFactor(keys, k, time);
+            }
+        }
+
+        n = (int) ch.rotationKeys.size();
+        if (n == 0) {
+            pose[i].rotation = aiQuaternion();
+        } else {
+            const PackedQuatKey *keys = &ch.rotationKeys[0];
+            int k = findKey(keys, n, time, &cursor.rotation);
+            pose[i].rotation = unpackQuaternion(keys[k].value);
+            if (k + 1 < n) {
+                aiQuaternion start = pose[i].rotation;
+                aiQuaternion::Interpolate(pose[i].rotation, start, unpackQuaternion(keys[k + 1].value),
+                                          keyFactor(keys, k, time));
+            }
+        }
+
+        n = (int) ch.scalingKeys.size();
+        pose[i].scale = n == 0 ? aiVector3D(1.0f, 1.0f, 1.0f)
+                               : sampleVectorKeys(&ch.scalingKeys[0], n, time, &cursor.scaling);
+    }
+}
+
+#endif
@@ -0,0 +1,146 @@
+// ----------------------------------------------------------------------------
+// Keyframe sampler
+//
+// Samples position, rotation and scaling keys of an animation at any
+// (fractional) time, interpolating between the surrounding keys. Each channel
+// keeps a cursor to the key it last used; during forward playback the next
+// sample is at most a key or two further on, so lookups are amortised O(1).
+// When time jumps (looping, seeking, switching clips) the key is found by a
+// binary search instead of a scan.
+//-----------------------------------------------------------------------------
+
+#ifndef ANIM_SAMPLER_H
+#define ANIM_SAMPLER_H
+
+#include <cmath>
+#include <vector>
+#include <assimp/scene.h>
+
+#define CURSOR_MAX_STEPS 2   // Keys to step forward before falling back to binary search
+
+// Local transform of the joint driven by one channel
+struct JointPose {
+    aiVector3D position;
+    aiQuaternion rotation;
+    aiVector3D scale;
+};
+
+struct ChannelCursor {
+    int position = 0;
+    int rotation = 0;
+    int scaling = 0;
+};
+
+struct AnimSampler {
+    const aiAnimation *anim = NULL;
+    std::vector<ChannelCursor> cursors;  // One per channel of anim
+};
+
+// ----------------------------------------------------------------------------
+void initAnimSampler(AnimSampler *sampler, const aiAnimation *anim) {
+    sampler->anim = anim;
+    sampler->cursors.assign(anim->mNumChannels, ChannelCursor());
+}
+
+// ----------------------------------------------------------------------------
+// Wraps time into [0, duration), e.g. to loop an animation
+double wrapAnimTime(double time, double duration) {
+    if (duration <= 0.0) return 0.0;
+    time = std::fmod(time, duration);
+    return time < 0.0 ? time + duration : time;
+}
+
+// ----------------------------------------------------------------------------
+// Returns the index of the last key at or before time (0 if time precedes all
+// keys), starting from the key found by the previous call
+template <typename Key>
+int findKey(const Key *keys, int numKeys, double time, int *cursor) {
+    int i = *cursor;
+    if (i >= numKeys || keys[i].mTime > time) {
+        i = -1;
+    } else {
+        for (int step = 0; step < CURSOR_MAX_STEPS && i + 1 < numKeys && keys[i + 1].mTime <= time; step++) i++;
+        if (i + 1 < numKeys && keys[i + 1].mTime <= time) i = -1;
+    }
+
+    if (i < 0) {
+        int lo = 0, hi = numKeys - 1;
+        while (lo < hi) {
+            int mid = (lo + hi + 1) / 2;
+            if (keys[mid].mTime <= time) lo = mid;
+            else hi = mid - 1;
+        }
+        i = lo;
+    }
+
+    *cursor = i;
+    return i;
+}
+
+// ----------------------------------------------------------------------------
+// Interpolation factor of time between key i and the next one, clamped to [0, 1]
+template <typename Key>
+float keyFactor(const Key *keys, int i, double time) {
+    double span = keys[i + 1].mTime - keys[i].mTime;
+    if (span <= 0.0 || time <= keys[i].mTime) return 0.0f;
+    if (time >= keys[i + 1].mTime) return 1.0f;
+    return (float) ((time - keys[i].mTime) / span);
+}
+
+// ----------------------------------------------------------------------------
+aiVector3D sampleVectorKeys(const aiVectorKey *keys, int numKeys, double time, int *cursor) {
+    int i = findKey(keys, numKeys, time, cursor);
+    if (i + 1 >= numKeys) return keys[i].mValue;
+    float t = keyFactor(keys, i, time);
+    return keys[i].mValue + (keys[i + 1].mValue - keys[i].mValue) * t;
+}
+
+// ----------------------------------------------------------------------------
+aiQuaternion sampleQuatKeys(const aiQuatKey *keys, int numKeys, double time, int *cursor) {
+    int i = findKey(keys, numKeys, time, cursor);
+    if (i + 1 >= numKeys) return keys[i].mValue;
+    aiQuaternion rotn;
+    aiQuaternion::Interpolate(rotn, keys[i].mValue, keys[i + 1].mValue, keyFactor(keys, i, time));
+    return rotn;
+}
+
+// ----------------------------------------------------------------------------
+aiVector3D samplePosition(AnimSampler *sampler, int channelId, double time) {
+    const aiNodeAnim *channel = sampler->anim->mChannels[channelId];
+    if (channel->mNumPositionKeys == 0) return aiVector3D(0.0f, 0.0f, 0.0f);
+    return sampleVectorKeys(channel->mPositionKeys, channel->mNumPositionKeys, time,
+                            &sampler->cursors[channelId].position);
+}
+
+// ----------------------------------------------------------------------------
+aiQuaternion sampleRotation(AnimSampler *sampler, int channelId, double time) {
+    const aiNodeAnim *channel = sampler->anim->mChannels[channelId];
+    if (channel->mNumRotationKeys == 0) return aiQuaternion();
+    return sampleQuatKeys(channel->mRotationKeys, channel->mNumRotationKeys, time,
+                          &sampler->cursors[channelId].rotation);
+}
+
+// ----------------------------------------------------------------------------
+aiVector3D sampleScaling(AnimSampler *sampler, int channelId, double time) {
+    const aiNodeAnim *channel = sampler->anim->mChannels[channelId];
+    if (channel->mNumScalingKeys == 0) return aiVector3D(1.0f, 1.0f, 1.0f);
+    return sampleVectorKeys(channel->mScalingKeys, channel->mNumScalingKeys, time,
+                            &sampler->cursors[channelId].scaling);
+}
+
+// ----------------------------------------------------------------------------
+// Samples every channel of the animation into pose (one entry per channel)
+void samplePose(AnimSampler *sampler, double time, JointPose *pose) {
+    for (int i = 0; i < sampler->anim->mNumChannels; i++) {
+        pose[i].position = samplePosition(sampler, i, time);
+        pose[i].rotation = sampleRotation(sampler, i, time);
+        pose[i].scale = sampleScaling(sampler, i, time);
+    }
+}
+
+// ----------------------------------------------------------------------------
+aiMatrix4x4 poseMatrix(const JointPose &pose) {
+    return aiMatrix4x4(pose.scale, pose.rotation, pose.position);
+}
+
+#endif
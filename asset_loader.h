@@ -0,0 +1,118 @@
+// ----------------------------------------------------------------------------
+// Startup asset loading
+//
+// Texture files are read on the worker pool and decoded to RGBA staging
+// buffers off the GL thread, so only the glTexImage2D upload remains on it.
+// DevIL keeps global state (the bound image), so its decode calls are
+// serialised by a mutex; file reads and copying out of DevIL run in
+// parallel. The viewers also import their second (animation) scene on a
+// separate thread while the model scene is imported and its textures decoded.
+//-----------------------------------------------------------------------------
+
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <IL/il.h>
+#include <assimp/scene.h>
+#include "thread_pool.h"
+
+typedef std::chrono::high_resolution_clock LoadClock;
+
+// Decoded texture, waiting to be uploaded on the GL thread
+struct TextureImage {
+    int materialId;
+    std::string path;
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> rgba;
+    bool ok = false;
+};
+
+// Startup time breakdown in ms
+struct StartupTimes {
+    double modelImport = 0;
+    double animImport = 0;      // Overlapped with the model import and texture decoding
+    double textureDecode = 0;
+    double setup = 0;           // Skeleton, skinning and animation preparation
+    double textureUpload = 0;
+    double total = 0;
+};
+
+std::mutex devilMutex;
+
+// ----------------------------------------------------------------------------
+double msSince(LoadClock::time_point start) {
+    return std::chrono::duration<double, std::milli>(LoadClock::now() - start).count();
+}
+
+// ----------------------------------------------------------------------------
+void printStartupTimes(const StartupTimes &times) {
+    std::cout << "Startup: model import " << times.modelImport << " ms";
+    if (times.animImport > 0) std::cout << ", animation import " << times.animImport << " ms (concurrent)";
+    std::cout << ", texture decode " << times.textureDecode << " ms, setup " << times.setup
+              << " ms, texture upload " << times.textureUpload << " ms, total " << times.total << " ms" << std::endl;
+}
+
+// ----------------------------------------------------------------------------
+void decodeTexture(TextureImage *image) {
+    std::ifstream file(image->path.c_str(), std::ios::binary);
+    if (!file) return;
+    std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (bytes.empty()) return;
+
+    std::lock_guard<std::mutex> lock(devilMutex);
+    ILuint imageId;
+    ilGenImages(1, &imageId);
+    ilBindImage(imageId);
+    std::vector<char> name(image->path.begin(), image->path.end());
+    name.push_back('\0');
+    if (ilLoadL(ilTypeFromExt((ILstring) &name[0]), &bytes[0], (ILuint) bytes.size())
+        && ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE)) {
+        image->width = ilGetInteger(IL_IMAGE_WIDTH);
+        image->height = ilGetInteger(IL_IMAGE_HEIGHT);
+        image->rgba.assign(ilGetData(), ilGetData() + image->width * image->height * 4);
+        image->ok = true;
+    }
+    ilDeleteImages(1, &imageId);
+}
+
+// ----------------------------------------------------------------------------
+// Decodes the first diffuse texture of every material of the scene.
+// resolvePath maps a material's texture path to a file to load.
+std::vector<TextureImage> decodeSceneTextures(const aiScene *scene, std::string (*resolvePath)(char *),
+                                              ThreadPool &pool) {
+    std::vector<TextureImage> images;
+    if (scene->HasTextures()) {
+        std::cout << "Support for meshes with embedded textures is not implemented" << std::endl;
+        return images;
+    }
+
+    for (unsigned int m = 0; m < scene->mNumMaterials; ++m) {
+        aiString path;
+        if (scene->mMaterials[m]->GetTexture(aiTextureType_DIFFUSE, 0, &path) == AI_SUCCESS) {
+            TextureImage image;
+            image.materialId = m;
+            image.path = resolvePath(path.data);
+            images.push_back(image);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(devilMutex);
+        ilInit();
+        ilEnable(IL_ORIGIN_SET);
+        ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
+    }
+    pool.parallelFor((int) images.size(), [&](int i) { decodeTexture(&images[i]); });
+    return images;
+}
+
+#endif
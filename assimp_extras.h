@@ -99,7 +99,7 @@ void printMeshInfo(const aiScene *scene) {
 void printTreeInfo(const aiNode *node) {
     int numMesh = node->mNumMeshes;
     const char *parentName;
-    float *mat = new float[16];
+    const float *mat;
     if (node->mParent != NULL) parentName = (node->mParent->mName).C_Str();
     else parentName = "NO PARENT";
     cout << "==================== Node Data ===========================" << endl;
@@ -111,7 +111,7 @@ void printTreeInfo(const aiNode *node) {
         cout << endl;
     }
     cout << "Transformation:  ";
-    mat = (float *) &(node->mTransformation.a1);
+    mat = &(node->mTransformation.a1);
     for (int n = 0; n < 16; ++n) cout << mat[n] << " ";
     cout << endl;
 
@@ -121,7 +121,7 @@ void printTreeInfo(const aiNode *node) {
 
 // ----------------------------------------------------------------------------
 void printBoneInfo(const aiScene *scene) {
-    float *mat = new float[16];
+    const float *mat;
     cout << "==================== Bone Data ===========================" << endl;
     int nd = scene->mNumMeshes;
     for (int n = 0; n < scene->mNumMeshes; ++n) {
@@ -144,8 +144,8 @@ void printBoneInfo(const aiScene *scene) {
 
 // ----------------------------------------------------------------------------
 void printAnimInfo(const aiScene *scene) {
-    float *pos = new float[3];
-    float *quat = new float[4];
+    const float *pos;
+    const float *quat;
     if (scene != NULL) {
         cout << "==================== Animation Data ===========================" << endl;
         cout << "Number of animations = " << scene->mNumAnimations << endl;
@@ -162,13 +162,13 @@ void printAnimInfo(const aiScene *scene) {
                      ndAnim->mNumRotationKeys << " nsclKeys = " << ndAnim->mNumScalingKeys << endl;
                 for (int k = 0; k < ndAnim->mNumPositionKeys; k++) {
                     aiVectorKey posKey = ndAnim->mPositionKeys[k];    //Note: Does not return a pointer
-                    pos = (float *) &posKey.mValue;
+                    pos = &posKey.mValue.x;
                     cout << "        posKey " << k << ":  Time = " << posKey.mTime << " Value = " << pos[0] << " "
                          << pos[1] << " " << pos[2] << endl;
                 }
                 for (int k = 0; k < ndAnim->mNumRotationKeys; k++) {
                     aiQuatKey rotnKey = ndAnim->mRotationKeys[k];    //Note: Does not return a pointer
-                    quat = (float *) &rotnKey.mValue;
+                    quat = &rotnKey.mValue.w;
                     cout << "        rotnKey " << k << ":  Time = " << rotnKey.mTime << " Value = " << quat[0] << " " <<
                          quat[1] << " " << quat[2] << " " << quat[3] << endl;
                 }
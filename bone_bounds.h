@@ -0,0 +1,242 @@
+// ----------------------------------------------------------------------------
+// Animated bounds from per-bone boxes, and view frustum culling
+//
+// At load time every vertex is added to the box of each bone that influences
+// it, in the bind space the bone's skinning matrix maps from. Linear blend
+// skinning moves a vertex to an average of its bones' transformations of it,
+// with weights summing to one, so the skinned vertex lies inside the union of
+// its bones' boxes, each transformed by the bone's skinning matrix. The bound
+// of a pose then costs one box transformation per bone, whatever the number
+// of vertices. Dual quaternion skinning can push a vertex a little outside
+// that union where a joint bends; the margin added to every box covers it.
+//
+// A character is culled when neither its bound nor that of its planar shadow
+// intersects the view frustum, whose planes are taken from the GL projection
+// and camera matrices.
+//-----------------------------------------------------------------------------
+
+#ifndef BONE_BOUNDS_H
+#define BONE_BOUNDS_H
+
+#include <cmath>
+#include <vector>
+#include <GL/glew.h>
+#include <assimp/scene.h>
+#include "skeleton.h"
+#include "skinning.h"
+#include "render_queue.h"
+
+#define BONE_BOX_MARGIN 0.15f   // Added to each half size of a bone's box, as a fraction of its largest one
+
+struct BoundingBox {
+    aiVector3D min, max;
+};
+
+struct BoneBox {
+    int boneId;                      // Palette entry (mNumBones for the vertices without influences)
+    aiVector3D center, halfSize;     // In bind space, margin included
+};
+
+struct BoneBounds {
+    std::vector<std::vector<BoneBox> > meshBoxes;   // Boxes of the bones influencing any vertex, per mesh
+};
+
+// Planes a x + b y + c z + d >= 0 of the inside of the view volume
+struct Frustum {
+    float planes[6][4];
+};
+
+// Everything a character's bound is tested against. Without culling, every
+// character is in view.
+struct CullView {
+    bool enabled = false;
+    Frustum frustum;                 // In world space
+    aiMatrix4x4 model;               // The viewer's model transformation (scaling to a unit box)
+    bool shadows = false;            // Whether planar shadows are drawn
+    aiMatrix4x4 shadow;              // Shadow projection, applied after a character's translation
+};
+
+// ----------------------------------------------------------------------------
+BoundingBox emptyBoundingBox() {
+    BoundingBox box;
+    box.min = aiVector3D(1e10f, 1e10f, 1e10f);
+    box.max = aiVector3D(-1e10f, -1e10f, -1e10f);
+    return box;
+}
+
+// ----------------------------------------------------------------------------
+bool boundingBoxEmpty(const BoundingBox &box) {
+    return box.min.x > box.max.x;
+}
+
+// ----------------------------------------------------------------------------
+void expandBoundingBox(BoundingBox *box, const aiVector3D &p) {
+    box->min.x = std::min(box->min.x, p.x);
+    box->min.y = std::min(box->min.y, p.y);
+    box->min.z = std::min(box->min.z, p.z);
+    box->max.x = std::max(box->max.x, p.x);
+    box->max.y = std::max(box->max.y, p.y);
+    box->max.z = std::max(box->max.z, p.z);
+}
+
+// ----------------------------------------------------------------------------
+// Expands box by the box of the given center and half size transformed by
+// the affine matrix m, without visiting its corners
+void addTransformedBox(BoundingBox *box, const aiMatrix4x4 &m, const aiVector3D &center,
+                       const aiVector3D &halfSize) {
+    aiVector3D c(m.a1 * center.x + m.a2 * center.y + m.a3 * center.z + m.a4,
+                 m.b1 * center.x + m.b2 * center.y + m.b3 * center.z + m.b4,
+                 m.c1 * center.x + m.c2 * center.y + m.c3 * center.z + m.c4);
+    aiVector3D h(std::fabs(m.a1) * halfSize.x + std::fabs(m.a2) * halfSize.y + std::fabs(m.a3) * halfSize.z,
+                 std::fabs(m.b1) * halfSize.x + std::fabs(m.b2) * halfSize.y + std::fabs(m.b3) * halfSize.z,
+                 std::fabs(m.c1) * halfSize.x + std::fabs(m.c2) * halfSize.y + std::fabs(m.c3) * halfSize.z);
+    expandBoundingBox(box, c - h);
+    expandBoundingBox(box, c + h);
+}
+
+// ----------------------------------------------------------------------------
+// Box around the corners of box transformed by m, which may be a projection
+// (the planar shadow)
+BoundingBox transformBoundingBox(const BoundingBox &box, const aiMatrix4x4 &m) {
+    BoundingBox result = emptyBoundingBox();
+    if (boundingBoxEmpty(box)) return result;
+    for (int corner = 0; corner < 8; corner++) {
+        float x = corner & 1 ? box.max.x : box.min.x;
+        float y = corner & 2 ? box.max.y : box.min.y;
+        float z = corner & 4 ? box.max.z : box.min.z;
+        float w = m.d1 * x + m.d2 * y + m.d3 * z + m.d4;
+        expandBoundingBox(&result, aiVector3D((m.a1 * x + m.a2 * y + m.a3 * z + m.a4) / w,
+                                              (m.b1 * x + m.b2 * y + m.b3 * z + m.b4) / w,
+                                              (m.c1 * x + m.c2 * y + m.c3 * z + m.c4) / w));
+    }
+    return result;
+}
+
+// ----------------------------------------------------------------------------
+// Builds the box of every bone of every mesh from the influence tables of
+// the skin meshes. palettes gives the number of entries of each mesh.
+void buildBoneBounds(BoneBounds *bounds, const std::vector<SkinMesh> &skinMeshes,
+                     const std::vector<BonePalette> &palettes) {
+    bounds->meshBoxes.assign(skinMeshes.size(), std::vector<BoneBox>());
+    for (int meshId = 0; meshId < skinMeshes.size(); meshId++) {
+        const SkinMesh &skin = skinMeshes[meshId];
+        int n = skin.numVertices;
+        std::vector<BoundingBox> boxes(palettes[meshId].matrices.size(), emptyBoundingBox());
+        for (int v = 0; v < n; v++) {
+            aiVector3D p(skin.bindPositions[v], skin.bindPositions[n + v], skin.bindPositions[2 * n + v]);
+            for (int k = 0; k < MAX_INFLUENCES; k++)
+                if (skin.weights[k * n + v] > 0.0f) expandBoundingBox(&boxes[skin.boneIds[k * n + v]], p);
+        }
+
+        for (int boneId = 0; boneId < boxes.size(); boneId++) {
+            if (boundingBoxEmpty(boxes[boneId])) continue;
+            BoneBox box;
+            box.boneId = boneId;
+            box.center = (boxes[boneId].min + boxes[boneId].max) * 0.5f;
+            box.halfSize = (boxes[boneId].max - boxes[boneId].min) * 0.5f;
+            float margin = BONE_BOX_MARGIN * std::max(box.halfSize.x, std::max(box.halfSize.y, box.halfSize.z));
+            box.halfSize += aiVector3D(margin, margin, margin);
+            bounds->meshBoxes[meshId].push_back(box);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Bound of the model in the pose of palettes (their matrices only), in the
+// model's space. batchTransforms holds the transformation of each render
+// batch's node; if NULL, the nodes' current global transformations are used.
+BoundingBox posedModelBounds(const BoneBounds &bounds, const RenderQueue &queue,
+                             const std::vector<BonePalette> &palettes, const aiMatrix4x4 *batchTransforms) {
+    BoundingBox modelBox = emptyBoundingBox();
+    for (int b = 0; b < queue.batches.size(); b++) {
+        const DrawBatch &batch = queue.batches[b];
+        BoundingBox batchBox = emptyBoundingBox();
+        for (int i = 0; i < batch.gpu.meshIds.size(); i++) {
+            int meshId = batch.gpu.meshIds[i];
+            const std::vector<BoneBox> &boxes = bounds.meshBoxes[meshId];
+            for (int k = 0; k < boxes.size(); k++)
+                addTransformedBox(&batchBox, palettes[meshId].matrices[boxes[k].boneId], boxes[k].center,
+                                  boxes[k].halfSize);
+        }
+        if (boundingBoxEmpty(batchBox)) continue;
+
+        aiMatrix4x4 node = batchTransforms != NULL ? batchTransforms[b] : batchTransform(batch);
+        addTransformedBox(&modelBox, node, (batchBox.min + batchBox.max) * 0.5f,
+                          (batchBox.max - batchBox.min) * 0.5f);
+    }
+    return modelBox;
+}
+
+// ----------------------------------------------------------------------------
+// The matrix m transforms points to clip space; each plane is the fourth
+// row plus or minus one of the others
+Frustum frustumFromMatrix(const aiMatrix4x4 &m) {
+    Frustum frustum;
+    for (int axis = 0; axis < 3; axis++) {
+        for (int side = 0; side < 2; side++) {
+            float sign = side == 0 ? 1.0f : -1.0f;
+            for (int c = 0; c < 4; c++) frustum.planes[2 * axis + side][c] = m[3][c] + sign * m[axis][c];
+        }
+    }
+    return frustum;
+}
+
+// ----------------------------------------------------------------------------
+// False only if the box is entirely outside one of the planes
+bool boxInFrustum(const Frustum &frustum, const BoundingBox &box) {
+    if (boundingBoxEmpty(box)) return false;
+    for (int p = 0; p < 6; p++) {
+        const float *plane = frustum.planes[p];
+        float x = plane[0] > 0 ? box.max.x : box.min.x;   // Corner furthest inside
+        float y = plane[1] > 0 ? box.max.y : box.min.y;
+        float z = plane[2] > 0 ? box.max.z : box.min.z;
+        if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0) return false;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Transformation the GL calls of apply make to the modelview matrix, as a
+// row-major matrix. Leaves the GL matrices unchanged.
+aiMatrix4x4 glTransformOf(void (*apply)()) {
+    aiMatrix4x4 m;
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    apply();
+    glGetFloatv(GL_MODELVIEW_MATRIX, &m.a1);
+    glPopMatrix();
+    return m.Transpose();   //Convert from column-major order
+}
+
+// ----------------------------------------------------------------------------
+// World space frustum of the current projection, seen from the camera that
+// applyView sets
+Frustum glViewFrustum(void (*applyView)()) {
+    aiMatrix4x4 projection;
+    glGetFloatv(GL_PROJECTION_MATRIX, &projection.a1);
+    projection.Transpose();
+    return frustumFromMatrix(projection * glTransformOf(applyView));
+}
+
+// ----------------------------------------------------------------------------
+// Whether a character with the given model space bound, translated to
+// position and rotated by heading degrees about y, is in view, itself or
+// through its shadow
+bool characterInView(const CullView &view, const BoundingBox &bounds, const aiVector3D &position, float heading) {
+    if (!view.enabled) return true;
+    float angle = heading * 3.14159265f / 180.0f;
+    aiMatrix4x4 rotation(std::cos(angle), 0, std::sin(angle), 0,
+                         0, 1, 0, 0,
+                         -std::sin(angle), 0, std::cos(angle), 0,
+                         0, 0, 0, 1);
+    aiMatrix4x4 translation(1, 0, 0, position.x,
+                            0, 1, 0, position.y,
+                            0, 0, 1, position.z,
+                            0, 0, 0, 1);
+    aiMatrix4x4 place = rotation * view.model;
+    if (boxInFrustum(view.frustum, transformBoundingBox(bounds, translation * place))) return true;
+    return view.shadows && boxInFrustum(view.frustum, transformBoundingBox(bounds, translation * view.shadow * place));
+}
+
+#endif
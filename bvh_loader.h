@@ -0,0 +1,423 @@
+// ----------------------------------------------------------------------------
+// Streaming BVH loader
+//
+// BVH files hold only a joint hierarchy and a block of motion samples, so
+// they are read here rather than by assimp's importer and mesh
+// post-processing. The file is mapped and tokenised in place: tokens are
+// pointer ranges into the mapping, and only joint names are copied. The
+// MOTION block is streamed a row at a time, with a number parser that skips
+// strtod's locale and error handling for the plain decimals BVH exporters
+// write, and each row is turned into keys for all joints while it is still
+// in cache. Euler angles become quaternions directly, as the product of one
+// half-angle rotation per channel in the joint's channel order, instead of
+// through rotation matrices.
+//
+// The scene matches what assimp's BVH importer gives the viewers: a node per
+// joint and end site, one animation channel per joint in hierarchy order,
+// one key per frame and time in frames. The skeleton mesh assimp adds for
+// display is not built. Consecutive rotation keys are kept in the same
+// hemisphere, for interpolation and compression.
+//-----------------------------------------------------------------------------
+
+#ifndef BVH_LOADER_H
+#define BVH_LOADER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#include <cstdio>
+#endif
+#include <assimp/scene.h>
+
+#if defined(MAP_POPULATE)
+#define BVH_MAP_FLAGS MAP_POPULATE      // Fault the pages in up front, since all of them are read
+#else
+#define BVH_MAP_FLAGS 0
+#endif
+
+enum BvhChannel {
+    BVH_X_POSITION, BVH_Y_POSITION, BVH_Z_POSITION, BVH_X_ROTATION, BVH_Y_ROTATION, BVH_Z_ROTATION
+};
+
+struct BvhJoint {
+    aiNode *node;
+    int firstColumn;                 // Column of its first channel in a motion row
+    std::vector<int> channels;       // BvhChannel of each of its columns
+};
+
+// Read-only view of a BVH file
+struct BvhFile {
+    const char *data;
+    size_t size;
+    bool mapped;                     // false if data was read into a heap buffer
+};
+
+struct BvhToken {
+    const char *begin;
+    size_t length;
+};
+
+struct BvhReader {
+    const char *p, *end;
+    int line;
+    bool ok;
+    const char *fileName;
+};
+
+// ----------------------------------------------------------------------------
+bool openBvhFile(const char *fileName, BvhFile *file) {
+#ifndef _WIN32
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+        data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE | BVH_MAP_FLAGS, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+    file->data = (const char *) data;
+    file->size = info.st_size;
+    file->mapped = true;
+    return true;
+#else
+    FILE *f = fopen(fileName, "rb");
+    if (f == NULL) return false;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = new char[size > 0 ? size : 1];
+    bool ok = size > 0 && fread(data, 1, size, f) == (size_t) size;
+    fclose(f);
+    if (!ok) {
+        delete[] data;
+        return false;
+    }
+    file->data = data;
+    file->size = size;
+    file->mapped = false;
+    return true;
+#endif
+}
+
+// ----------------------------------------------------------------------------
+void closeBvhFile(const BvhFile &file) {
+#ifndef _WIN32
+    if (file.mapped) {
+        munmap((void *) file.data, file.size);
+        return;
+    }
+#endif
+    delete[] file.data;
+}
+
+// ----------------------------------------------------------------------------
+void bvhError(BvhReader &in, const std::string &message) {
+    if (in.ok) std::cout << in.fileName << ":" << in.line << ": " << message << std::endl;
+    in.ok = false;
+}
+
+// ----------------------------------------------------------------------------
+// Next whitespace separated token; empty at the end of the file
+BvhToken nextBvhToken(BvhReader &in) {
+    while (in.p < in.end && (unsigned char) *in.p <= ' ')
+        if (*in.p++ == '\n') in.line++;
+    BvhToken token = {in.p, 0};
+    while (in.p < in.end && (unsigned char) *in.p > ' ') in.p++;
+    token.length = in.p - token.begin;
+    return token;
+}
+
+// ----------------------------------------------------------------------------
+bool bvhTokenIs(const BvhToken &token, const char *word) {
+    return token.length == strlen(word) && memcmp(token.begin, word, token.length) == 0;
+}
+
+// ----------------------------------------------------------------------------
+std::string bvhTokenString(const BvhToken &token) {
+    return std::string(token.begin, token.length);
+}
+
+// ----------------------------------------------------------------------------
+void expectBvhToken(BvhReader &in, const char *word) {
+    BvhToken token = nextBvhToken(in);
+    if (!bvhTokenIs(token, word)) bvhError(in, "expected '" + std::string(word) + "', found '" + bvhTokenString(token) + "'");
+}
+
+// ----------------------------------------------------------------------------
+// Parses the decimal number at p and advances p past it. Numbers of up to
+// 15 significant digits with small exponents are converted exactly from an
+// integer mantissa; anything else falls back to strtod.
+bool parseBvhNumber(const char *&p, const char *end, float *value) {
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char *s = p;
+    bool negative = s < end && *s == '-';
+    if (s < end && (*s == '-' || *s == '+')) s++;
+    uint64_t mantissa = 0;
+    int exponent = 0, digits = 0, significant = 0;
+    for (; s < end && (unsigned) (*s - '0') < 10; s++, digits++) {
+        mantissa = mantissa * 10 + (*s - '0');
+        if (mantissa > 0) significant++;
+    }
+    if (s < end && *s == '.') {
+        for (s++; s < end && (unsigned) (*s - '0') < 10; s++, digits++, exponent--) {
+            mantissa = mantissa * 10 + (*s - '0');
+            if (mantissa > 0) significant++;
+        }
+    }
+    if (digits == 0) return false;
+    bool simple = significant <= 15;
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        const char *e = s + 1;
+        bool negativeExponent = e < end && *e == '-';
+        if (e < end && (*e == '-' || *e == '+')) e++;
+        int power = 0;
+        for (; e < end && (unsigned) (*e - '0') < 10 && power < 10000; e++) power = power * 10 + (*e - '0');
+        exponent += negativeExponent ? -power : power;
+        s = e;
+    }
+    if (s < end && (unsigned char) *s > ' ') return false;
+
+    if (simple && exponent >= -22 && exponent <= 22) {
+        double v = exponent < 0 ? mantissa / powers[-exponent] : mantissa * powers[exponent];
+        *value = (float) (negative ? -v : v);
+    } else {
+        std::string text(p, s);
+        *value = (float) strtod(text.c_str(), NULL);
+    }
+    p = s;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+float readBvhNumber(BvhReader &in) {
+    BvhToken token = nextBvhToken(in);
+    const char *p = token.begin;
+    float value = 0;
+    if (!parseBvhNumber(p, token.begin + token.length, &value) || p != token.begin + token.length)
+        bvhError(in, "expected a number, found '" + bvhTokenString(token) + "'");
+    return value;
+}
+
+// ----------------------------------------------------------------------------
+aiNode *newBvhNode(const std::string &name, aiNode *parent, const aiVector3D &offset) {
+    aiNode *node = new aiNode();
+    node->mName = aiString(name);
+    node->mParent = parent;
+    node->mTransformation = aiMatrix4x4(1, 0, 0, offset.x,
+                                        0, 1, 0, offset.y,
+                                        0, 0, 1, offset.z,
+                                        0, 0, 0, 1);
+    return node;
+}
+
+// ----------------------------------------------------------------------------
+aiVector3D readBvhOffset(BvhReader &in) {
+    expectBvhToken(in, "OFFSET");
+    float x = readBvhNumber(in);
+    float y = readBvhNumber(in);
+    float z = readBvhNumber(in);
+    return aiVector3D(x, y, z);
+}
+
+// ----------------------------------------------------------------------------
+// Reads a joint from its name to its closing brace, appending it and its
+// descendants to joints in hierarchy order. numColumns counts the channels
+// read so far.
+aiNode *readBvhJoint(BvhReader &in, aiNode *parent, std::vector<BvhJoint> *joints, int *numColumns) {
+    static const char *channelNames[] = {"Xposition", "Yposition", "Zposition", "Xrotation", "Yrotation", "Zrotation"};
+    std::string name = bvhTokenString(nextBvhToken(in));
+    expectBvhToken(in, "{");
+    aiNode *node = newBvhNode(name, parent, readBvhOffset(in));
+    joints->push_back(BvhJoint());
+    int jointId = joints->size() - 1;
+    (*joints)[jointId].node = node;
+    (*joints)[jointId].firstColumn = *numColumns;
+
+    expectBvhToken(in, "CHANNELS");
+    int numChannels = (int) readBvhNumber(in);
+    for (int c = 0; c < numChannels && in.ok; c++) {
+        BvhToken token = nextBvhToken(in);
+        int channel = 0;
+        while (channel < 6 && !bvhTokenIs(token, channelNames[channel])) channel++;
+        if (channel == 6) bvhError(in, "unknown channel '" + bvhTokenString(token) + "'");
+        (*joints)[jointId].channels.push_back(channel);
+    }
+    *numColumns += numChannels;
+
+    std::vector<aiNode *> children;
+    while (in.ok) {
+        BvhToken token = nextBvhToken(in);
+        if (bvhTokenIs(token, "}")) break;
+        if (bvhTokenIs(token, "JOINT")) {
+            children.push_back(readBvhJoint(in, node, joints, numColumns));
+        } else if (bvhTokenIs(token, "End")) {
+            expectBvhToken(in, "Site");
+            expectBvhToken(in, "{");
+            children.push_back(newBvhNode("EndSite_" + name, node, readBvhOffset(in)));
+            expectBvhToken(in, "}");
+        } else {
+            bvhError(in, "expected 'JOINT', 'End Site' or '}' in joint '" + name + "', found '"
+                         + bvhTokenString(token) + "'");
+        }
+    }
+    if (!children.empty()) {
+        node->mNumChildren = children.size();
+        node->mChildren = new aiNode*[children.size()];
+        for (int i = 0; i < children.size(); i++) node->mChildren[i] = children[i];
+    }
+    return node;
+}
+
+// ----------------------------------------------------------------------------
+// Channel of one joint with its keys allocated: a position key per frame if
+// it has position channels (a single one at its offset otherwise), a
+// rotation key per frame and unit scaling
+aiNodeAnim *newBvhChannel(const BvhJoint &joint, int numFrames) {
+    aiNodeAnim *channel = new aiNodeAnim();
+    channel->mNodeName = joint.node->mName;
+    bool hasPosition = false;
+    for (int c = 0; c < joint.channels.size(); c++) hasPosition |= joint.channels[c] <= BVH_Z_POSITION;
+    channel->mNumPositionKeys = hasPosition ? numFrames : 1;
+    channel->mPositionKeys = new aiVectorKey[channel->mNumPositionKeys];
+    channel->mPositionKeys[0].mTime = 0;
+    channel->mPositionKeys[0].mValue = aiVector3D(joint.node->mTransformation.a4, joint.node->mTransformation.b4,
+                                                  joint.node->mTransformation.c4);
+    channel->mNumRotationKeys = numFrames;
+    channel->mRotationKeys = new aiQuatKey[numFrames];
+    channel->mNumScalingKeys = 1;
+    channel->mScalingKeys = new aiVectorKey[1];
+    channel->mScalingKeys[0].mTime = 0;
+    channel->mScalingKeys[0].mValue = aiVector3D(1, 1, 1);
+    return channel;
+}
+
+// ----------------------------------------------------------------------------
+// Sets the keys of frame f of every joint from the frame's motion row. A
+// rotation is R(first channel) R(second) R(third), built as a product of
+// half-angle quaternions, and kept in the hemisphere of the previous key.
+void setBvhFrameKeys(const float *row, int f, const std::vector<BvhJoint> &joints, aiNodeAnim **channels) {
+    for (int j = 0; j < joints.size(); j++) {
+        const BvhJoint &joint = joints[j];
+        aiNodeAnim *channel = channels[j];
+        const float *values = row + joint.firstColumn;
+        aiVector3D position = channel->mPositionKeys[0].mValue;
+        aiQuaternion q;
+        for (int c = 0; c < joint.channels.size(); c++) {
+            int type = joint.channels[c];
+            if (type <= BVH_Z_POSITION) {
+                position[type] = values[c];
+                continue;
+            }
+            float angle = values[c] * (0.5f * 3.14159265358979f / 180.0f);
+            float s = std::sin(angle), w = std::cos(angle);
+            q = q * aiQuaternion(w, type == BVH_X_ROTATION ? s : 0.0f, type == BVH_Y_ROTATION ? s : 0.0f,
+                                 type == BVH_Z_ROTATION ? s : 0.0f);
+        }
+
+        if (channel->mNumPositionKeys > 1) {
+            channel->mPositionKeys[f].mTime = f;
+            channel->mPositionKeys[f].mValue = position;
+        }
+        if (f > 0) {
+            const aiQuaternion &previous = channel->mRotationKeys[f - 1].mValue;
+            if (q.w * previous.w + q.x * previous.x + q.y * previous.y + q.z * previous.z < 0)
+                q = aiQuaternion(-q.w, -q.x, -q.y, -q.z);
+        }
+        channel->mRotationKeys[f].mTime = f;
+        channel->mRotationKeys[f].mValue = q;
+    }
+}
+
+// ----------------------------------------------------------------------------
+bool isBvhFile(const char *fileName) {
+    size_t length = strlen(fileName);
+    return length >= 4 && (strcmp(fileName + length - 4, ".bvh") == 0 || strcmp(fileName + length - 4, ".BVH") == 0);
+}
+
+// ----------------------------------------------------------------------------
+// Reads a BVH file into a scene with its joint hierarchy and one animation.
+// Prints the problem and returns NULL if the file can't be read or parsed.
+const aiScene *loadBvhScene(const char *fileName) {
+    typedef std::chrono::high_resolution_clock Clock;
+    Clock::time_point start = Clock::now();
+    BvhFile file;
+    if (!openBvhFile(fileName, &file)) return NULL;
+    BvhReader in = {file.data, file.data + file.size, 1, true, fileName};
+
+    std::vector<BvhJoint> joints;
+    int rowLength = 0;
+    aiNode *root = NULL;
+    expectBvhToken(in, "HIERARCHY");
+    expectBvhToken(in, "ROOT");
+    if (in.ok) root = readBvhJoint(in, NULL, &joints, &rowLength);
+    expectBvhToken(in, "MOTION");
+    expectBvhToken(in, "Frames:");
+    int numFrames = (int) readBvhNumber(in);
+    expectBvhToken(in, "Frame");
+    expectBvhToken(in, "Time:");
+    float frameTime = readBvhNumber(in);
+    if (in.ok && (numFrames < 1 || frameTime <= 0)) bvhError(in, "invalid frame count or frame time");
+    if (in.ok && rowLength == 0) bvhError(in, "the hierarchy has no channels");
+
+    // The motion rows, in one pass without line tracking. Each row is turned
+    // into keys while it is still in cache.
+    aiAnimation *anim = new aiAnimation();
+    if (in.ok) {
+        anim->mDuration = numFrames - 1;
+        anim->mTicksPerSecond = 1.0 / frameTime;
+        anim->mNumChannels = joints.size();
+        anim->mChannels = new aiNodeAnim*[joints.size()];
+        for (int j = 0; j < joints.size(); j++) anim->mChannels[j] = newBvhChannel(joints[j], numFrames);
+    }
+    std::vector<float> row(rowLength);
+    for (int f = 0; f < numFrames && in.ok; f++) {
+        for (int i = 0; i < rowLength; i++) {
+            while (in.p < in.end && (unsigned char) *in.p <= ' ') in.p++;
+            if (!parseBvhNumber(in.p, in.end, &row[i])) {
+                std::ostringstream message;
+                message << "frame " << f << " of the motion has fewer than " << rowLength
+                        << " numbers, or is not a number";
+                bvhError(in, message.str());
+                break;
+            }
+        }
+        if (in.ok) setBvhFrameKeys(&row[0], f, joints, anim->mChannels);
+    }
+    size_t parsedBytes = in.p - file.data;
+    closeBvhFile(file);
+    if (!in.ok) {
+        delete anim;
+        delete root;
+        return NULL;
+    }
+
+    aiScene *scene = new aiScene();
+    scene->mRootNode = root;
+    scene->mNumAnimations = 1;
+    scene->mAnimations = new aiAnimation*[1];
+    scene->mAnimations[0] = anim;
+
+    double loadMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    std::ostringstream message;
+    message << "Loaded '" << fileName << "' (" << joints.size() << " joints, " << numFrames << " frames) in "
+            << loadMs << " ms, " << parsedBytes / 1e3 / std::max(loadMs, 1e-3) << " MB/s\n";
+    std::cout << message.str() << std::flush;
+    return scene;
+}
+
+#endif
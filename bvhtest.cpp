@@ -0,0 +1,125 @@
+//  ========================================================================
+//  FILE NAME: bvhtest.cpp
+//
+//  Checks the streaming BVH loader (bvh_loader.h) against assimp's BVH
+//  importer, which the viewers used before: both must give the same node
+//  hierarchy (names and offsets), the same animation length and rate, and
+//  channels that pose every joint alike at every frame, within a tolerance
+//  for the different number parsing and rotation arithmetic. Keys are
+//  compared by sampling, as assimp's post-processing may merge constant
+//  keys.
+//
+//  Usage: bvhtest [file.bvh]   (default ./models/Dwarf/avatar_walk.bvh;
+//                               exits with 1 if a check fails)
+//  ========================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include <assimp/cimport.h>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include "anim_sampler.h"
+#include "bvh_loader.h"
+
+#define POSITION_TOLERANCE 1e-3f   // Largest position or offset difference, in the file's units
+#define ROTATION_TOLERANCE 1e-3f   // Largest rotation difference, in radians
+
+int failures = 0;
+
+// ----------------------------------------------------------------------------
+void check(bool ok, const string &what) {
+    if (ok) return;
+    cout << "FAILED: " << what << endl;
+    failures++;
+}
+
+// ----------------------------------------------------------------------------
+// Angle of the rotation between two unit quaternions, from the distance
+// between them (2 sin(angle / 4)), which unlike acos of their dot product
+// stays accurate for small angles
+float rotationAngle(const aiQuaternion &a, const aiQuaternion &b) {
+    float sign = a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z < 0 ? -1.0f : 1.0f;
+    float dw = a.w - sign * b.w, dx = a.x - sign * b.x, dy = a.y - sign * b.y, dz = a.z - sign * b.z;
+    float distance = sqrtf(dw * dw + dx * dx + dy * dy + dz * dz);
+    return 4.0f * asinf(min(0.5f * distance, 1.0f));
+}
+
+// ----------------------------------------------------------------------------
+// Compares two node trees: names, offsets and children, in order
+void compareNodes(const aiNode *loaded, const aiNode *imported) {
+    string name = imported->mName.C_Str();
+    check(name == loaded->mName.C_Str(), "node '" + string(loaded->mName.C_Str()) + "' is named '" + name + "'");
+    aiVector3D a(loaded->mTransformation.a4, loaded->mTransformation.b4, loaded->mTransformation.c4);
+    aiVector3D b(imported->mTransformation.a4, imported->mTransformation.b4, imported->mTransformation.c4);
+    check((a - b).Length() <= POSITION_TOLERANCE, "offset of node '" + name + "'");
+    check(loaded->mNumChildren == imported->mNumChildren, "number of children of node '" + name + "'");
+    for (int i = 0; i < min(loaded->mNumChildren, imported->mNumChildren); i++)
+        compareNodes(loaded->mChildren[i], imported->mChildren[i]);
+}
+
+// ----------------------------------------------------------------------------
+int main(int argc, char **argv) {
+    const char *fileName = argc > 1 ? argv[1] : "./models/Dwarf/avatar_walk.bvh";
+    const aiScene *loaded = loadBvhScene(fileName);
+    const aiScene *imported = aiImportFile(fileName, aiProcessPreset_TargetRealtime_MaxQuality);
+    check(loaded != NULL, "bvh_loader reads the file");
+    check(imported != NULL, "assimp reads the file");
+    if (loaded == NULL || imported == NULL || imported->mNumAnimations == 0) {
+        cout << "Some checks failed" << endl;
+        return 1;
+    }
+
+    compareNodes(loaded->mRootNode, imported->mRootNode);
+
+    const aiAnimation *a = loaded->mAnimations[0], *b = imported->mAnimations[0];
+    check(loaded->mNumAnimations == 1, "one animation");
+    check(a->mDuration == b->mDuration, "animation duration");
+    check(fabs(a->mTicksPerSecond - b->mTicksPerSecond) <= 1e-3 * b->mTicksPerSecond, "ticks per second");
+    check(a->mNumChannels == b->mNumChannels, "number of channels");
+
+    // Channel of the assimp animation for each channel of the loaded one
+    map<string, int> importedChannels;
+    for (int i = 0; i < b->mNumChannels; i++) importedChannels[b->mChannels[i]->mNodeName.C_Str()] = i;
+    vector<int> match(a->mNumChannels, -1);
+    for (int i = 0; i < a->mNumChannels; i++) {
+        map<string, int>::iterator it = importedChannels.find(a->mChannels[i]->mNodeName.C_Str());
+        check(it != importedChannels.end(), "assimp has a channel for '" + string(a->mChannels[i]->mNodeName.C_Str()) + "'");
+        if (it != importedChannels.end()) match[i] = it->second;
+        check(i < b->mNumChannels && a->mChannels[i]->mNodeName == b->mChannels[i]->mNodeName,
+              "channel " + to_string(i) + " is in hierarchy order");
+    }
+
+    AnimSampler samplerA, samplerB;
+    initAnimSampler(&samplerA, a);
+    initAnimSampler(&samplerB, b);
+    vector<JointPose> poseA(a->mNumChannels), poseB(b->mNumChannels);
+    float positionError = 0, rotationError = 0, scaleError = 0;
+    for (int frame = 0; frame <= (int) b->mDuration; frame++) {
+        samplePose(&samplerA, frame, &poseA[0]);
+        samplePose(&samplerB, frame, &poseB[0]);
+        for (int i = 0; i < a->mNumChannels; i++) {
+            if (match[i] < 0) continue;
+            const JointPose &p = poseA[i], &q = poseB[match[i]];
+            positionError = max(positionError, (p.position - q.position).Length());
+            rotationError = max(rotationError, rotationAngle(p.rotation, q.rotation));
+            scaleError = max(scaleError, (p.scale - q.scale).Length());
+        }
+    }
+    check(positionError <= POSITION_TOLERANCE, "position keys (largest difference " + to_string(positionError) + ")");
+    check(rotationError <= ROTATION_TOLERANCE, "rotation keys (largest difference " + to_string(rotationError) + " rad)");
+    check(scaleError <= 1e-6f, "scaling keys");
+
+    cout << a->mNumChannels << " channels, " << (int) b->mDuration + 1 << " frames; largest differences: position "
+         << positionError << ", rotation " << rotationError << " rad" << endl;
+    delete loaded;
+    aiReleaseImport(imported);
+    cout << (failures == 0 ? "All checks passed" : "Some checks failed") << endl;
+    return failures == 0 ? 0 : 1;
+}
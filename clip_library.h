@@ -0,0 +1,369 @@
+// ----------------------------------------------------------------------------
+// Animation clip library
+//
+// The clip files of a directory (every animation of every file with a given
+// extension) are packed into one archive in that directory, clips.pack: a
+// header, each clip's node hierarchy and keys in the scene cache's layout,
+// and an index of clip names sorted for lookup. The archive is rebuilt when a
+// clip file is added, removed or modified, one file at a time, so building
+// needs memory for the largest file only.
+//
+// Opening the library maps the archive and reads only its index; clip data
+// is paged in on first use, when its object graph is built around key arrays
+// used in place from the mapping. Paging a clip in costs a few allocations
+// per channel, whatever the size of the library. Resident clips are kept in
+// least recently used order and evicted when their bytes exceed the memory
+// cap: the object graph is deleted and the clip's pages are released
+// (MADV_DONTNEED), to be read from the file again if the clip comes back.
+// Clips are pinned while in use (acquireLibraryClip / releaseLibraryClip) and
+// never evicted while pinned, so the cap can be exceeded by pinned clips.
+// Without mmap, each clip's bytes are read into a buffer of its own instead.
+//-----------------------------------------------------------------------------
+
+#ifndef CLIP_LIBRARY_H
+#define CLIP_LIBRARY_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+#include "scene_cache.h"
+
+#define CLIP_LIBRARY_VERSION 1
+#define CLIP_LIBRARY_FILE "clips.pack"
+
+struct ClipLibraryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;            // sceneCacheLayout, as the keys are used in place
+    uint64_t indexOffset;       // Start of the source list and clip index, after all clip data
+};
+
+// A clip file the archive was built from
+struct ClipSource {
+    std::string name;           // File name within the directory
+    int64_t size;
+    int64_t time;               // Modification time
+};
+
+struct LibraryClip {
+    std::string name;           // File name without extension, plus "/<animation>" if it has several
+    uint64_t offset, size;      // Byte range of its data in the archive
+    int pins = 0;
+    aiNode *root = NULL;        // Hierarchy the clip was made for, in its bind pose; NULL until paged in
+    aiAnimation *anim = NULL;
+    std::vector<char> buffer;   // The clip's bytes, if the archive isn't mapped
+    std::list<int>::iterator lru;
+};
+
+struct ClipLibrary {
+    std::string path;
+    char *data = NULL;          // The archive, mapped (or NULL if it is read clip by clip)
+    size_t size = 0;
+    std::vector<LibraryClip> clips;   // Sorted by name
+    std::list<int> resident;    // Clips paged in, most recently used first
+    size_t capBytes = 0;
+    size_t residentBytes = 0;
+
+    // Counters since the library was opened
+    unsigned long long loads = 0, evictions = 0;
+};
+
+//=============================================================================
+// Building
+//=============================================================================
+
+// ----------------------------------------------------------------------------
+// Clip files of the directory, sorted by name
+std::vector<ClipSource> listClipSources(const std::string &dir, const char *extension) {
+    std::vector<ClipSource> sources;
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL) return sources;
+    size_t extensionLength = strlen(extension);
+    for (struct dirent *entry = readdir(d); entry != NULL; entry = readdir(d)) {
+        std::string name = entry->d_name;
+        struct stat info;
+        if (name.size() <= extensionLength || name.compare(name.size() - extensionLength, extensionLength, extension) != 0
+            || stat((dir + "/" + name).c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+            continue;
+        ClipSource source = {name, (int64_t) info.st_size, (int64_t) info.st_mtime};
+        sources.push_back(source);
+    }
+    closedir(d);
+    std::sort(sources.begin(), sources.end(),
+              [](const ClipSource &a, const ClipSource &b) { return a.name < b.name; });
+    return sources;
+}
+
+// ----------------------------------------------------------------------------
+// Imports every source and writes its animations to the archive at path.
+// Prints the problem and returns false on failure.
+bool buildClipLibrary(const std::string &dir, const std::vector<ClipSource> &sources, const std::string &path) {
+    std::string tempPath = path + ".tmp";
+    FILE *file = fopen(tempPath.c_str(), "wb");
+    if (file == NULL) {
+        std::cout << "The clip library '" << path << "' could not be written." << std::endl;
+        return false;
+    }
+    ClipLibraryHeader header;
+    memset(&header, 0, sizeof(header));
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t offset = sizeof(header);
+
+    std::vector<LibraryClip> clips;
+    std::vector<char> out;
+    for (int s = 0; s < sources.size() && written; s++) {
+        std::string fileName = dir + "/" + sources[s].name;
+        const aiScene *scene = importScene(fileName.c_str(), aiProcessPreset_TargetRealtime_MaxQuality, false);
+        if (scene == NULL) {
+            std::cout << "Clip library: skipping '" << fileName << "', which could not be imported" << std::endl;
+            continue;
+        }
+        std::string stem = sources[s].name.substr(0, sources[s].name.find_last_of('.'));
+        for (int a = 0; a < scene->mNumAnimations && written; a++) {
+            const aiAnimation *anim = scene->mAnimations[a];
+            LibraryClip clip;
+            clip.name = stem;
+            if (scene->mNumAnimations > 1)
+                clip.name += "/" + (anim->mName.length > 0 ? std::string(anim->mName.C_Str()) : std::to_string(a));
+
+            // Clip data starts aligned, as its arrays are aligned relative to its start
+            char padding[SCENE_CACHE_ALIGNMENT] = {0};
+            size_t paddingSize = (SCENE_CACHE_ALIGNMENT - offset % SCENE_CACHE_ALIGNMENT) % SCENE_CACHE_ALIGNMENT;
+            out.clear();
+            cachePutNode(out, scene->mRootNode);
+            cachePutAnimation(out, anim);
+            clip.offset = offset + paddingSize;
+            clip.size = out.size();
+            written = fwrite(padding, 1, paddingSize, file) == paddingSize
+                      && fwrite(out.data(), 1, out.size(), file) == out.size();
+            offset = clip.offset + clip.size;
+            clips.push_back(clip);
+        }
+        releaseScene(scene);
+    }
+
+    std::sort(clips.begin(), clips.end(), [](const LibraryClip &a, const LibraryClip &b) { return a.name < b.name; });
+    out.clear();
+    cachePutU32(out, sources.size());
+    for (int s = 0; s < sources.size(); s++) {
+        cachePutString(out, aiString(sources[s].name));
+        cachePut(out, &sources[s].size, sizeof(int64_t));
+        cachePut(out, &sources[s].time, sizeof(int64_t));
+    }
+    cachePutU32(out, clips.size());
+    for (int c = 0; c < clips.size(); c++) {
+        cachePutString(out, aiString(clips[c].name));
+        cachePut(out, &clips[c].offset, sizeof(uint64_t));
+        cachePut(out, &clips[c].size, sizeof(uint64_t));
+    }
+    written = written && fwrite(out.data(), 1, out.size(), file) == out.size();
+
+    memcpy(header.magic, "A2SCLIPS", 8);
+    header.version = CLIP_LIBRARY_VERSION;
+    header.layout = sceneCacheLayout();
+    header.indexOffset = offset;
+    written = written && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(tempPath.c_str(), path.c_str()) != 0) {
+        remove(tempPath.c_str());
+        std::cout << "The clip library '" << path << "' could not be written." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//=============================================================================
+// Opening and paging
+//=============================================================================
+
+// ----------------------------------------------------------------------------
+// Reads the archive's index into the library if the archive is valid and
+// was built from exactly the given sources
+bool readClipLibraryIndex(ClipLibrary *library, const std::vector<ClipSource> &sources) {
+    FILE *file = fopen(library->path.c_str(), "rb");
+    if (file == NULL) return false;
+    ClipLibraryHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "A2SCLIPS", 8) == 0
+              && header.version == CLIP_LIBRARY_VERSION && header.layout == sceneCacheLayout();
+    std::vector<char> index;
+    if (ok && fseek(file, 0, SEEK_END) == 0) {
+        long end = ftell(file);
+        ok = end >= 0 && header.indexOffset <= (uint64_t) end;
+        if (ok) {
+            index.resize(end - header.indexOffset);
+            ok = fseek(file, header.indexOffset, SEEK_SET) == 0
+                 && fread(index.data(), 1, index.size(), file) == index.size();
+        }
+        library->size = end;
+    }
+    fclose(file);
+    if (!ok) return false;
+
+    CacheReader in = {index.data(), index.size(), 0, true};
+    uint32_t numSources = cacheGetU32(in);
+    if (numSources != sources.size()) return false;
+    for (int s = 0; s < numSources && in.ok; s++) {
+        std::string name = cacheGetString(in).C_Str();
+        int64_t stamp[2] = {0, 0};
+        void *p = cacheGet(in, sizeof(stamp));
+        if (p) memcpy(stamp, p, sizeof(stamp));
+        if (name != sources[s].name || stamp[0] != sources[s].size || stamp[1] != sources[s].time) return false;
+    }
+    uint32_t numClips = cacheGetU32(in);
+    library->clips.clear();
+    for (int c = 0; c < numClips && in.ok; c++) {
+        LibraryClip clip;
+        clip.name = cacheGetString(in).C_Str();
+        uint64_t range[2] = {0, 0};
+        void *p = cacheGet(in, sizeof(range));
+        if (p) memcpy(range, p, sizeof(range));
+        clip.offset = range[0];
+        clip.size = range[1];
+        if (clip.offset + clip.size > header.indexOffset) in.ok = false;
+        library->clips.push_back(clip);
+    }
+    return in.ok;
+}
+
+// ----------------------------------------------------------------------------
+// Opens the library of the clip files with the given extension (e.g. ".bvh")
+// in dir, building its archive first if it is missing or out of date. At
+// most capBytes of clip data are kept paged in, besides pinned clips.
+bool openClipLibrary(ClipLibrary *library, const std::string &dir, const char *extension, size_t capBytes) {
+    library->path = dir + "/" + CLIP_LIBRARY_FILE;
+    library->capBytes = capBytes;
+    std::vector<ClipSource> sources = listClipSources(dir, extension);
+    if (!readClipLibraryIndex(library, sources)) {
+        typedef std::chrono::high_resolution_clock Clock;
+        Clock::time_point start = Clock::now();
+        if (!buildClipLibrary(dir, sources, library->path) || !readClipLibraryIndex(library, sources)) return false;
+        std::cout << "Built clip library '" << library->path << "' from " << sources.size() << " file(s) in "
+                  << std::chrono::duration<double, std::milli>(Clock::now() - start).count() << " ms" << std::endl;
+    }
+
+#ifndef _WIN32
+    int fd = open(library->path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        void *data = mmap(NULL, library->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data != MAP_FAILED) library->data = (char *) data;
+    }
+#endif
+    std::cout << "Clip library '" << library->path << "': " << library->clips.size() << " clips, "
+              << library->size / (1024.0 * 1024.0) << " MB, " << capBytes / (1024.0 * 1024.0)
+              << " MB paged in at most" << std::endl;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Index of the clip with the given name, -1 if none
+int findLibraryClip(const ClipLibrary &library, const std::string &name) {
+    std::vector<LibraryClip>::const_iterator it = std::lower_bound(
+            library.clips.begin(), library.clips.end(), name,
+            [](const LibraryClip &clip, const std::string &key) { return clip.name < key; });
+    return it != library.clips.end() && it->name == name ? (int) (it - library.clips.begin()) : -1;
+}
+
+// ----------------------------------------------------------------------------
+// Tells the OS how the pages holding a clip's data will be used
+void adviseClipPages(const ClipLibrary &library, const LibraryClip &clip, int advice) {
+#ifndef _WIN32
+    uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t) (library.data + clip.offset) / page * page;
+    uintptr_t end = (uintptr_t) (library.data + clip.offset + clip.size);
+    madvise((void *) begin, end - begin, advice);
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// Deletes the object graph of a paged in clip and releases its pages
+void evictLibraryClip(ClipLibrary *library, int clipId) {
+    LibraryClip &clip = library->clips[clipId];
+    for (int c = 0; c < clip.anim->mNumChannels; c++) {
+        clip.anim->mChannels[c]->mPositionKeys = clip.anim->mChannels[c]->mScalingKeys = NULL;
+        clip.anim->mChannels[c]->mRotationKeys = NULL;
+    }
+    delete clip.anim;
+    delete clip.root;
+    clip.anim = NULL;
+    clip.root = NULL;
+    std::vector<char>().swap(clip.buffer);
+    if (library->data != NULL) adviseClipPages(*library, clip, MADV_DONTNEED);
+    library->resident.erase(clip.lru);
+    library->residentBytes -= clip.size;
+    library->evictions++;
+}
+
+// ----------------------------------------------------------------------------
+// Pages the clip in if needed, pins it and marks it most recently used, then
+// evicts unpinned clips beyond the cap. Returns NULL if its data is corrupt.
+const LibraryClip *acquireLibraryClip(ClipLibrary *library, int clipId) {
+    LibraryClip &clip = library->clips[clipId];
+    if (clip.anim == NULL) {
+        char *data = NULL;
+        if (library->data != NULL) {
+            data = library->data + clip.offset;
+            adviseClipPages(*library, clip, MADV_WILLNEED);
+        } else {
+            FILE *file = fopen(library->path.c_str(), "rb");
+            clip.buffer.resize(clip.size);
+            bool ok = file != NULL && fseek(file, clip.offset, SEEK_SET) == 0
+                      && fread(clip.buffer.data(), 1, clip.size, file) == clip.size;
+            if (file != NULL) fclose(file);
+            if (!ok) return NULL;
+            data = clip.buffer.data();
+        }
+
+        CacheReader in = {data, clip.size, 0, true};
+        clip.root = cacheGetNode(in, NULL);
+        clip.anim = cacheGetAnimation(in);
+        library->resident.push_front(clipId);
+        clip.lru = library->resident.begin();
+        library->residentBytes += clip.size;
+        library->loads++;
+        if (!in.ok) {
+            std::cout << "Clip '" << clip.name << "' of '" << library->path << "' is corrupt." << std::endl;
+            evictLibraryClip(library, clipId);
+            return NULL;
+        }
+    } else {
+        library->resident.splice(library->resident.begin(), library->resident, clip.lru);
+    }
+    clip.pins++;
+
+    std::list<int>::iterator it = library->resident.end();
+    while (library->residentBytes > library->capBytes && it != library->resident.begin()) {
+        std::list<int>::iterator candidate = --it;
+        if (library->clips[*candidate].pins > 0) continue;
+        ++it;   // Stays valid when the candidate is erased
+        evictLibraryClip(library, *candidate);
+    }
+    return &clip;
+}
+
+// ----------------------------------------------------------------------------
+void releaseLibraryClip(ClipLibrary *library, int clipId) {
+    library->clips[clipId].pins--;
+}
+
+// ----------------------------------------------------------------------------
+void closeClipLibrary(ClipLibrary *library) {
+    while (!library->resident.empty()) evictLibraryClip(library, library->resident.front());
+#ifndef _WIN32
+    if (library->data != NULL) munmap(library->data, library->size);
+#endif
+    library->data = NULL;
+    library->clips.clear();
+}
+
+#endif
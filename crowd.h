@@ -0,0 +1,599 @@
+// ----------------------------------------------------------------------------
+// Crowd of animated characters sharing one model
+//
+// Every instance of the crowd plays one of the model's clips from its own
+// time offset and at its own speed, at its own place on the floor. What does
+// not change per instance is shared: the scene (meshes, materials, node
+// hierarchy), the skeleton, the skin meshes, the bone joints and offsets of
+// the palettes, the clips (raw, baked or compressed), and the static vertex
+// and index buffers of the render queue. An instance holds only its pose,
+// joint transforms and palette matrices, plus, when skinned on the CPU, its
+// skinned vertices and a stream buffer per render batch.
+//
+// Poses are evaluated in parallel over instances. When vertex shader
+// skinning is enabled (see gpu_skinning.h) and the skinning mode is linear
+// blend, the instances' matrices go to one texture buffer and each batch is
+// drawn for the whole crowd with one instanced draw call. Otherwise skinning
+// runs on the CPU in parallel over instances x chunks, into per-instance
+// buffers allocated on the first CPU frame, and drawing goes batch by batch
+// and, inside a batch, instance by instance, so material state changes once
+// per batch no matter how large the crowd is. With a skin cache (see
+// skin_cache.h), instances at the same quantised time of the same clip share
+// one skinned copy, which is posed, skinned and uploaded once.
+//
+// With levels of detail (see mesh_lod.h), every instance picks its level
+// from its projected size, seen from lodView, before it is skinned: the CPU
+// path skins and streams only the vertices of that level, and both paths
+// draw only its triangles.
+//
+// The per-frame lists of updateCrowd (instances to pose and to skin, skin
+// tasks, block offsets) come from the crowd's frame arena, and spawnCrowd
+// sizes the arena, the GPU staging buffer and the skin cache's pool of
+// skinned copies for the whole crowd, so after the first frames a frame
+// allocates nothing. Instances that bypass a full cache skin into copies of
+// a separate pool, which grows to the most bypasses seen in one frame and
+// is reused by the following frames; only without the cache does every
+// instance get a copy of its own.
+//
+// With culling (see bone_bounds.h), the bound of every posed instance is
+// taken from its palettes, and instances that are out of view, shadow
+// included, are neither skinned nor drawn. Their pose is still evaluated,
+// since the bound depends on it.
+//-----------------------------------------------------------------------------
+
+#ifndef CROWD_H
+#define CROWD_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <list>
+#include <random>
+#include <vector>
+#include <GL/glew.h>
+#include <assimp/scene.h>
+#include "skeleton.h"
+#include "anim_sampler.h"
+#include "anim_bake.h"
+#include "anim_compress.h"
+#include "skinning.h"
+#include "thread_pool.h"
+#include "render_queue.h"
+#include "gpu_skinning.h"
+#include "skin_cache.h"
+#include "bone_bounds.h"
+#include "frame_arena.h"
+
+#define CROWD_REPORT_MS 2000.0   // Interval between crowd frame time reports
+
+struct CrowdClip {
+    const aiAnimation *anim;
+    std::vector<int> channelJoints;    // Joint index for each channel of anim
+    int pinnedChannel = -1;            // Channel whose translation is zeroed (-1 if none)
+    BakedClip *baked = NULL;           // Shared baked copy of anim, if baking is enabled
+    CompressedClip *compressed = NULL; // Shared compressed copy of anim, if compression is enabled
+};
+
+struct CrowdInstance {
+    int clipId;
+    double timeOffset;                 // In ticks
+    double speed;                      // Playback speed relative to the viewer's
+    float x, z, heading;               // Position on the floor and rotation about y, in degrees
+    AnimSampler sampler;               // Key cursors (unused if the clip is baked or compressed)
+    CompressedSampler compressedSampler;
+    std::vector<JointPose> pose;       // One per channel of the clip
+    std::vector<aiMatrix4x4> locals, globals;   // One per joint of the shared skeleton
+    std::vector<BonePalette> palettes; // Matrices only; bone joints and offsets are in Crowd::bindPalettes
+    std::vector<aiMatrix4x4> batchTransforms;   // Transformation of each render batch's node
+    double tick;                       // Clip time of the current frame
+    int lod = 0;                       // Level of detail of the current frame
+    int block = 0;                     // Index of its block on the GPU path (blocks are sorted by level)
+    BoundingBox bounds;                // Bound of the current pose, in the model's space
+    bool visible = true;               // In view in the current frame
+
+    SkinOutput own;                    // CPU skinning output, empty until needed without the cache
+    SkinOutput *output = NULL;         // What to draw on the CPU path: own, a skin cache entry's or a bypass copy
+};
+
+struct Crowd {
+    const aiScene *scene = NULL;
+    const Skeleton *skeleton = NULL;
+    const std::vector<SkinMesh> *skinMeshes = NULL;
+    const std::vector<BonePalette> *bindPalettes = NULL;
+    const std::vector<std::vector<SkinChunk> > *levelChunks = NULL;   // Chunks of each level of detail
+    const BoneBounds *boneBounds = NULL;
+    const RenderQueue *queue = NULL;
+    std::vector<CrowdClip> clips;
+    std::vector<aiMatrix4x4> bindLocals;     // Joint transforms of the bind pose
+    std::vector<int> batchJoints;            // Joint of each batch's node (-1 if not in the skeleton)
+    std::vector<aiMatrix4x4> batchStatic;    // Global transform of each batch's node, if not in the skeleton
+    std::vector<CrowdInstance> instances;
+    GpuSkinning gpu;                         // Vertex shader skinning, if enabled
+    bool skinnedOnGpu = false;               // Path taken by the last updateCrowd
+    SkinCache skinCache;                     // Shared CPU skinning results, if its budget is set
+    size_t outputBytes = 0;                  // Size of a SkinOutput (CPU and GPU copies)
+    bool ownOutputs = false;                 // Whether every instance has its own skinned copy
+    std::list<SkinOutput> bypassOutputs;     // Skinned copies for instances bypassing the cache, reused every frame
+    FrameArena scratch;                      // Per-frame lists of updateCrowd, reset at its start
+    LodView lodView;                         // Camera the levels of detail are picked for
+    std::vector<int> levelCounts;            // Visible instances at each level of detail in the current frame
+    CullView cullView;                       // What instances must be in view of to be skinned and drawn
+    int numVisible = 0;                      // Instances in view in the current frame
+
+    // Accumulated since the last report
+    double reportFrameMs = 0, reportUpdateMs = 0, reportDrawMs = 0;
+    int reportFrames = 0;
+};
+
+// ----------------------------------------------------------------------------
+// Shares the model data of a viewer. levelChunks holds the skinning chunks
+// of each level of detail (just one without levels of detail). Must be
+// called before the nodes are first posed, so that their transformations
+// are still the bind pose.
+void initCrowd(Crowd *crowd, const aiScene *scene, const Skeleton &skeleton,
+               const std::vector<SkinMesh> &skinMeshes, const std::vector<BonePalette> &bindPalettes,
+               const std::vector<std::vector<SkinChunk> > &levelChunks, const BoneBounds &boneBounds,
+               const RenderQueue &queue) {
+    crowd->scene = scene;
+    crowd->skeleton = &skeleton;
+    crowd->skinMeshes = &skinMeshes;
+    crowd->bindPalettes = &bindPalettes;
+    crowd->levelChunks = &levelChunks;
+    crowd->boneBounds = &boneBounds;
+    crowd->queue = &queue;
+
+    crowd->bindLocals.resize(skeleton.nodes.size());
+    for (int j = 0; j < skeleton.nodes.size(); j++)
+        crowd->bindLocals[j] = skeleton.nodes[j]->mTransformation;
+
+    crowd->outputBytes = 0;
+    for (int meshId = 0; meshId < scene->mNumMeshes; meshId++)
+        crowd->outputBytes += 4 * scene->mMeshes[meshId]->mNumVertices * sizeof(aiVector3D);
+
+    crowd->batchJoints.assign(queue.batches.size(), -1);
+    crowd->batchStatic.resize(queue.batches.size());
+    for (int b = 0; b < queue.batches.size(); b++) {
+        for (int j = 0; j < skeleton.nodes.size(); j++)
+            if (skeleton.nodes[j] == queue.batches[b].node) crowd->batchJoints[b] = j;
+        crowd->batchStatic[b] = queue.batches[b].transform;
+    }
+}
+
+// One skinning task of a frame: a chunk of an instance
+struct CrowdSkinTask {
+    int skinned;   // Index into the frame's list of skinned instances
+    int chunk;
+};
+
+// ----------------------------------------------------------------------------
+void addCrowdClip(Crowd *crowd, const aiAnimation *anim, int pinnedChannel = -1, BakedClip *baked = NULL,
+                  CompressedClip *compressed = NULL) {
+    CrowdClip clip;
+    clip.anim = anim;
+    clip.channelJoints = mapChannelsToJoints(*crowd->skeleton, anim);
+    clip.pinnedChannel = pinnedChannel;
+    clip.baked = baked != NULL && baked->numFrames > 0 ? baked : NULL;
+    clip.compressed = compressed != NULL && !compressed->channels.empty() ? compressed : NULL;
+    crowd->clips.push_back(clip);
+}
+
+// ----------------------------------------------------------------------------
+// Skins the crowd in the vertex shader from now on, when the skinning mode
+// allows. Returns false if the GL implementation can't.
+bool enableCrowdGpuSkinning(Crowd *crowd) {
+    return buildGpuSkinning(&crowd->gpu, *crowd->queue, *crowd->skinMeshes, *crowd->bindPalettes);
+}
+
+// ----------------------------------------------------------------------------
+void releaseCrowdInstances(Crowd *crowd) {
+    for (int i = 0; i < crowd->instances.size(); i++) releaseSkinOutput(&crowd->instances[i].own);
+    crowd->instances.clear();
+    crowd->ownOutputs = false;
+}
+
+// ----------------------------------------------------------------------------
+void releaseCrowd(Crowd *crowd) {
+    releaseCrowdInstances(crowd);
+    for (std::list<SkinOutput>::iterator it = crowd->bypassOutputs.begin(); it != crowd->bypassOutputs.end(); ++it)
+        releaseSkinOutput(&*it);
+    crowd->bypassOutputs.clear();
+    releaseGpuSkinning(&crowd->gpu);
+    clearSkinCache(&crowd->skinCache);
+}
+
+// ----------------------------------------------------------------------------
+// Allocates a skinned copy of the crowd's model. Needs a GL context.
+void allocateSkinOutput(const Crowd &crowd, SkinOutput *output) {
+    const aiScene *scene = crowd.scene;
+    output->vertices.resize(scene->mNumMeshes);
+    output->normals.resize(scene->mNumMeshes);
+    output->vertexPtrs.resize(scene->mNumMeshes);
+    output->normalPtrs.resize(scene->mNumMeshes);
+    for (int meshId = 0; meshId < scene->mNumMeshes; meshId++) {
+        output->vertices[meshId].resize(scene->mMeshes[meshId]->mNumVertices);
+        output->normals[meshId].resize(scene->mMeshes[meshId]->mNumVertices);
+        output->vertexPtrs[meshId] = output->vertices[meshId].empty() ? NULL : &output->vertices[meshId][0];
+        output->normalPtrs[meshId] = output->normals[meshId].empty() ? NULL : &output->normals[meshId][0];
+    }
+    output->gpuMeshes.resize(crowd.queue->batches.size());
+    output->batchTransforms.resize(crowd.queue->batches.size());
+    for (int b = 0; b < output->gpuMeshes.size(); b++)
+        createGpuMeshInstance(&output->gpuMeshes[b], crowd.queue->batches[b].gpu);
+}
+
+// ----------------------------------------------------------------------------
+// Gives every instance its own skinned copy, if it hasn't one yet. Done for
+// the whole crowd at once, the first frame skinned without the cache, so
+// that instances coming into view later don't allocate. Needs a GL context.
+void allocateOwnSkinOutputs(Crowd *crowd) {
+    if (crowd->ownOutputs) return;
+    for (int i = 0; i < crowd->instances.size(); i++)
+        if (crowd->instances[i].own.gpuMeshes.empty()) allocateSkinOutput(*crowd, &crowd->instances[i].own);
+    crowd->ownOutputs = true;
+}
+
+// ----------------------------------------------------------------------------
+// Fills the skin cache's spare list with as many skinned copies as its
+// budget holds, so that entries are recycled from the first frame on instead
+// of being allocated while frames run. Needs a GL context.
+void fillSkinCachePool(Crowd *crowd) {
+    SkinCache &cache = crowd->skinCache;
+    if (!skinCacheEnabled(cache) || crowd->outputBytes == 0) return;
+    size_t count = cache.budgetBytes / crowd->outputBytes;
+    while (cache.entries.size() + cache.spare.size() < count) {
+        cache.spare.push_back(SkinCacheEntry());
+        allocateSkinOutput(*crowd, &cache.spare.back().output);
+    }
+    cache.index.reserve(count);
+}
+
+// ----------------------------------------------------------------------------
+// Replaces the crowd with count instances spread over the square
+// [-halfSize, halfSize] of the floor, with random clips, headings, time
+// offsets and speeds. With numPhases > 0 the instances play at the viewer's
+// speed, each from one of numPhases evenly spaced offsets, like troops
+// marching in step. Needs a GL context.
+void spawnCrowd(Crowd *crowd, int count, float halfSize, int numPhases = 0, unsigned seed = 1) {
+    releaseCrowdInstances(crowd);
+    if (crowd->clips.empty()) return;
+    if (crowd->gpu.ready && count > gpuSkinMaxInstances(crowd->gpu)) {
+        count = gpuSkinMaxInstances(crowd->gpu);
+        std::cout << "The crowd is limited to " << count << " instances by the texture buffer size" << std::endl;
+    }
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    int side = (int) std::ceil(std::sqrt((double) count));
+    float spacing = 2.0f * halfSize / side;
+    const aiScene *scene = crowd->scene;
+
+    crowd->instances.resize(count);
+    for (int i = 0; i < count; i++) {
+        CrowdInstance &inst = crowd->instances[i];
+        inst.clipId = std::min((int) (unit(rng) * crowd->clips.size()), (int) crowd->clips.size() - 1);
+        const CrowdClip &clip = crowd->clips[inst.clipId];
+        if (numPhases > 0) {
+            inst.timeOffset = std::min((int) (unit(rng) * numPhases), numPhases - 1) * clip.anim->mDuration / numPhases;
+            inst.speed = 1.0;
+        } else {
+            inst.timeOffset = unit(rng) * clip.anim->mDuration;
+            inst.speed = 0.8 + 0.4 * unit(rng);
+        }
+        inst.x = -halfSize + spacing * (i % side + 0.25f + 0.5f * unit(rng));
+        inst.z = -halfSize + spacing * (i / side + 0.25f + 0.5f * unit(rng));
+        inst.heading = 360.0f * unit(rng);
+
+        if (clip.compressed != NULL) initCompressedSampler(&inst.compressedSampler, clip.compressed);
+        else if (clip.baked == NULL) initAnimSampler(&inst.sampler, clip.anim);
+        inst.pose.resize(clip.anim->mNumChannels);
+        inst.locals = crowd->bindLocals;
+        inst.globals.resize(crowd->bindLocals.size());
+        inst.palettes.resize(scene->mNumMeshes);
+        for (int meshId = 0; meshId < scene->mNumMeshes; meshId++)
+            inst.palettes[meshId].matrices = (*crowd->bindPalettes)[meshId].matrices;
+        inst.batchTransforms = crowd->batchStatic;
+    }
+
+    size_t maxChunks = 0;
+    for (int level = 0; level < crowd->levelChunks->size(); level++)
+        maxChunks = std::max(maxChunks, (*crowd->levelChunks)[level].size());
+    reserveFrameArena(&crowd->scratch, count * (2 * sizeof(int) + maxChunks * sizeof(CrowdSkinTask))
+                                       + crowd->levelChunks->size() * sizeof(int) + 4 * FRAME_ARENA_ALIGNMENT);
+    if (crowd->gpu.ready) crowd->gpu.staging.reserve((size_t) count * crowd->gpu.blockTexels * 4);
+    fillSkinCachePool(crowd);
+}
+
+// ----------------------------------------------------------------------------
+// Clip time of an instance at the viewer's time, both in ticks
+double crowdInstanceTick(const Crowd &crowd, const CrowdInstance &inst, double time) {
+    return wrapAnimTime(time * inst.speed + inst.timeOffset, crowd.clips[inst.clipId].anim->mDuration);
+}
+
+// ----------------------------------------------------------------------------
+// Evaluates the pose of one instance at tick (clip time) and fills its
+// palettes, batch transforms and bound, with the palettes prepared for the
+// CPU kernels of mode if prepare is set. Touches nothing shared, so
+// instances can be posed in parallel.
+void poseCrowdInstance(const Crowd &crowd, CrowdInstance *inst, double tick, SkinMode mode, bool prepare) {
+    const CrowdClip &clip = crowd.clips[inst->clipId];
+    if (clip.baked != NULL)
+        evaluateBakedPose(*clip.baked, tick, &inst->pose[0]);
+    else if (clip.compressed != NULL)
+        samplePose(&inst->compressedSampler, tick, &inst->pose[0]);
+    else
+        samplePose(&inst->sampler, tick, &inst->pose[0]);
+
+    for (int i = 0; i < inst->pose.size(); i++) {
+        if (clip.channelJoints[i] < 0) continue;
+        if (i == clip.pinnedChannel) inst->pose[i].position = aiVector3D(0.0f, 0.0f, 0.0f);
+        inst->locals[clip.channelJoints[i]] = poseMatrix(inst->pose[i]);
+    }
+    computeGlobalTransforms(*crowd.skeleton, &inst->locals[0], &inst->globals[0]);
+
+    for (int meshId = 0; meshId < inst->palettes.size(); meshId++) {
+        updateBonePalette(&inst->palettes[meshId], (*crowd.bindPalettes)[meshId], &inst->globals[0]);
+        if (prepare) prepareSkinPalette(&inst->palettes[meshId], mode);
+    }
+    for (int b = 0; b < crowd.batchJoints.size(); b++)
+        if (crowd.batchJoints[b] >= 0) inst->batchTransforms[b] = inst->globals[crowd.batchJoints[b]];
+    inst->bounds = posedModelBounds(*crowd.boneBounds, *crowd.queue, inst->palettes, &inst->batchTransforms[0]);
+}
+
+// ----------------------------------------------------------------------------
+bool crowdInstanceInView(const Crowd &crowd, const CrowdInstance &inst, const BoundingBox &bounds) {
+    return characterInView(crowd.cullView, bounds, aiVector3D(inst.x, 0.0f, inst.z), inst.heading);
+}
+
+// ----------------------------------------------------------------------------
+// Counts the visible instances at each level of detail, and gives them
+// blocks for the GPU path in level order. Uses the crowd's frame arena.
+void assignCrowdBlocks(Crowd *crowd) {
+    int numLevels = (int) crowd->levelChunks->size();
+    crowd->levelCounts.assign(numLevels, 0);
+    for (int i = 0; i < crowd->instances.size(); i++)
+        if (crowd->instances[i].visible) crowd->levelCounts[crowd->instances[i].lod]++;
+    int *nextBlock = frameArenaArray<int>(&crowd->scratch, numLevels);
+    nextBlock[0] = 0;
+    for (int level = 1; level < numLevels; level++)
+        nextBlock[level] = nextBlock[level - 1] + crowd->levelCounts[level - 1];
+    crowd->numVisible = nextBlock[numLevels - 1] + crowd->levelCounts[numLevels - 1];
+    for (int i = 0; i < crowd->instances.size(); i++) {
+        CrowdInstance &inst = crowd->instances[i];
+        inst.block = inst.visible ? nextBlock[inst.lod]++ : -1;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Key of the skinned copy an instance is drawn from, at its current tick
+SkinCacheKey crowdSkinCacheKey(const SkinCache &cache, const CrowdInstance &inst, SkinMode mode) {
+    SkinCacheKey key = {inst.clipId, (long long) std::floor(inst.tick / cache.step + 0.5), mode, inst.lod};
+    return key;
+}
+
+// ----------------------------------------------------------------------------
+// Poses every instance and culls those out of view. On the GPU path the
+// matrices of the visible ones are then uploaded; otherwise they are skinned
+// and streamed to their buffers.
+void updateCrowd(Crowd *crowd, double time, ThreadPool &pool, SkinMode mode) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int numInstances = (int) crowd->instances.size();
+    int numLevels = (int) crowd->levelChunks->size();
+    resetFrameArena(&crowd->scratch);
+    for (int i = 0; i < numInstances; i++) {
+        CrowdInstance &inst = crowd->instances[i];
+        inst.lod = std::min(selectLod(crowd->lodView, aiVector3D(inst.x, 0.0f, inst.z)), numLevels - 1);
+    }
+
+    crowd->skinnedOnGpu = crowd->gpu.ready && mode == SKIN_MODE_LINEAR;
+    if (crowd->skinnedOnGpu) {
+        GpuSkinning &gpu = crowd->gpu;
+        pool.parallelFor(numInstances, [&](int i) {
+            CrowdInstance &inst = crowd->instances[i];
+            poseCrowdInstance(*crowd, &inst, crowdInstanceTick(*crowd, inst, time), mode, false);
+            inst.visible = crowdInstanceInView(*crowd, inst, inst.bounds);
+        });
+        assignCrowdBlocks(crowd);
+        gpu.staging.resize((size_t) crowd->numVisible * gpu.blockTexels * 4);
+        pool.parallelFor(numInstances, [&](int i) {
+            CrowdInstance &inst = crowd->instances[i];
+            if (!inst.visible) return;
+            writeGpuSkinBlock(gpu, inst.palettes, &inst.batchTransforms[0], inst.x, inst.z, inst.heading,
+                              &gpu.staging[(size_t) inst.block * gpu.blockTexels * 4]);
+        });
+        uploadGpuSkinPalettes(&gpu, crowd->numVisible);
+        crowd->reportUpdateMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return;
+    }
+
+    // Instances found in the skin cache are drawn from it, if the bound it
+    // recorded is in view. The others are posed; those in view are then
+    // skinned, into a new cache entry when there is room.
+    SkinCache &cache = crowd->skinCache;
+    bool caching = skinCacheEnabled(cache);
+    if (!caching) allocateOwnSkinOutputs(crowd);
+    if (caching) beginSkinCacheFrame(&cache);
+    std::list<SkinOutput>::iterator nextBypass = crowd->bypassOutputs.begin();
+    int *posed = frameArenaArray<int>(&crowd->scratch, numInstances);
+    int numPosed = 0;
+    for (int i = 0; i < numInstances; i++) {
+        CrowdInstance &inst = crowd->instances[i];
+        inst.tick = crowdInstanceTick(*crowd, inst, time);
+        if (caching) {
+            SkinCacheKey key = crowdSkinCacheKey(cache, inst, mode);
+            inst.tick = key.sample * cache.step;
+            SkinCacheEntry *entry = findSkinCacheEntry(&cache, key);
+            if (entry != NULL) {
+                inst.output = &entry->output;
+                inst.visible = crowdInstanceInView(*crowd, inst, entry->output.bounds);
+                continue;
+            }
+        }
+        posed[numPosed++] = i;
+    }
+
+    pool.parallelFor(numPosed, [&](int i) {
+        CrowdInstance &inst = crowd->instances[posed[i]];
+        poseCrowdInstance(*crowd, &inst, inst.tick, mode, false);
+        inst.visible = crowdInstanceInView(*crowd, inst, inst.bounds);
+    });
+
+    // An instance missing from the cache may find an entry another one
+    // added in this frame
+    int *skinned = frameArenaArray<int>(&crowd->scratch, numPosed);
+    int numSkinned = 0;
+    for (int i = 0; i < numPosed; i++) {
+        CrowdInstance &inst = crowd->instances[posed[i]];
+        if (!inst.visible) {
+            inst.output = NULL;
+            continue;
+        }
+        if (caching) {
+            SkinCacheKey key = crowdSkinCacheKey(cache, inst, mode);
+            SkinCacheEntry *entry = findSkinCacheEntry(&cache, key);
+            if (entry != NULL) {
+                inst.output = &entry->output;
+                continue;
+            }
+            entry = insertSkinCacheEntry(&cache, key, crowd->outputBytes);
+            if (entry != NULL) {
+                if (entry->output.gpuMeshes.empty()) allocateSkinOutput(*crowd, &entry->output);
+                inst.output = &entry->output;
+                skinned[numSkinned++] = posed[i];
+                continue;
+            }
+
+            // Every entry is in use in this frame: skin into a bypass copy
+            if (nextBypass == crowd->bypassOutputs.end()) {
+                nextBypass = crowd->bypassOutputs.insert(nextBypass, SkinOutput());
+                allocateSkinOutput(*crowd, &*nextBypass);
+            }
+            inst.output = &*nextBypass++;
+        } else {
+            inst.output = &inst.own;
+        }
+        skinned[numSkinned++] = posed[i];
+    }
+    assignCrowdBlocks(crowd);
+
+    pool.parallelFor(numSkinned, [&](int i) {
+        CrowdInstance &inst = crowd->instances[skinned[i]];
+        for (int meshId = 0; meshId < inst.palettes.size(); meshId++) prepareSkinPalette(&inst.palettes[meshId], mode);
+        inst.output->batchTransforms = inst.batchTransforms;
+        inst.output->bounds = inst.bounds;
+    });
+
+    int numTasks = 0;
+    for (int i = 0; i < numSkinned; i++) numTasks += (int) (*crowd->levelChunks)[crowd->instances[skinned[i]].lod].size();
+    CrowdSkinTask *skinTasks = frameArenaArray<CrowdSkinTask>(&crowd->scratch, numTasks);
+    numTasks = 0;
+    for (int i = 0; i < numSkinned; i++) {
+        int numChunks = (int) (*crowd->levelChunks)[crowd->instances[skinned[i]].lod].size();
+        for (int c = 0; c < numChunks; c++) {
+            CrowdSkinTask task = {i, c};
+            skinTasks[numTasks++] = task;
+        }
+    }
+    pool.parallelFor(numTasks, [&](int task) {
+        CrowdInstance &inst = crowd->instances[skinned[skinTasks[task].skinned]];
+        SkinOutput &output = *inst.output;
+        const SkinChunk &chunk = (*crowd->levelChunks)[inst.lod][skinTasks[task].chunk];
+        const SkinMesh &skin = (*crowd->skinMeshes)[chunk.meshId];
+        if (mode == SKIN_MODE_DUAL_QUAT)
+            skinVerticesDualQuat(skin, inst.palettes[chunk.meshId], output.vertexPtrs[chunk.meshId],
+                                 output.normalPtrs[chunk.meshId], chunk.begin, chunk.end);
+        else
+            skinVertices(skin, inst.palettes[chunk.meshId], output.vertexPtrs[chunk.meshId],
+                         output.normalPtrs[chunk.meshId], chunk.begin, chunk.end);
+    });
+
+    for (int i = 0; i < numSkinned; i++) {
+        const CrowdInstance &inst = crowd->instances[skinned[i]];
+        const SkinOutput &output = *inst.output;
+        for (int b = 0; b < output.gpuMeshes.size(); b++)
+            updateGpuMesh(crowd->scene, output.gpuMeshes[b], &output.vertexPtrs[0], &output.normalPtrs[0], inst.lod);
+    }
+    crowd->reportUpdateMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// ----------------------------------------------------------------------------
+// Draws every instance, like drawRenderQueue does the single model. An
+// instance is placed by translating it to its position, projecting it onto
+// the floor with applyShadowTransform in the shadow pass, rotating it to its
+// heading and applying applyModelTransform (the viewer's rotation and
+// scaling of the model).
+void drawCrowd(Crowd *crowd, bool isShadow, const float *overrideCol, void (*applyModelTransform)(),
+               void (*applyShadowTransform)()) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const RenderQueue &queue = *crowd->queue;
+    if (crowd->skinnedOnGpu) {
+        float model[16], shadow[16];
+        glPushMatrix();
+        glLoadIdentity();
+        applyModelTransform();
+        glGetFloatv(GL_MODELVIEW_MATRIX, model);
+        glLoadIdentity();
+        if (isShadow) applyShadowTransform();
+        glGetFloatv(GL_MODELVIEW_MATRIX, shadow);
+        glPopMatrix();
+        drawGpuSkinned(crowd->gpu, queue, crowd->levelCounts, isShadow, overrideCol, model, shadow);
+    } else {
+        MaterialState state;
+        beginMaterialState(&state, queue, isShadow);
+        for (int b = 0; b < queue.batches.size(); b++) {
+            const DrawBatch &batch = queue.batches[b];
+            for (int i = 0; i < crowd->instances.size(); i++) {
+                const CrowdInstance &inst = crowd->instances[i];
+                if (inst.output == NULL || !inst.visible) continue;   // Not skinned yet, or culled
+                applyBatchMaterial(&state, queue, batch, isShadow, overrideCol);
+
+                aiMatrix4x4 m = inst.output->batchTransforms[b];
+                aiTransposeMatrix4(&m);   //Convert to column-major order
+                glPushMatrix();
+                glTranslatef(inst.x, 0, inst.z);
+                if (isShadow) applyShadowTransform();
+                glRotatef(inst.heading, 0, 1, 0);
+                applyModelTransform();
+                glMultMatrixf((float *) &m);
+                drawGpuMesh(inst.output->gpuMeshes[b], isShadow, inst.lod);
+                glPopMatrix();
+
+                endBatchMaterial(&state, batch, isShadow);
+            }
+        }
+        glDisable(GL_TEXTURE_2D);
+    }
+    crowd->reportDrawMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// ----------------------------------------------------------------------------
+// Adds a frame of frameMs and prints the average frame, update and draw
+// times every CROWD_REPORT_MS, with the skin cache counters, and the number of
+// visible instances and of those at each level of detail
+void reportCrowdFrame(Crowd *crowd, double frameMs) {
+    crowd->reportFrameMs += frameMs;
+    crowd->reportFrames++;
+    if (crowd->reportFrameMs < CROWD_REPORT_MS) return;
+
+    int n = crowd->reportFrames;
+    std::cout << "Crowd of " << crowd->instances.size() << ": frame " << crowd->reportFrameMs / n
+              << " ms (update " << crowd->reportUpdateMs / n << " ms, draw " << crowd->reportDrawMs / n
+              << " ms), " << 1000.0 * n / crowd->reportFrameMs << " fps" << std::endl;
+    if (crowd->cullView.enabled)
+        std::cout << "    in view: " << crowd->numVisible << " of " << crowd->instances.size() << " instances" << std::endl;
+    if (crowd->levelCounts.size() > 1) {
+        std::cout << "    levels of detail:";
+        for (int level = 0; level < crowd->levelCounts.size(); level++)
+            std::cout << (level > 0 ? " /" : "") << " " << crowd->levelCounts[level];
+        std::cout << " instances" << std::endl;
+    }
+    const SkinCache &cache = crowd->skinCache;
+    if (skinCacheEnabled(cache))
+        std::cout << "    skin cache: " << cache.hits << " hits, " << cache.misses << " misses, " << cache.evictions
+                  << " evictions, " << cache.bypasses << " bypasses, " << cache.usedBytes / (1024.0 * 1024.0)
+                  << " of " << cache.budgetBytes / (1024.0 * 1024.0) << " MB" << std::endl;
+    crowd->reportFrameMs = crowd->reportUpdateMs = crowd->reportDrawMs = 0;
+    crowd->reportFrames = 0;
+}
+
+#endif
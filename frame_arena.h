@@ -0,0 +1,147 @@
+// ----------------------------------------------------------------------------
+// Per-frame scratch memory, and a check that steady-state frames don't
+// allocate
+//
+// A frame arena hands out scratch arrays that live until the end of the
+// frame by bumping an offset into one block, and resetFrameArena frees them
+// all at once. A frame that needs more than the block gets the rest from the
+// heap; the next reset grows the block to the most any frame has used, so
+// once the workload settles no frame touches the heap for its scratch. Only
+// trivially constructible types belong in an arena: nothing is constructed
+// or destroyed.
+//
+// With FRAME_ALLOC_CHECK defined, the global operator new and delete are
+// replaced by versions that count allocations (from every thread), and a
+// FrameAllocScope around a frame's update or display asserts that none were
+// made once FRAME_ALLOC_WARMUP scopes have passed since the check was
+// (re)started. Buffers that are filled on first use (skinned copies, GPU
+// staging) are warmed up by then. Viewers restart the check on input, which
+// can change what a frame does. Each program is a single translation unit,
+// so the replacements can live in this header. Allocations made through
+// malloc (e.g. by the GL driver) are not counted. Without the macro the
+// scope compiles to nothing.
+//-----------------------------------------------------------------------------
+
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#define FRAME_ARENA_ALIGNMENT 16
+#define FRAME_ALLOC_WARMUP 240   // Scopes after a (re)start whose allocations are allowed (two per frame)
+
+struct FrameArena {
+    std::vector<char> block;
+    size_t used = 0;               // Bytes of block handed out in the current frame
+    size_t frameBytes = 0;         // Bytes asked for in the current frame, overflow included
+    size_t highWater = 0;          // Most bytes asked for in one frame
+    std::vector<char *> overflow;  // Heap allocations of the current frame that didn't fit in block
+};
+
+// ----------------------------------------------------------------------------
+// Returns bytes of scratch memory aligned to align (a power of two), valid
+// until the next reset
+void *frameArenaAlloc(FrameArena *arena, size_t bytes, size_t align = FRAME_ARENA_ALIGNMENT) {
+    arena->frameBytes += bytes + align - 1;
+    if (!arena->block.empty()) {
+        uintptr_t base = (uintptr_t) &arena->block[0];
+        size_t offset = ((base + arena->used + align - 1) & ~(uintptr_t) (align - 1)) - base;
+        if (offset + bytes <= arena->block.size()) {
+            arena->used = offset + bytes;
+            return &arena->block[offset];
+        }
+    }
+    char *memory = new char[bytes + align - 1];
+    arena->overflow.push_back(memory);
+    return (void *) (((uintptr_t) memory + align - 1) & ~(uintptr_t) (align - 1));
+}
+
+// ----------------------------------------------------------------------------
+template <typename T>
+T *frameArenaArray(FrameArena *arena, size_t count) {
+    return (T *) frameArenaAlloc(arena, count * sizeof(T), alignof(T) > FRAME_ARENA_ALIGNMENT ? alignof(T) : FRAME_ARENA_ALIGNMENT);
+}
+
+// ----------------------------------------------------------------------------
+// Frees everything handed out since the last reset. If the frame overflowed
+// the block, the block is grown to hold the largest frame so far.
+void resetFrameArena(FrameArena *arena) {
+    arena->highWater = std::max(arena->highWater, arena->frameBytes);
+    if (!arena->overflow.empty()) {
+        for (int i = 0; i < arena->overflow.size(); i++) delete[] arena->overflow[i];
+        arena->overflow.clear();
+        arena->block.assign(arena->highWater + arena->highWater / 2, 0);
+    }
+    arena->used = 0;
+    arena->frameBytes = 0;
+}
+
+// ----------------------------------------------------------------------------
+// Makes sure the block holds at least bytes, so frames up to that size never
+// overflow
+void reserveFrameArena(FrameArena *arena, size_t bytes) {
+    if (arena->used == 0 && arena->overflow.empty() && arena->block.size() < bytes) arena->block.assign(bytes, 0);
+}
+
+// ----------------------------------------------------------------------------
+#ifdef FRAME_ALLOC_CHECK
+#include <atomic>
+
+std::atomic<unsigned long long> heapAllocations(0);   // operator new calls since the program started
+
+void *operator new(size_t size) {
+    heapAllocations++;
+    void *p = malloc(size > 0 ? size : 1);
+    if (p == NULL) throw std::bad_alloc();
+    return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    heapAllocations++;
+    return malloc(size > 0 ? size : 1);
+}
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept { return operator new(size, tag); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+#endif
+
+struct FrameAllocCheck {
+    int scopes = 0;   // Scopes checked since the last restart
+};
+
+// ----------------------------------------------------------------------------
+// Allows allocations again for the next FRAME_ALLOC_WARMUP scopes, e.g.
+// after input that changes the work of a frame
+void restartFrameAllocCheck(FrameAllocCheck *check) {
+    check->scopes = 0;
+}
+
+// Asserts that the scope made no heap allocations, once the check has warmed up
+struct FrameAllocScope {
+#ifdef FRAME_ALLOC_CHECK
+    FrameAllocCheck &check;
+    const char *stage;
+    unsigned long long start;
+
+    FrameAllocScope(FrameAllocCheck &check, const char *stage)
+        : check(check), stage(stage), start(heapAllocations.load()) {}
+    ~FrameAllocScope() {
+        unsigned long long count = heapAllocations.load() - start;
+        if (check.scopes >= FRAME_ALLOC_WARMUP && count > 0) {
+            std::cout << count << " heap allocation(s) in steady-state " << stage << std::endl;
+            assert(count == 0);
+        }
+        if (check.scopes < FRAME_ALLOC_WARMUP) check.scopes++;
+    }
+#else
+    FrameAllocScope(FrameAllocCheck &, const char *) {}
+#endif
+};
+
+#endif
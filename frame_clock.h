@@ -0,0 +1,56 @@
+// ----------------------------------------------------------------------------
+// Wall-clock frame loop
+//
+// The viewers advance their animation and movement by the real time elapsed
+// since the previous frame, so playback speed no longer depends on timer
+// jitter and frames can be rendered at any rate. Rendering is paced by the
+// swap interval: 1 waits for the display refresh, 0 renders unthrottled.
+//-----------------------------------------------------------------------------
+
+#ifndef FRAME_CLOCK_H
+#define FRAME_CLOCK_H
+
+#include <algorithm>
+#include <chrono>
+#include <GL/glew.h>
+#ifdef _WIN32
+#include <GL/wglew.h>
+#else
+#include <GL/glxew.h>
+#endif
+
+#define MAX_FRAME_STEP_MS 250.0   // Longer stalls (e.g. a dragged window) are not played back
+
+struct FrameClock {
+    bool started = false;
+    std::chrono::steady_clock::time_point last;
+};
+
+// ----------------------------------------------------------------------------
+// Returns the time in ms since the previous call (0 on the first call)
+double frameClockStep(FrameClock *clock) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double elapsed = clock->started ? std::chrono::duration<double, std::milli>(now - clock->last).count() : 0.0;
+    clock->last = now;
+    clock->started = true;
+    return std::min(elapsed, MAX_FRAME_STEP_MS);
+}
+
+// ----------------------------------------------------------------------------
+// Sets the number of display refreshes per buffer swap of the current
+// context. Returns false if the window system has no swap control.
+bool setSwapInterval(int interval) {
+#ifdef _WIN32
+    if (WGLEW_EXT_swap_control) return wglSwapIntervalEXT(interval) == TRUE;
+#else
+    if (GLXEW_EXT_swap_control) {
+        glXSwapIntervalEXT(glXGetCurrentDisplay(), glXGetCurrentDrawable(), interval);
+        return true;
+    }
+    if (GLXEW_MESA_swap_control) return glXSwapIntervalMESA(interval) == 0;
+    if (GLXEW_SGI_swap_control && interval > 0) return glXSwapIntervalSGI(interval) == 0;
+#endif
+    return false;
+}
+
+#endif
@@ -0,0 +1,193 @@
+// ----------------------------------------------------------------------------
+// Per-stage frame timing
+//
+// Scoped timers add the CPU time of each stage of a frame (pose evaluation,
+// skinning, bounding box, floor, shadow pass and model pass) to the current
+// frame; commitFrameStats then moves the frame into a ring buffer holding the
+// last FRAME_STATS_FRAMES frames, together with the wall time since the
+// previous frame. The draw stages measure the time spent issuing GL commands,
+// not GPU time. While collection is disabled a timer costs one branch and
+// never reads the clock.
+//
+// The ring can be shown as a HUD (rolling averages and a frame-time graph)
+// or written to a CSV file, oldest frame first.
+//-----------------------------------------------------------------------------
+
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <GL/freeglut.h>
+
+#define FRAME_STATS_FRAMES 600
+
+typedef std::chrono::steady_clock StatsClock;
+
+enum FrameStage {
+    STAGE_POSE,       // updateNodeMatrices
+    STAGE_SKIN,       // transformVertices
+    STAGE_BOUNDS,     // Animated bound and culling of the model
+    STAGE_FLOOR,      // drawFloor
+    STAGE_SHADOW,     // Planar shadow pass
+    STAGE_MODEL,      // Lit model pass
+    NUM_FRAME_STAGES
+};
+
+const char *frameStageNames[NUM_FRAME_STAGES] = {"pose", "skin", "bounds", "floor", "shadow", "model"};
+
+struct FrameStats {
+    bool enabled = false;
+    int capacity = 0;
+    int head = 0;                 // Next row to write
+    int count = 0;                // Rows in use
+    std::vector<float> rows;      // capacity rows of frame time then NUM_FRAME_STAGES stage times, in ms
+    double current[NUM_FRAME_STAGES] = {};
+    bool hasLastFrame = false;
+    StatsClock::time_point lastFrame;
+};
+
+#define FRAME_STATS_COLUMNS (NUM_FRAME_STAGES + 1)
+
+// Adds the time until the end of the scope to a stage of the current frame
+struct StageTimer {
+    FrameStats &stats;
+    FrameStage stage;
+    StatsClock::time_point start;
+
+    StageTimer(FrameStats &stats, FrameStage stage) : stats(stats), stage(stage) {
+        if (stats.enabled) start = StatsClock::now();
+    }
+
+    ~StageTimer() {
+        if (stats.enabled)
+            stats.current[stage] += std::chrono::duration<double, std::milli>(StatsClock::now() - start).count();
+    }
+};
+
+// ----------------------------------------------------------------------------
+void initFrameStats(FrameStats *stats, int capacity, bool enabled) {
+    stats->capacity = capacity;
+    stats->rows.assign(capacity * FRAME_STATS_COLUMNS, 0.0f);
+    stats->head = stats->count = 0;
+    stats->enabled = enabled;
+    stats->hasLastFrame = false;
+}
+
+// ----------------------------------------------------------------------------
+void setFrameStatsEnabled(FrameStats *stats, bool enabled) {
+    if (enabled && !stats->enabled) {
+        std::fill(stats->current, stats->current + NUM_FRAME_STAGES, 0.0);
+        stats->hasLastFrame = false;   // Don't count the time spent disabled as a frame
+    }
+    stats->enabled = enabled;
+}
+
+// ----------------------------------------------------------------------------
+// Ends the current frame and stores it in the ring
+void commitFrameStats(FrameStats *stats) {
+    if (!stats->enabled) return;
+    StatsClock::time_point now = StatsClock::now();
+    float *row = &stats->rows[stats->head * FRAME_STATS_COLUMNS];
+    row[0] = stats->hasLastFrame ? std::chrono::duration<float, std::milli>(now - stats->lastFrame).count() : 0.0f;
+    for (int s = 0; s < NUM_FRAME_STAGES; s++) {
+        row[s + 1] = (float) stats->current[s];
+        stats->current[s] = 0.0;
+    }
+    stats->lastFrame = now;
+    stats->hasLastFrame = true;
+    stats->head = (stats->head + 1) % stats->capacity;
+    stats->count = std::min(stats->count + 1, stats->capacity);
+}
+
+// ----------------------------------------------------------------------------
+// Row i of the ring, 0 being the oldest frame
+const float *frameStatsRow(const FrameStats &stats, int i) {
+    int row = (stats.head - stats.count + i + stats.capacity) % stats.capacity;
+    return &stats.rows[row * FRAME_STATS_COLUMNS];
+}
+
+// ----------------------------------------------------------------------------
+bool writeFrameStatsCsv(const FrameStats &stats, const std::string &path) {
+    std::ofstream csv(path.c_str());
+    if (!csv) return false;
+    csv << "frame,frame_ms";
+    for (int s = 0; s < NUM_FRAME_STAGES; s++) csv << "," << frameStageNames[s] << "_ms";
+    csv << "\n";
+    for (int i = 0; i < stats.count; i++) {
+        const float *row = frameStatsRow(stats, i);
+        csv << i;
+        for (int c = 0; c < FRAME_STATS_COLUMNS; c++) csv << "," << row[c];
+        csv << "\n";
+    }
+    return (bool) csv;
+}
+
+// ----------------------------------------------------------------------------
+// Draws rolling averages and a graph of the frame times over the scene.
+// Needs GLUT for the bitmap font, so it is only used by the interactive viewers.
+void drawFrameStatsHud(const FrameStats &stats, int width, int height) {
+    double sums[FRAME_STATS_COLUMNS] = {};
+    float maxFrame = 1000.0f / 30.0f;
+    for (int i = 0; i < stats.count; i++) {
+        const float *row = frameStatsRow(stats, i);
+        for (int c = 0; c < FRAME_STATS_COLUMNS; c++) sums[c] += row[c];
+        maxFrame = std::max(maxFrame, row[0]);
+    }
+    int n = std::max(stats.count, 1);
+
+    glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_TEXTURE_2D);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, width, 0, height);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+
+    char line[64];
+    glColor3f(0, 0, 0);
+    snprintf(line, sizeof(line), "frame %6.2f ms  (%d frames)", sums[0] / n, stats.count);
+    glRasterPos2i(10, height - 20);
+    glutBitmapString(GLUT_BITMAP_8_BY_13, (const unsigned char *) line);
+    for (int s = 0; s < NUM_FRAME_STAGES; s++) {
+        snprintf(line, sizeof(line), "%-7s %6.3f ms", frameStageNames[s], sums[s + 1] / n);
+        glRasterPos2i(10, height - 36 - 14 * s);
+        glutBitmapString(GLUT_BITMAP_8_BY_13, (const unsigned char *) line);
+    }
+
+    // Frame times, newest on the right, with a line at 30 fps
+    const int graphX = 10, graphY = 10, graphW = 200, graphH = 60;
+    glBegin(GL_LINE_LOOP);
+    glVertex2i(graphX, graphY);
+    glVertex2i(graphX + graphW, graphY);
+    glVertex2i(graphX + graphW, graphY + graphH);
+    glVertex2i(graphX, graphY + graphH);
+    glEnd();
+    glColor3f(0, 0.6, 0);
+    glBegin(GL_LINES);
+    glVertex2f(graphX, graphY + graphH * (1000.0f / 30.0f) / maxFrame);
+    glVertex2f(graphX + graphW, graphY + graphH * (1000.0f / 30.0f) / maxFrame);
+    glEnd();
+    glColor3f(0.8, 0, 0);
+    glBegin(GL_LINE_STRIP);
+    for (int i = 0; i < stats.count; i++)
+        glVertex2f(graphX + graphW * (i + stats.capacity - stats.count) / (float) (stats.capacity - 1),
+                   graphY + graphH * frameStatsRow(stats, i)[0] / maxFrame);
+    glEnd();
+
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopAttrib();
+}
+
+#endif
@@ -0,0 +1,448 @@
+// ----------------------------------------------------------------------------
+// Instanced vertex-shader skinning
+//
+// The bind pose, bone indices and weights of every render batch are uploaded
+// once, next to the batch's static texture coordinate and colour buffer and
+// index buffer, which are shared with the fixed-function path. Each frame the
+// placement and the skinning matrices of every instance are written to one
+// texture buffer, and each batch is drawn for all instances with a single
+// instanced draw call; the vertex shader fetches the matrices of its instance
+// by gl_InstanceID and blends them.
+//
+// Texture buffer layout, in RGBA32F texels, one block of blockTexels per
+// instance: texel 0 holds (x, z, cos heading, sin heading), followed by rows
+// 1-3 of the skinning matrix of every bone slot. A slot is one bone of one
+// mesh of one batch, premultiplied by the transformation of the batch's node,
+// so a batch merging several meshes still needs one draw.
+//
+// The shaders reproduce the viewers' fixed-function shading (light 0 per
+// vertex, colour material, GL_MODULATE texturing), with the light and
+// material read from the GL state at draw time. Only linear blend skinning
+// is done on the GPU. Needs GLSL 1.40, instanced draws, texture buffers and
+// vertex array objects (OpenGL 3.1); buildGpuSkinning returns false
+// otherwise, and the caller keeps skinning on the CPU.
+//
+// With levels of detail, the blocks are ordered by level and each batch is
+// drawn once per level in use, from that level's range of the index buffer,
+// with firstInstance pointing at the level's first block.
+//-----------------------------------------------------------------------------
+
+#ifndef GPU_SKINNING_H
+#define GPU_SKINNING_H
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <GL/glew.h>
+#include <assimp/scene.h>
+#include "skeleton.h"
+#include "skinning.h"
+#include "render_queue.h"
+
+enum GpuSkinAttrib {
+    ATTRIB_POSITION,
+    ATTRIB_NORMAL,
+    ATTRIB_BONES,
+    ATTRIB_WEIGHTS,
+    ATTRIB_TEXCOORD,
+    ATTRIB_COLOR
+};
+
+#define GPU_SKIN_FLOATS 14   // Floats per vertex in GpuSkinBatch::skinVbo
+
+const char *gpuSkinVertexShader =
+        "#version 140\n"
+        "uniform samplerBuffer palettes;\n"
+        "uniform int blockTexels, firstInstance;\n"
+        "uniform mat4 projection, view, model, shadow;\n"
+        "uniform bool lit, vertexColors;\n"
+        "uniform vec4 materialColor, materialSpecular;\n"
+        "uniform float shininess;\n"
+        "uniform vec4 lightPosition, lightAmbient, lightDiffuse, lightSpecular, sceneAmbient;\n"
+        "in vec3 position;\n"
+        "in vec3 normal;\n"
+        "in vec4 bones;\n"
+        "in vec4 weights;\n"
+        "in vec2 texCoord;\n"
+        "in vec4 color;\n"
+        "out vec4 litColor;\n"
+        "out vec2 fragTexCoord;\n"
+        "void main() {\n"
+        "    int base = (firstInstance + gl_InstanceID) * blockTexels;\n"
+        "    vec4 r0 = vec4(0.0), r1 = vec4(0.0), r2 = vec4(0.0);\n"
+        "    for (int k = 0; k < 4; k++) {\n"
+        "        int t = base + 1 + 3 * int(bones[k]);\n"
+        "        r0 += weights[k] * texelFetch(palettes, t);\n"
+        "        r1 += weights[k] * texelFetch(palettes, t + 1);\n"
+        "        r2 += weights[k] * texelFetch(palettes, t + 2);\n"
+        "    }\n"
+        "    vec4 p = vec4(position, 1.0);\n"
+        "    vec4 local = model * vec4(dot(r0, p), dot(r1, p), dot(r2, p), 1.0);\n"
+        "    vec4 placement = texelFetch(palettes, base);\n"
+        "    mat3 heading = mat3(placement.z, 0.0, -placement.w, 0.0, 1.0, 0.0, placement.w, 0.0, placement.z);\n"
+        "    vec4 q = shadow * vec4(heading * local.xyz, local.w);\n"
+        "    vec4 eye = view * vec4(q.xyz + vec3(placement.x, 0.0, placement.y) * q.w, q.w);\n"
+        "    gl_Position = projection * eye;\n"
+        "    fragTexCoord = texCoord;\n"
+        "    if (!lit) {\n"
+        "        litColor = materialColor;\n"
+        "        return;\n"
+        "    }\n"
+        "\n"
+        "    // Light 0 per vertex, as the fixed-function pipeline does it (infinite viewer)\n"
+        "    vec3 n = mat3(model) * vec3(dot(r0.xyz, normal), dot(r1.xyz, normal), dot(r2.xyz, normal));\n"
+        "    n = normalize(mat3(view) * (heading * n));\n"
+        "    vec3 l = normalize(lightPosition.xyz - eye.xyz / eye.w * lightPosition.w);\n"
+        "    vec4 c = vertexColors ? color : materialColor;\n"
+        "    float diffuse = max(dot(n, l), 0.0);\n"
+        "    float specular = diffuse > 0.0 ? pow(max(dot(n, normalize(l + vec3(0.0, 0.0, 1.0))), 0.0), shininess) : 0.0;\n"
+        "    vec3 rgb = c.rgb * (sceneAmbient.rgb + lightAmbient.rgb + lightDiffuse.rgb * diffuse)\n"
+        "               + materialSpecular.rgb * lightSpecular.rgb * specular;\n"
+        "    litColor = vec4(min(rgb, vec3(1.0)), c.a);\n"
+        "}\n";
+
+const char *gpuSkinFragmentShader =
+        "#version 140\n"
+        "uniform sampler2D diffuseMap;\n"
+        "uniform bool textured;\n"
+        "in vec4 litColor;\n"
+        "in vec2 fragTexCoord;\n"
+        "out vec4 fragColor;\n"
+        "void main() {\n"
+        "    fragColor = textured ? litColor * texture(diffuseMap, fragTexCoord) : litColor;\n"
+        "}\n";
+
+struct GpuSkinProgram {
+    GLuint program = 0;
+    GLint palettes, blockTexels, firstInstance, projection, view, model, shadow;
+    GLint diffuseMap, lit, textured, vertexColors, materialColor, materialSpecular, shininess;
+    GLint lightPosition, lightAmbient, lightDiffuse, lightSpecular, sceneAmbient;
+};
+
+struct GpuSkinBatch {
+    GLuint vao = 0;
+    GLuint skinVbo = 0;      // Bind positions, normals, bone slots and weights (GPU_SKIN_FLOATS per vertex)
+};
+
+// One bone palette of one mesh of one batch
+struct GpuSkinSlot {
+    int batch;
+    int meshId;
+    int base;                // Index of the palette's first bone slot
+};
+
+struct GpuSkinning {
+    bool ready = false;
+    GpuSkinProgram program;
+    std::vector<GpuSkinBatch> batches;   // One per batch of the render queue
+    std::vector<GpuSkinSlot> slots;
+    int numBoneSlots = 0;
+    int blockTexels = 0;                 // Texels per instance
+    GLuint paletteBuffer = 0, paletteTexture = 0;
+    std::vector<float> staging;          // Texture buffer contents of the current frame
+};
+
+// ----------------------------------------------------------------------------
+bool gpuSkinningSupported() {
+    return GLEW_VERSION_3_1
+           || (GLEW_VERSION_2_0 && GLEW_ARB_draw_instanced && GLEW_ARB_texture_buffer_object
+               && GLEW_ARB_vertex_array_object);
+}
+
+// ----------------------------------------------------------------------------
+GLuint compileShader(GLenum type, const char *source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    GLint ok;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        std::cout << "Skinning shader did not compile: " << log << std::endl;
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+// ----------------------------------------------------------------------------
+bool buildGpuSkinProgram(GpuSkinProgram *prog) {
+    GLuint vs = compileShader(GL_VERTEX_SHADER, gpuSkinVertexShader);
+    GLuint fs = compileShader(GL_FRAGMENT_SHADER, gpuSkinFragmentShader);
+    if (vs == 0 || fs == 0) {
+        if (vs != 0) glDeleteShader(vs);
+        if (fs != 0) glDeleteShader(fs);
+        return false;
+    }
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glBindAttribLocation(program, ATTRIB_POSITION, "position");
+    glBindAttribLocation(program, ATTRIB_NORMAL, "normal");
+    glBindAttribLocation(program, ATTRIB_BONES, "bones");
+    glBindAttribLocation(program, ATTRIB_WEIGHTS, "weights");
+    glBindAttribLocation(program, ATTRIB_TEXCOORD, "texCoord");
+    glBindAttribLocation(program, ATTRIB_COLOR, "color");
+    glBindFragDataLocation(program, 0, "fragColor");
+    glLinkProgram(program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    GLint ok;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        std::cout << "Skinning shaders did not link: " << log << std::endl;
+        glDeleteProgram(program);
+        return false;
+    }
+
+    prog->program = program;
+    prog->palettes = glGetUniformLocation(program, "palettes");
+    prog->blockTexels = glGetUniformLocation(program, "blockTexels");
+    prog->firstInstance = glGetUniformLocation(program, "firstInstance");
+    prog->projection = glGetUniformLocation(program, "projection");
+    prog->view = glGetUniformLocation(program, "view");
+    prog->model = glGetUniformLocation(program, "model");
+    prog->shadow = glGetUniformLocation(program, "shadow");
+    prog->diffuseMap = glGetUniformLocation(program, "diffuseMap");
+    prog->lit = glGetUniformLocation(program, "lit");
+    prog->textured = glGetUniformLocation(program, "textured");
+    prog->vertexColors = glGetUniformLocation(program, "vertexColors");
+    prog->materialColor = glGetUniformLocation(program, "materialColor");
+    prog->materialSpecular = glGetUniformLocation(program, "materialSpecular");
+    prog->shininess = glGetUniformLocation(program, "shininess");
+    prog->lightPosition = glGetUniformLocation(program, "lightPosition");
+    prog->lightAmbient = glGetUniformLocation(program, "lightAmbient");
+    prog->lightDiffuse = glGetUniformLocation(program, "lightDiffuse");
+    prog->lightSpecular = glGetUniformLocation(program, "lightSpecular");
+    prog->sceneAmbient = glGetUniformLocation(program, "sceneAmbient");
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Uploads the bind pose and bone influences of a batch and records its
+// vertex array object. slotBases holds the first bone slot of each of the
+// batch's meshes.
+void buildGpuSkinBatch(GpuSkinBatch *gsb, const GpuMesh &gm, const std::vector<SkinMesh> &skinMeshes,
+                       const std::vector<int> &slotBases) {
+    std::vector<float> data(gm.numVertices * GPU_SKIN_FLOATS);
+    float *dst = data.data();
+    for (int i = 0; i < gm.meshIds.size(); i++) {
+        const SkinMesh &skin = skinMeshes[gm.meshIds[i]];
+        int n = skin.numVertices;
+        for (int v = 0; v < n; v++) {
+            for (int c = 0; c < 3; c++) *dst++ = skin.bindPositions[c * n + v];
+            for (int c = 0; c < 3; c++) *dst++ = skin.bindNormals[c * n + v];
+            for (int k = 0; k < MAX_INFLUENCES; k++) *dst++ = (float) (slotBases[i] + skin.boneIds[k * n + v]);
+            for (int k = 0; k < MAX_INFLUENCES; k++) *dst++ = skin.weights[k * n + v];
+        }
+    }
+    glGenBuffers(1, &gsb->skinVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, gsb->skinVbo);
+    glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float), data.data(), GL_STATIC_DRAW);
+
+    GLsizei stride = GPU_SKIN_FLOATS * sizeof(float);
+    glGenVertexArrays(1, &gsb->vao);
+    glBindVertexArray(gsb->vao);
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, stride, (const GLvoid *) 0);
+    if (gm.hasNormals) {
+        glEnableVertexAttribArray(ATTRIB_NORMAL);
+        glVertexAttribPointer(ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE, stride, (const GLvoid *) (3 * sizeof(float)));
+    }
+    glEnableVertexAttribArray(ATTRIB_BONES);
+    glVertexAttribPointer(ATTRIB_BONES, 4, GL_FLOAT, GL_FALSE, stride, (const GLvoid *) (6 * sizeof(float)));
+    glEnableVertexAttribArray(ATTRIB_WEIGHTS);
+    glVertexAttribPointer(ATTRIB_WEIGHTS, 4, GL_FLOAT, GL_FALSE, stride, (const GLvoid *) (10 * sizeof(float)));
+
+    if (gm.hasTexCoords || gm.hasColors) glBindBuffer(GL_ARRAY_BUFFER, gm.staticVbo);
+    if (gm.hasTexCoords) {
+        glEnableVertexAttribArray(ATTRIB_TEXCOORD);
+        glVertexAttribPointer(ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, gm.staticStride, (const GLvoid *) 0);
+    }
+    if (gm.hasColors) {
+        glEnableVertexAttribArray(ATTRIB_COLOR);
+        glVertexAttribPointer(ATTRIB_COLOR, 4, GL_FLOAT, GL_FALSE, gm.staticStride,
+                              (const GLvoid *) (gm.hasTexCoords ? 2 * sizeof(float) : 0));
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gm.ibo);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+// ----------------------------------------------------------------------------
+// Sets up the shader path for the batches of queue. bindPalettes gives the
+// number of bones of each mesh. Returns false, having released everything,
+// if the GL implementation can't run it.
+bool buildGpuSkinning(GpuSkinning *gs, const RenderQueue &queue, const std::vector<SkinMesh> &skinMeshes,
+                      const std::vector<BonePalette> &bindPalettes) {
+    if (!gpuSkinningSupported()) {
+        std::cout << "Vertex shader skinning needs OpenGL 3.1; skinning on the CPU" << std::endl;
+        return false;
+    }
+    if (!buildGpuSkinProgram(&gs->program)) return false;
+
+    gs->slots.clear();
+    gs->numBoneSlots = 0;
+    gs->batches.resize(queue.batches.size());
+    for (int b = 0; b < queue.batches.size(); b++) {
+        const GpuMesh &gm = queue.batches[b].gpu;
+        std::vector<int> slotBases;
+        for (int i = 0; i < gm.meshIds.size(); i++) {
+            GpuSkinSlot slot = {b, gm.meshIds[i], gs->numBoneSlots};
+            gs->slots.push_back(slot);
+            slotBases.push_back(gs->numBoneSlots);
+            gs->numBoneSlots += (int) bindPalettes[gm.meshIds[i]].matrices.size();
+        }
+        buildGpuSkinBatch(&gs->batches[b], gm, skinMeshes, slotBases);
+    }
+    gs->blockTexels = 1 + 3 * gs->numBoneSlots;
+
+    glGenBuffers(1, &gs->paletteBuffer);
+    glGenTextures(1, &gs->paletteTexture);
+    glBindBuffer(GL_TEXTURE_BUFFER, gs->paletteBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, 4 * sizeof(float), NULL, GL_STREAM_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, gs->paletteTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, gs->paletteBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    gs->ready = true;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+void releaseGpuSkinning(GpuSkinning *gs) {
+    if (!gs->ready) return;
+    for (int b = 0; b < gs->batches.size(); b++) {
+        glDeleteVertexArrays(1, &gs->batches[b].vao);
+        glDeleteBuffers(1, &gs->batches[b].skinVbo);
+    }
+    glDeleteTextures(1, &gs->paletteTexture);
+    glDeleteBuffers(1, &gs->paletteBuffer);
+    glDeleteProgram(gs->program.program);
+    *gs = GpuSkinning();
+}
+
+// ----------------------------------------------------------------------------
+// Number of instances whose blocks fit into the largest texture buffer
+int gpuSkinMaxInstances(const GpuSkinning &gs) {
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    return gs.blockTexels > 0 ? maxTexels / gs.blockTexels : 0;
+}
+
+// ----------------------------------------------------------------------------
+// Writes the block of one instance: its placement, then every bone slot's
+// matrix premultiplied by the transformation of the slot's batch node.
+// palettes holds the instance's skinning matrices per mesh.
+void writeGpuSkinBlock(const GpuSkinning &gs, const std::vector<BonePalette> &palettes,
+                       const aiMatrix4x4 *batchTransforms, float x, float z, float heading, float *dst) {
+    float radians = heading * 3.14159265f / 180.0f;
+    *dst++ = x;
+    *dst++ = z;
+    *dst++ = std::cos(radians);
+    *dst++ = std::sin(radians);
+    for (int s = 0; s < gs.slots.size(); s++) {
+        const GpuSkinSlot &slot = gs.slots[s];
+        const std::vector<aiMatrix4x4> &matrices = palettes[slot.meshId].matrices;
+        const aiMatrix4x4 &node = batchTransforms[slot.batch];
+        for (int boneId = 0; boneId < matrices.size(); boneId++) {
+            aiMatrix4x4 m = node * matrices[boneId];
+            memcpy(dst, &m.a1, 12 * sizeof(float));   // Rows 1-3
+            dst += 12;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Uploads the blocks of numInstances instances from gs->staging
+void uploadGpuSkinPalettes(GpuSkinning *gs, int numInstances) {
+    glBindBuffer(GL_TEXTURE_BUFFER, gs->paletteBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, numInstances * gs->blockTexels * 4 * sizeof(float), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, numInstances * gs->blockTexels * 4 * sizeof(float), gs->staging.data());
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// ----------------------------------------------------------------------------
+// Draws every batch for the instances whose blocks were uploaded, with one
+// instanced draw call per level of detail in use. levelCounts holds the
+// number of instances at each level, whose blocks follow each other in that
+// order. model and shadow are column-major matrices applied in the model's
+// space after skinning (the viewer's scaling) and before the instance's
+// translation (the planar shadow projection, identity for the lit pass).
+// The camera, light and material specular are read from the current GL state.
+void drawGpuSkinned(const GpuSkinning &gs, const RenderQueue &queue, const std::vector<int> &levelCounts,
+                    bool isShadow, const float *overrideCol, const float *model, const float *shadow) {
+    int numInstances = 0;
+    for (int level = 0; level < levelCounts.size(); level++) numInstances += levelCounts[level];
+    if (numInstances == 0) return;
+    const GpuSkinProgram &prog = gs.program;
+    float projection[16], view[16], lightPosition[4], lightAmbient[4], lightDiffuse[4], lightSpecular[4];
+    float sceneAmbient[4], materialSpecular[4], shininess;
+    glGetFloatv(GL_PROJECTION_MATRIX, projection);
+    glGetFloatv(GL_MODELVIEW_MATRIX, view);
+    glGetLightfv(GL_LIGHT0, GL_POSITION, lightPosition);   // Already in eye space
+    glGetLightfv(GL_LIGHT0, GL_AMBIENT, lightAmbient);
+    glGetLightfv(GL_LIGHT0, GL_DIFFUSE, lightDiffuse);
+    glGetLightfv(GL_LIGHT0, GL_SPECULAR, lightSpecular);
+    glGetFloatv(GL_LIGHT_MODEL_AMBIENT, sceneAmbient);
+    glGetMaterialfv(GL_FRONT, GL_SPECULAR, materialSpecular);
+    glGetMaterialfv(GL_FRONT, GL_SHININESS, &shininess);
+
+    glUseProgram(prog.program);
+    glUniformMatrix4fv(prog.projection, 1, GL_FALSE, projection);
+    glUniformMatrix4fv(prog.view, 1, GL_FALSE, view);
+    glUniformMatrix4fv(prog.model, 1, GL_FALSE, model);
+    glUniformMatrix4fv(prog.shadow, 1, GL_FALSE, shadow);
+    glUniform1i(prog.blockTexels, gs.blockTexels);
+    glUniform1i(prog.lit, !isShadow);
+    glUniform4fv(prog.lightPosition, 1, lightPosition);
+    glUniform4fv(prog.lightAmbient, 1, lightAmbient);
+    glUniform4fv(prog.lightDiffuse, 1, lightDiffuse);
+    glUniform4fv(prog.lightSpecular, 1, lightSpecular);
+    glUniform4fv(prog.sceneAmbient, 1, sceneAmbient);
+    glUniform4fv(prog.materialSpecular, 1, materialSpecular);
+    glUniform1f(prog.shininess, shininess);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, gs.paletteTexture);
+    glUniform1i(prog.palettes, 1);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(prog.diffuseMap, 0);
+
+    GLuint boundTex = 0;
+    for (int b = 0; b < queue.batches.size(); b++) {
+        const DrawBatch &batch = queue.batches[b];
+        const GpuMesh &gm = batch.gpu;
+        bool textured = batch.textured && !isShadow;
+        glUniform1i(prog.textured, textured);
+        glUniform1i(prog.vertexColors, gm.hasColors && !isShadow);
+        const float *color = overrideCol != NULL ? overrideCol : &queue.materials[batch.materialId].diffuse.r;
+        glUniform4fv(prog.materialColor, 1, isShadow ? &queue.shadowColor.r : color);
+        if (textured && queue.materials[batch.materialId].texId != boundTex) {
+            boundTex = queue.materials[batch.materialId].texId;
+            glBindTexture(GL_TEXTURE_2D, boundTex);
+        }
+        if (!gm.hasNormals) glVertexAttrib3f(ATTRIB_NORMAL, 0, 0, 1);   // Facing the viewer, as no normal is given
+
+        glBindVertexArray(gs.batches[b].vao);
+        for (int level = 0, first = 0; level < levelCounts.size(); first += levelCounts[level++]) {
+            if (levelCounts[level] == 0) continue;
+            int lod = gpuMeshLevel(gm, level);
+            glUniform1i(prog.firstInstance, first);
+            glDrawElementsInstanced(gm.mode, gm.lodNumIndices[lod], GL_UNSIGNED_INT,
+                                    (const GLvoid *) (gm.lodFirstIndex[lod] * sizeof(GLuint)), levelCounts[level]);
+        }
+    }
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glUseProgram(0);
+}
+
+#endif
@@ -0,0 +1,168 @@
+// ----------------------------------------------------------------------------
+// Headless rendering
+//
+// Runs a viewer without a window system. The legacy GL context is created
+// with EGL on a pbuffer surface (Mesa's surfaceless platform is used when
+// there is no default display, so llvmpipe works on servers with no GPU or
+// X server). The viewer's update and draw functions are then called back to
+// back for a fixed number of frames. Per-frame timings are written to a CSV
+// file and, optionally, every frame is read back and written as a PPM image.
+//-----------------------------------------------------------------------------
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/glew.h>
+#include "options.h"
+
+struct HeadlessContext {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+    EGLSurface surface = EGL_NO_SURFACE;
+};
+
+// ----------------------------------------------------------------------------
+EGLDisplay openHeadlessDisplay() {
+    EGLint major, minor;
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display != EGL_NO_DISPLAY && eglInitialize(display, &major, &minor)) return display;
+
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay == NULL) return EGL_NO_DISPLAY;
+    display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (display != EGL_NO_DISPLAY && eglInitialize(display, &major, &minor)) return display;
+    return EGL_NO_DISPLAY;
+}
+
+// ----------------------------------------------------------------------------
+// Creates a desktop GL (compatibility) context with a width x height
+// pbuffer surface and makes it current
+bool createHeadlessContext(HeadlessContext *ctx, int width, int height) {
+    ctx->display = openHeadlessDisplay();
+    if (ctx->display == EGL_NO_DISPLAY) {
+        std::cout << "Could not open an EGL display" << std::endl;
+        return false;
+    }
+
+    const EGLint configAttribs[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+            EGL_DEPTH_SIZE, 24,
+            EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs;
+    if (!eglChooseConfig(ctx->display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+        std::cout << "No EGL config supports desktop OpenGL on a pbuffer" << std::endl;
+        return false;
+    }
+
+    const EGLint surfaceAttribs[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+    ctx->surface = eglCreatePbufferSurface(ctx->display, config, surfaceAttribs);
+    eglBindAPI(EGL_OPENGL_API);
+    ctx->context = eglCreateContext(ctx->display, config, EGL_NO_CONTEXT, NULL);
+    if (ctx->surface == EGL_NO_SURFACE || ctx->context == EGL_NO_CONTEXT
+        || !eglMakeCurrent(ctx->display, ctx->surface, ctx->surface, ctx->context)) {
+        std::cout << "Could not create the EGL pbuffer context (error 0x" << std::hex << eglGetError()
+                  << std::dec << ")" << std::endl;
+        return false;
+    }
+
+    // GLEW built for GLX loads the GL entry points and then fails to find a GLX display
+    GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    if (err == GLEW_ERROR_NO_GLX_DISPLAY) err = GLEW_OK;
+#endif
+    if (err != GLEW_OK) {
+        std::cout << "Could not initialise GLEW" << std::endl;
+        return false;
+    }
+    glViewport(0, 0, width, height);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+void destroyHeadlessContext(HeadlessContext *ctx) {
+    if (ctx->display == EGL_NO_DISPLAY) return;
+    eglMakeCurrent(ctx->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (ctx->context != EGL_NO_CONTEXT) eglDestroyContext(ctx->display, ctx->context);
+    if (ctx->surface != EGL_NO_SURFACE) eglDestroySurface(ctx->display, ctx->surface);
+    eglTerminate(ctx->display);
+    *ctx = HeadlessContext();
+}
+
+// ----------------------------------------------------------------------------
+// Reads back the colour buffer and writes it as a binary PPM, top row first
+bool writeFramePPM(const std::string &path, int width, int height, std::vector<unsigned char> *pixels) {
+    pixels->resize(width * height * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &(*pixels)[0]);
+
+    std::ofstream file(path.c_str(), std::ios::binary);
+    if (!file) return false;
+    file << "P6\n" << width << " " << height << "\n255\n";
+    for (int y = height - 1; y >= 0; y--)
+        file.write((const char *) &(*pixels)[y * width * 3], width * 3);
+    return (bool) file;
+}
+
+// ----------------------------------------------------------------------------
+// Runs update then draw for options.headlessFrames frames, as fast as possible.
+// The GL context must be current. Returns the process exit code.
+int runHeadless(const ViewerOptions &options, void (*update)(), void (*draw)()) {
+    typedef std::chrono::high_resolution_clock Clock;
+    std::ofstream csv(options.timingsFile.c_str());
+    if (!csv) {
+        std::cout << "Could not write " << options.timingsFile << std::endl;
+        return 1;
+    }
+    csv << "frame,update_ms,render_ms,readback_ms" << std::endl;
+
+    std::vector<unsigned char> pixels;
+    double totalUpdate = 0, totalRender = 0;
+    Clock::time_point start = Clock::now();
+    for (int frame = 0; frame < options.headlessFrames; frame++) {
+        Clock::time_point t0 = Clock::now();
+        update();
+        Clock::time_point t1 = Clock::now();
+        draw();
+        glFinish();   // Include the GPU (or rasteriser) work in the render time
+        Clock::time_point t2 = Clock::now();
+        if (!options.frameDir.empty()) {
+            char name[32];
+            snprintf(name, sizeof(name), "/frame_%05d.ppm", frame);
+            if (!writeFramePPM(options.frameDir + name, options.width, options.height, &pixels)) {
+                std::cout << "Could not write " << options.frameDir + name << std::endl;
+                return 1;
+            }
+        }
+        Clock::time_point t3 = Clock::now();
+
+        double updateMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        double renderMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+        double readbackMs = std::chrono::duration<double, std::milli>(t3 - t2).count();
+        csv << frame << "," << updateMs << "," << renderMs << "," << readbackMs << "\n";
+        totalUpdate += updateMs;
+        totalRender += renderMs;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    int n = options.headlessFrames;
+    std::cout << options.headlessFrames << " frames at " << options.width << "x" << options.height << " in "
+              << seconds << " s (" << options.headlessFrames / seconds << " fps): update " << totalUpdate / n
+              << " ms, render " << totalRender / n << " ms per frame. Timings written to "
+              << options.timingsFile << std::endl;
+    return 0;
+}
+
+#endif
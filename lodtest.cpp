@@ -0,0 +1,162 @@
+//  ========================================================================
+//  FILE NAME: lodtest.cpp
+//
+//  Checks the levels of detail built by mesh_lod.h on a synthetic mesh: a
+//  bumpy grid split by a texture seam (a column of vertices duplicated with
+//  other texture coordinates) and skinned to two bones by height. Every
+//  level must keep a vertex prefix no longer than the previous one, index
+//  only into that prefix and keep about its share of the triangles; seam and
+//  border vertices must survive into the coarsest level, and the bone
+//  weights must follow the vertices when they are reordered.
+//
+//  Usage: lodtest       (exits with 1 if a check fails)
+//  ========================================================================
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+#include <assimp/scene.h>
+#include "mesh_lod.h"
+
+#define GRID_SIZE 33   // Vertices along each side of the grid, before the seam is split
+
+int failures = 0;
+
+// ----------------------------------------------------------------------------
+void check(bool ok, const string &what) {
+    if (ok) return;
+    cout << "FAILED: " << what << endl;
+    failures++;
+}
+
+// ----------------------------------------------------------------------------
+// Weight of the upper bone of a vertex at height y, so that the weights can
+// be checked against the positions after the reorder
+float upperWeight(float y) {
+    return y / (GRID_SIZE - 1);
+}
+
+// ----------------------------------------------------------------------------
+// Grid of GRID_SIZE x GRID_SIZE quads' corners in the xy plane, with a bump
+// in z. The middle column is split: the quads left of it use one copy of its
+// vertices and the quads right of it another, at the same positions.
+aiMesh *makeSeamedGrid() {
+    int seam = GRID_SIZE / 2;
+    int columns = GRID_SIZE + 1;   // The seam column twice
+    aiMesh *mesh = new aiMesh();
+    mesh->mPrimitiveTypes = aiPrimitiveType_TRIANGLE;
+    mesh->mNumVertices = columns * GRID_SIZE;
+    mesh->mVertices = new aiVector3D[mesh->mNumVertices];
+    mesh->mTextureCoords[0] = new aiVector3D[mesh->mNumVertices];
+    mesh->mNumUVComponents[0] = 2;
+    for (int y = 0; y < GRID_SIZE; y++)
+        for (int c = 0; c < columns; c++) {
+            int x = c <= seam ? c : c - 1;
+            float z = 2.0f * sinf(x * 0.3f) * cosf(y * 0.2f);
+            mesh->mVertices[y * columns + c] = aiVector3D((float) x, (float) y, z);
+            mesh->mTextureCoords[0][y * columns + c] = aiVector3D(c <= seam ? 0.0f : 1.0f, (float) y, 0.0f);
+        }
+
+    vector<unsigned int> indices;
+    for (int y = 0; y + 1 < GRID_SIZE; y++)
+        for (int x = 0; x + 1 < GRID_SIZE; x++) {
+            int c0 = x < seam ? x : x + 1, c1 = c0 + 1;
+            unsigned int a = y * columns + c0, b = y * columns + c1;
+            unsigned int d = (y + 1) * columns + c0, e = (y + 1) * columns + c1;
+            indices.push_back(a); indices.push_back(b); indices.push_back(e);
+            indices.push_back(a); indices.push_back(e); indices.push_back(d);
+        }
+    mesh->mNumFaces = indices.size() / 3;
+    mesh->mFaces = new aiFace[mesh->mNumFaces];
+    for (int f = 0; f < mesh->mNumFaces; f++) {
+        mesh->mFaces[f].mNumIndices = 3;
+        mesh->mFaces[f].mIndices = new unsigned int[3];
+        for (int i = 0; i < 3; i++) mesh->mFaces[f].mIndices[i] = indices[3 * f + i];
+    }
+
+    mesh->mNumBones = 2;
+    mesh->mBones = new aiBone*[2];
+    for (int boneId = 0; boneId < 2; boneId++) {
+        aiBone *bone = new aiBone();
+        bone->mNumWeights = mesh->mNumVertices;
+        bone->mWeights = new aiVertexWeight[mesh->mNumVertices];
+        for (int v = 0; v < mesh->mNumVertices; v++) {
+            float upper = upperWeight(mesh->mVertices[v].y);
+            bone->mWeights[v].mVertexId = v;
+            bone->mWeights[v].mWeight = boneId == 1 ? upper : 1.0f - upper;
+        }
+        mesh->mBones[boneId] = bone;
+    }
+    return mesh;
+}
+
+// ----------------------------------------------------------------------------
+int main() {
+    aiMesh *mesh = makeSeamedGrid();
+    int numVertices = mesh->mNumVertices, numFaces = mesh->mNumFaces;
+    MeshLod lod;
+    buildMeshLod(&lod, mesh);
+
+    check(lod.simplified, "the grid is simplified");
+    check(lod.numVertices[0] == numVertices, "level 0 uses every vertex");
+    for (int k = 0; k < mesh->mNumFaces; k++)
+        for (int i = 0; i < 3; i++)
+            check(mesh->mFaces[k].mIndices[i] < numVertices, "level 0 indices are in range");
+
+    for (int level = 1; level < LOD_LEVELS; level++) {
+        string name = "level " + to_string(level);
+        const vector<unsigned int> &indices = lod.indices[level];
+        int numTriangles = (int) indices.size() / 3;
+        check(indices.size() % 3 == 0, name + " holds whole triangles");
+        check(lod.numVertices[level] <= lod.numVertices[level - 1], name + " uses no more vertices than the level before");
+        check(lod.numVertices[level] < numVertices, name + " drops vertices");
+        check(numTriangles > 0 && numTriangles <= ceil(lodTriangleRatios[level] * numFaces),
+              name + " keeps at most its share of the triangles");
+
+        vector<bool> used(numVertices, false);
+        for (int i = 0; i < indices.size(); i++) {
+            check(indices[i] < lod.numVertices[level], name + " indexes only its vertex prefix");
+            if (indices[i] < numVertices) used[indices[i]] = true;
+        }
+        for (int t = 0; t < numTriangles; t++) {
+            unsigned int a = indices[3 * t], b = indices[3 * t + 1], c = indices[3 * t + 2];
+            check(a != b && b != c && a != c, name + " has no degenerate triangles");
+        }
+        int unused = 0;
+        for (int v = 0; v < lod.numVertices[level]; v++) unused += !used[v];
+        check(unused == 0, name + " has no unused vertices in its prefix");
+    }
+
+    // Seam and border vertices are locked: they are never removed, so they
+    // lie in the coarsest level's prefix
+    int coarsest = lod.numVertices[LOD_LEVELS - 1];
+    for (int v = 0; v < numVertices; v++) {
+        const aiVector3D &p = mesh->mVertices[v];
+        bool seam = p.x == GRID_SIZE / 2;
+        bool border = p.x == 0 || p.y == 0 || p.x == GRID_SIZE - 1 || p.y == GRID_SIZE - 1;
+        if (seam || border) check(v < coarsest, "seam and border vertices are in every level");
+    }
+
+    // Texture coordinates and bone weights were reordered with the vertices
+    for (int v = 0; v < numVertices; v++)
+        check(mesh->mTextureCoords[0][v].y == mesh->mVertices[v].y, "texture coordinates follow their vertices");
+    for (int boneId = 0; boneId < 2; boneId++) {
+        const aiBone *bone = mesh->mBones[boneId];
+        for (int w = 0; w < bone->mNumWeights; w++) {
+            float upper = upperWeight(mesh->mVertices[bone->mWeights[w].mVertexId].y);
+            float expected = boneId == 1 ? upper : 1.0f - upper;
+            check(fabsf(bone->mWeights[w].mWeight - expected) < 1e-6f, "bone weights follow their vertices");
+        }
+    }
+
+    cout << "Levels of detail:";
+    for (int level = 0; level < LOD_LEVELS; level++)
+        cout << " " << (level == 0 ? numFaces : (int) lod.indices[level].size() / 3) << " triangles / "
+             << lod.numVertices[level] << " vertices" << (level + 1 < LOD_LEVELS ? "," : "\n");
+    delete mesh;
+    cout << (failures == 0 ? "All checks passed" : "Some checks failed") << endl;
+    return failures == 0 ? 0 : 1;
+}
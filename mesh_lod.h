@@ -0,0 +1,407 @@
+// ----------------------------------------------------------------------------
+// Mesh levels of detail
+//
+// LOD_LEVELS levels are built for every triangle mesh at load time by quadric
+// error edge collapse (Garland and Heckbert), restricted to half-edge
+// collapses: a vertex is always merged into one of its neighbours and never
+// moved, so every vertex of a coarser level is an original vertex, with its
+// own bone weights, texture coordinates and colours. The error of a collapse
+// includes a penalty for the difference between the bone weights of the two
+// vertices, so regions that deform alike are simplified first. Vertices on
+// open edges and texture seams (several vertices at one position) are never
+// removed, which keeps the surface closed where it was.
+//
+// The vertices of the mesh are then reordered so that the last ones to be
+// removed come first. Every level uses a prefix of the vertex array, so
+// skinning or streaming a level touches only that prefix. The faces and bone
+// weights of the mesh are remapped to the new order, and each coarser level
+// keeps its own triangle list. The reorder happens in place, so it must run
+// before anything else reads the mesh.
+//
+// At run time a level is picked per character from its projected size.
+//-----------------------------------------------------------------------------
+
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <queue>
+#include <vector>
+#include <assimp/scene.h>
+#include "thread_pool.h"
+
+#define LOD_LEVELS 4
+#define LOD_WEIGHT_PENALTY 0.01    // Collapse error per unit of bone weight difference, in squared mesh sizes
+
+const float lodTriangleRatios[LOD_LEVELS] = {1.0f, 0.5f, 0.25f, 0.125f};   // Share of the triangles each level keeps
+const float lodMinPixels[LOD_LEVELS - 1] = {240.0f, 120.0f, 60.0f};        // Smallest projected size of levels 0-2
+
+struct MeshLod {
+    bool simplified = false;                       // False if every level draws the whole mesh
+    int numVertices[LOD_LEVELS];                   // Length of the vertex prefix each level uses
+    std::vector<unsigned int> indices[LOD_LEVELS]; // Triangles of levels 1 and up (level 0 uses the faces)
+};
+
+// Where the characters are seen from, for picking their level of detail
+struct LodView {
+    aiVector3D eye;              // Camera position in world space
+    float pixelsPerUnit = 0;     // Projected size of one world unit at unit distance, 0 = always level 0
+    float characterSize = 1;     // Size of a character in world units
+};
+
+// Symmetric 4x4 matrix summing squared distances to planes
+struct Quadric {
+    double q[10] = {0};          // a², ab, ac, ad, b², bc, bd, c², cd, d²
+};
+
+struct CollapseCandidate {
+    double cost;
+    int from, to;
+    int stamp;                   // Version of 'from' the candidate was computed for
+
+    bool operator>(const CollapseCandidate &other) const { return cost > other.cost; }
+};
+
+struct LodSimplifier {
+    std::vector<aiVector3D> positions;
+    std::vector<int> triangles;                    // 3 corners per face, rewritten as vertices collapse
+    std::vector<bool> faceAlive;
+    std::vector<std::vector<int> > vertexFaces;    // Faces around each vertex, including dead ones
+    std::vector<Quadric> quadrics;
+    std::vector<std::vector<std::pair<int, float> > > influences;   // (bone, weight) of each vertex, by bone
+    std::vector<bool> locked, removed;
+    std::vector<int> stamps;
+    std::vector<int> removalOrder;
+    double weightPenalty = 0;
+    int aliveFaces = 0;
+    std::priority_queue<CollapseCandidate, std::vector<CollapseCandidate>, std::greater<CollapseCandidate> > queue;
+};
+
+// ----------------------------------------------------------------------------
+void addPlaneQuadric(Quadric *quadric, double a, double b, double c, double d) {
+    double *q = quadric->q;
+    q[0] += a * a; q[1] += a * b; q[2] += a * c; q[3] += a * d;
+    q[4] += b * b; q[5] += b * c; q[6] += b * d;
+    q[7] += c * c; q[8] += c * d;
+    q[9] += d * d;
+}
+
+// ----------------------------------------------------------------------------
+// Error of (a + b) at p
+double quadricError(const Quadric &a, const Quadric &b, const aiVector3D &p) {
+    double q[10];
+    for (int i = 0; i < 10; i++) q[i] = a.q[i] + b.q[i];
+    double x = p.x, y = p.y, z = p.z;
+    return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+           + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+           + q[7] * z * z + 2 * q[8] * z
+           + q[9];
+}
+
+// ----------------------------------------------------------------------------
+// Sum of the absolute differences of two vertices' bone weights (0 to 2)
+float influenceDistance(const std::vector<std::pair<int, float> > &a, const std::vector<std::pair<int, float> > &b) {
+    float distance = 0;
+    int i = 0, j = 0;
+    while (i < a.size() || j < b.size()) {
+        if (j == b.size() || (i < a.size() && a[i].first < b[j].first)) distance += a[i++].second;
+        else if (i == a.size() || b[j].first < a[i].first) distance += b[j++].second;
+        else distance += std::fabs(a[i++].second - b[j++].second);
+    }
+    return distance;
+}
+
+// ----------------------------------------------------------------------------
+// Vertices sharing a live face with v, sorted
+void vertexNeighbours(const LodSimplifier &s, int v, std::vector<int> *neighbours) {
+    neighbours->clear();
+    for (int i = 0; i < s.vertexFaces[v].size(); i++) {
+        int f = s.vertexFaces[v][i];
+        if (!s.faceAlive[f]) continue;
+        for (int c = 0; c < 3; c++)
+            if (s.triangles[3 * f + c] != v) neighbours->push_back(s.triangles[3 * f + c]);
+    }
+    std::sort(neighbours->begin(), neighbours->end());
+    neighbours->erase(std::unique(neighbours->begin(), neighbours->end()), neighbours->end());
+}
+
+// ----------------------------------------------------------------------------
+// True if merging 'from' into 'to' keeps the surface manifold (the two
+// vertices share no neighbours besides the corners of their common faces)
+// and turns no remaining face of 'from' over
+bool canCollapse(const LodSimplifier &s, int from, int to) {
+    std::vector<int> fromNeighbours, toNeighbours, common;
+    vertexNeighbours(s, from, &fromNeighbours);
+    vertexNeighbours(s, to, &toNeighbours);
+    std::set_intersection(fromNeighbours.begin(), fromNeighbours.end(), toNeighbours.begin(), toNeighbours.end(),
+                          std::back_inserter(common));
+    int sharedFaces = 0;
+    for (int i = 0; i < s.vertexFaces[from].size(); i++) {
+        int f = s.vertexFaces[from][i];
+        if (!s.faceAlive[f]) continue;
+        const int *t = &s.triangles[3 * f];
+        if (t[0] == to || t[1] == to || t[2] == to) {
+            sharedFaces++;
+            continue;
+        }
+        aiVector3D p[3], q[3];
+        for (int c = 0; c < 3; c++) {
+            p[c] = s.positions[t[c]];
+            q[c] = t[c] == from ? s.positions[to] : p[c];
+        }
+        aiVector3D before = (p[1] - p[0]) ^ (p[2] - p[0]);
+        aiVector3D after = (q[1] - q[0]) ^ (q[2] - q[0]);
+        if (before * after <= 0.2f * before.Length() * after.Length()) return false;
+    }
+    return sharedFaces > 0 && common.size() == sharedFaces;
+}
+
+// ----------------------------------------------------------------------------
+// Queues the cheapest valid collapse of 'from', replacing any queued before
+void queueBestCollapse(LodSimplifier *s, int from) {
+    s->stamps[from]++;
+    if (s->locked[from] || s->removed[from]) return;
+    std::vector<int> neighbours;
+    vertexNeighbours(*s, from, &neighbours);
+    CollapseCandidate best = {0, from, -1, s->stamps[from]};
+    for (int i = 0; i < neighbours.size(); i++) {
+        int to = neighbours[i];
+        double cost = quadricError(s->quadrics[from], s->quadrics[to], s->positions[to])
+                      + s->weightPenalty * influenceDistance(s->influences[from], s->influences[to]);
+        if ((best.to < 0 || cost < best.cost) && canCollapse(*s, from, to)) {
+            best.cost = cost;
+            best.to = to;
+        }
+    }
+    if (best.to >= 0) s->queue.push(best);
+}
+
+// ----------------------------------------------------------------------------
+void collapseVertex(LodSimplifier *s, int from, int to) {
+    for (int i = 0; i < s->vertexFaces[from].size(); i++) {
+        int f = s->vertexFaces[from][i];
+        if (!s->faceAlive[f]) continue;
+        int *t = &s->triangles[3 * f];
+        if (t[0] == to || t[1] == to || t[2] == to) {
+            s->faceAlive[f] = false;
+            s->aliveFaces--;
+            continue;
+        }
+        for (int c = 0; c < 3; c++)
+            if (t[c] == from) t[c] = to;
+        s->vertexFaces[to].push_back(f);
+    }
+    for (int i = 0; i < 10; i++) s->quadrics[to].q[i] += s->quadrics[from].q[i];
+    s->removed[from] = true;
+    s->removalOrder.push_back(from);
+
+    std::vector<int> neighbours;
+    vertexNeighbours(*s, to, &neighbours);
+    queueBestCollapse(s, to);
+    for (int i = 0; i < neighbours.size(); i++) queueBestCollapse(s, neighbours[i]);
+}
+
+// ----------------------------------------------------------------------------
+// Rewrites a per-vertex array so that element i is the old element order[i]
+template <typename T>
+void permuteVertexArray(T *data, const std::vector<int> &order) {
+    if (data == NULL) return;
+    std::vector<T> copy(data, data + order.size());
+    for (int i = 0; i < order.size(); i++) data[i] = copy[order[i]];
+}
+
+// ----------------------------------------------------------------------------
+// Builds the levels of a mesh and reorders its vertices for them. Meshes
+// other than pure triangle meshes, and meshes with morph targets, keep their
+// vertices and draw in full at every level.
+void buildMeshLod(MeshLod *lod, aiMesh *mesh) {
+    int n = mesh->mNumVertices;
+    lod->simplified = false;
+    for (int level = 0; level < LOD_LEVELS; level++) {
+        lod->numVertices[level] = n;
+        lod->indices[level].clear();
+    }
+    if (mesh->mPrimitiveTypes != aiPrimitiveType_TRIANGLE || mesh->mNumAnimMeshes > 0 || mesh->mNumFaces == 0) return;
+
+    LodSimplifier s;
+    s.positions.assign(mesh->mVertices, mesh->mVertices + n);
+    s.vertexFaces.resize(n);
+    s.quadrics.resize(n);
+    s.influences.resize(n);
+    s.locked.assign(n, false);
+    s.removed.assign(n, false);
+    s.stamps.assign(n, 0);
+
+    aiVector3D lo = s.positions[0], hi = s.positions[0];
+    for (int v = 1; v < n; v++) {
+        lo.x = std::min(lo.x, s.positions[v].x); hi.x = std::max(hi.x, s.positions[v].x);
+        lo.y = std::min(lo.y, s.positions[v].y); hi.y = std::max(hi.y, s.positions[v].y);
+        lo.z = std::min(lo.z, s.positions[v].z); hi.z = std::max(hi.z, s.positions[v].z);
+    }
+    s.weightPenalty = LOD_WEIGHT_PENALTY * (hi - lo).SquareLength();
+
+    for (int boneId = 0; boneId < mesh->mNumBones; boneId++) {
+        const aiBone *bone = mesh->mBones[boneId];
+        for (int w = 0; w < bone->mNumWeights; w++)
+            if (bone->mWeights[w].mWeight > 0.0f)
+                s.influences[bone->mWeights[w].mVertexId].push_back(std::make_pair(boneId, bone->mWeights[w].mWeight));
+    }
+
+    // Faces, their plane quadrics, and the edges used by one face only (open
+    // edges) or more than two (non-manifold), whose ends are locked
+    std::map<std::pair<int, int>, int> edgeFaces;
+    for (int k = 0; k < mesh->mNumFaces; k++) {
+        const aiFace &face = mesh->mFaces[k];
+        if (face.mNumIndices != 3) continue;
+        int a = face.mIndices[0], b = face.mIndices[1], c = face.mIndices[2];
+        if (a == b || b == c || a == c) continue;
+        int f = (int) s.faceAlive.size();
+        s.triangles.push_back(a);
+        s.triangles.push_back(b);
+        s.triangles.push_back(c);
+        s.faceAlive.push_back(true);
+        s.vertexFaces[a].push_back(f);
+        s.vertexFaces[b].push_back(f);
+        s.vertexFaces[c].push_back(f);
+
+        aiVector3D normal = (s.positions[b] - s.positions[a]) ^ (s.positions[c] - s.positions[a]);
+        if (normal.SquareLength() > 0) {
+            normal.Normalize();
+            double d = -(normal * s.positions[a]);
+            for (int i = 0; i < 3; i++)
+                addPlaneQuadric(&s.quadrics[face.mIndices[i]], normal.x, normal.y, normal.z, d);
+        }
+        for (int i = 0; i < 3; i++) {
+            int u = face.mIndices[i], v = face.mIndices[(i + 1) % 3];
+            edgeFaces[std::make_pair(std::min(u, v), std::max(u, v))]++;
+        }
+    }
+    s.aliveFaces = (int) s.faceAlive.size();
+    if (s.aliveFaces == 0) return;
+    for (std::map<std::pair<int, int>, int>::iterator it = edgeFaces.begin(); it != edgeFaces.end(); ++it)
+        if (it->second != 2) s.locked[it->first.first] = s.locked[it->first.second] = true;
+
+    // Vertices sharing a position with another vertex lie on a seam
+    std::vector<int> byPosition(n);
+    for (int v = 0; v < n; v++) byPosition[v] = v;
+    std::sort(byPosition.begin(), byPosition.end(), [&](int a, int b) {
+        const aiVector3D &p = s.positions[a], &q = s.positions[b];
+        return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+    });
+    for (int i = 1; i < n; i++)
+        if (s.positions[byPosition[i]] == s.positions[byPosition[i - 1]])
+            s.locked[byPosition[i]] = s.locked[byPosition[i - 1]] = true;
+
+    for (int v = 0; v < n; v++) queueBestCollapse(&s, v);
+
+    int removedAt[LOD_LEVELS] = {0};
+    int level = 1;
+    int numFaces = s.aliveFaces;
+    while (level < LOD_LEVELS) {
+        if (s.aliveFaces <= lodTriangleRatios[level] * numFaces || s.queue.empty()) {
+            removedAt[level] = (int) s.removalOrder.size();
+            for (int f = 0; f < s.faceAlive.size(); f++)
+                if (s.faceAlive[f]) lod->indices[level].insert(lod->indices[level].end(), &s.triangles[3 * f], &s.triangles[3 * f] + 3);
+            level++;
+            continue;
+        }
+        CollapseCandidate candidate = s.queue.top();
+        s.queue.pop();
+        if (candidate.stamp != s.stamps[candidate.from] || s.removed[candidate.from]) continue;
+        if (s.removed[candidate.to] || !canCollapse(s, candidate.from, candidate.to)) {
+            queueBestCollapse(&s, candidate.from);
+            continue;
+        }
+        collapseVertex(&s, candidate.from, candidate.to);
+    }
+
+    // New order: vertices kept by every level, then the removed ones, last
+    // removed first, then vertices no face uses
+    std::vector<int> order, newIndex(n, -1);
+    std::vector<bool> used(n, false);
+    for (int i = 0; i < s.triangles.size(); i++) used[s.triangles[i]] = true;
+    for (int v = 0; v < n; v++)
+        if (used[v] && !s.removed[v]) order.push_back(v);
+    int numKept = (int) order.size();
+    order.insert(order.end(), s.removalOrder.rbegin(), s.removalOrder.rend());
+    for (int v = 0; v < n; v++)
+        if (!used[v]) order.push_back(v);
+    for (int i = 0; i < n; i++) newIndex[order[i]] = i;
+
+    permuteVertexArray(mesh->mVertices, order);
+    permuteVertexArray(mesh->mNormals, order);
+    permuteVertexArray(mesh->mTangents, order);
+    permuteVertexArray(mesh->mBitangents, order);
+    for (int c = 0; c < AI_MAX_NUMBER_OF_TEXTURECOORDS; c++) permuteVertexArray(mesh->mTextureCoords[c], order);
+    for (int c = 0; c < AI_MAX_NUMBER_OF_COLOR_SETS; c++) permuteVertexArray(mesh->mColors[c], order);
+    for (int boneId = 0; boneId < mesh->mNumBones; boneId++) {
+        aiBone *bone = mesh->mBones[boneId];
+        for (int w = 0; w < bone->mNumWeights; w++) bone->mWeights[w].mVertexId = newIndex[bone->mWeights[w].mVertexId];
+    }
+    for (int k = 0; k < mesh->mNumFaces; k++)
+        for (int i = 0; i < mesh->mFaces[k].mNumIndices; i++)
+            mesh->mFaces[k].mIndices[i] = newIndex[mesh->mFaces[k].mIndices[i]];
+
+    lod->simplified = true;
+    int numRemoved = (int) s.removalOrder.size();
+    for (level = 1; level < LOD_LEVELS; level++) {
+        lod->numVertices[level] = numKept + numRemoved - removedAt[level];
+        for (int i = 0; i < lod->indices[level].size(); i++) lod->indices[level][i] = newIndex[lod->indices[level][i]];
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Builds the levels of every mesh of the scene, one mesh per task
+void buildSceneLods(std::vector<MeshLod> *lods, const aiScene *scene, ThreadPool &pool) {
+    lods->resize(scene->mNumMeshes);
+    pool.parallelFor(scene->mNumMeshes, [&](int meshId) {
+        buildMeshLod(&(*lods)[meshId], scene->mMeshes[meshId]);
+    });
+}
+
+// ----------------------------------------------------------------------------
+// Length of the vertex prefix a level of a mesh uses (the whole mesh if
+// lods is empty)
+int lodVertexCount(const std::vector<MeshLod> &lods, const aiScene *scene, int meshId, int level) {
+    return lods.empty() ? scene->mMeshes[meshId]->mNumVertices : lods[meshId].numVertices[level];
+}
+
+// ----------------------------------------------------------------------------
+void printLodInfo(const std::vector<MeshLod> &lods, const aiScene *scene) {
+    std::cout << "Levels of detail:";
+    for (int level = 0; level < LOD_LEVELS; level++) {
+        long long triangles = 0, vertices = 0;
+        for (int meshId = 0; meshId < lods.size(); meshId++) {
+            const MeshLod &lod = lods[meshId];
+            triangles += level > 0 && lod.simplified ? lod.indices[level].size() / 3 : scene->mMeshes[meshId]->mNumFaces;
+            vertices += lod.numVertices[level];
+        }
+        std::cout << (level > 0 ? "," : "") << " " << triangles << " triangles / " << vertices << " vertices";
+    }
+    std::cout << std::endl;
+}
+
+// ----------------------------------------------------------------------------
+// Projected size of one world unit at unit distance, in pixels, for a
+// perspective projection of fovY degrees onto a viewport viewportHeight high
+float lodPixelsPerUnit(float fovY, int viewportHeight) {
+    return viewportHeight / (2.0f * std::tan(fovY * 3.14159265f / 360.0f));
+}
+
+// ----------------------------------------------------------------------------
+// Level of detail of a character at position
+int selectLod(const LodView &view, const aiVector3D &position) {
+    if (view.pixelsPerUnit <= 0) return 0;
+    float distance = std::max((position - view.eye).Length(), 1e-3f);
+    float pixels = view.characterSize * view.pixelsPerUnit / distance;
+    int level = 0;
+    while (level < LOD_LEVELS - 1 && pixels < lodMinPixels[level]) level++;
+    return level;
+}
+
+#endif
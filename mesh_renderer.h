@@ -0,0 +1,301 @@
+// ----------------------------------------------------------------------------
+// Retained mesh renderer
+//
+// Each mesh is uploaded once: texture coordinates and vertex colours are
+// interleaved in a static vertex buffer and the faces go to an index buffer,
+// so a mesh is drawn with a single glDrawElements call. Meshes sharing a draw
+// mode and vertex format can be merged into one set of buffers. Skinned
+// positions and normals live in a separate stream buffer that is orphaned and
+// refilled each frame, so the driver never stalls waiting for the previous
+// frame's draw.
+//
+// The renderer keeps the fixed-function pipeline (lighting, glColor material,
+// texture environment); vertex data is fed through the client array pointers.
+// Each mesh records two vertex array objects: one with every attribute and
+// one with positions only, for the planar shadow pass. Without VAO support
+// the same pointers are set on every draw instead.
+//
+// With levels of detail (see mesh_lod.h), the index buffer holds the
+// triangles of every level one after the other. A level is drawn from its
+// range of the index buffer, and streaming a level uploads only the vertex
+// prefix of each mesh that the level uses.
+//-----------------------------------------------------------------------------
+
+#ifndef MESH_RENDERER_H
+#define MESH_RENDERER_H
+
+#include <algorithm>
+#include <vector>
+#include <GL/glew.h>
+#include <assimp/scene.h>
+#include "mesh_lod.h"
+
+struct GpuMesh {
+    std::vector<int> meshIds;        // Scene meshes merged into these buffers
+    GLuint vao = 0, shadowVao = 0;   // 0 if vertex array objects are not supported
+    GLuint staticVbo = 0;            // Interleaved texture coordinates (2 floats) and colours (4 floats)
+    GLuint streamVbo = 0;            // Positions, then normals, rewritten every frame
+    GLuint ibo = 0;
+    GLenum mode = GL_TRIANGLES;
+    GLsizei numIndices = 0;
+    int numVertices = 0;
+    int staticStride = 0;            // Bytes per vertex in staticVbo, 0 if it is empty
+    bool hasTexCoords = false, hasColors = false, hasNormals = false;
+    std::vector<GLsizei> lodFirstIndex, lodNumIndices;   // Index range of each level of detail
+    std::vector<int> lodMeshVertices;    // Vertices of each merged mesh per level, [level * meshIds.size() + i]
+};
+
+// ----------------------------------------------------------------------------
+// Clamps a level of detail to those the mesh has
+int gpuMeshLevel(const GpuMesh &gm, int level) {
+    return std::max(0, std::min(level, (int) gm.lodNumIndices.size() - 1));
+}
+
+// ----------------------------------------------------------------------------
+bool vertexArraysSupported() {
+    return GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object;
+}
+
+// ----------------------------------------------------------------------------
+// Sets the client array pointers of the mesh (recorded in its VAO when available)
+void bindMeshArrays(const GpuMesh &gm, bool isShadow) {
+    glBindBuffer(GL_ARRAY_BUFFER, gm.streamVbo);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, (const GLvoid *) 0);
+    if (gm.hasNormals) {
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glNormalPointer(GL_FLOAT, 0, (const GLvoid *) (gm.numVertices * sizeof(aiVector3D)));
+    } else {
+        glDisableClientState(GL_NORMAL_ARRAY);
+    }
+
+    bool texCoords = gm.hasTexCoords && !isShadow, colors = gm.hasColors && !isShadow;
+    if (texCoords || colors) glBindBuffer(GL_ARRAY_BUFFER, gm.staticVbo);
+    if (texCoords) {
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glTexCoordPointer(2, GL_FLOAT, gm.staticStride, (const GLvoid *) 0);
+    } else {
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    }
+    if (colors) {
+        glEnableClientState(GL_COLOR_ARRAY);
+        glColorPointer(4, GL_FLOAT, gm.staticStride, (const GLvoid *) (gm.hasTexCoords ? 2 * sizeof(float) : 0));
+    } else {
+        glDisableClientState(GL_COLOR_ARRAY);
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gm.ibo);
+}
+
+// ----------------------------------------------------------------------------
+// Meshes are split by primitive type on import (aiProcess_SortByPType), so
+// only mixed meshes (rare) are drawn as triangles with their points and lines dropped.
+GLenum meshDrawMode(const aiMesh *mesh) {
+    if (mesh->mPrimitiveTypes == aiPrimitiveType_POINT) return GL_POINTS;
+    if (mesh->mPrimitiveTypes == aiPrimitiveType_LINE) return GL_LINES;
+    return GL_TRIANGLES;
+}
+
+// ----------------------------------------------------------------------------
+// Appends the faces of a mesh to an index list, offset by the mesh's first vertex
+void appendMeshIndices(const aiMesh *mesh, GLenum mode, GLuint base, std::vector<GLuint> *indices) {
+    unsigned int faceSize = mode == GL_POINTS ? 1 : mode == GL_LINES ? 2 : 0;
+    for (int k = 0; k < mesh->mNumFaces; k++) {
+        const aiFace &face = mesh->mFaces[k];
+        if (faceSize > 0) {
+            if (face.mNumIndices != faceSize) continue;
+            for (int i = 0; i < faceSize; i++) indices->push_back(base + face.mIndices[i]);
+            continue;
+        }
+        for (int i = 2; i < face.mNumIndices; i++) {   // Polygons are fanned into triangles
+            indices->push_back(base + face.mIndices[0]);
+            indices->push_back(base + face.mIndices[i - 1]);
+            indices->push_back(base + face.mIndices[i]);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Uploads meshIds into one set of buffers. The meshes must share the same
+// draw mode and vertex attributes (those of the first mesh are used). The
+// levels of detail of lods are added if it isn't empty.
+void buildGpuMesh(GpuMesh *gm, const aiScene *scene, const std::vector<int> &meshIds,
+                  const std::vector<MeshLod> &lods = std::vector<MeshLod>()) {
+    const aiMesh *first = scene->mMeshes[meshIds[0]];
+    gm->meshIds = meshIds;
+    gm->mode = meshDrawMode(first);
+    gm->hasTexCoords = first->HasTextureCoords(0);
+    gm->hasColors = first->HasVertexColors(0);
+    gm->hasNormals = first->HasNormals();
+
+    std::vector<GLuint> indices;
+    gm->numVertices = 0;
+    for (int i = 0; i < meshIds.size(); i++) {
+        const aiMesh *mesh = scene->mMeshes[meshIds[i]];
+        appendMeshIndices(mesh, gm->mode, gm->numVertices, &indices);
+        gm->numVertices += mesh->mNumVertices;
+    }
+    gm->numIndices = (GLsizei) indices.size();
+
+    int numLevels = lods.empty() ? 1 : LOD_LEVELS;
+    gm->lodFirstIndex.assign(1, 0);
+    gm->lodNumIndices.assign(1, gm->numIndices);
+    gm->lodMeshVertices.clear();
+    for (int level = 0; level < numLevels; level++) {
+        GLuint base = 0;
+        GLsizei first = (GLsizei) indices.size();
+        for (int i = 0; i < meshIds.size(); i++) {
+            const aiMesh *mesh = scene->mMeshes[meshIds[i]];
+            gm->lodMeshVertices.push_back(lodVertexCount(lods, scene, meshIds[i], level));
+            if (level > 0) {
+                const MeshLod &lod = lods[meshIds[i]];
+                if (lod.simplified)
+                    for (int k = 0; k < lod.indices[level].size(); k++) indices.push_back(base + lod.indices[level][k]);
+                else
+                    appendMeshIndices(mesh, gm->mode, base, &indices);
+            }
+            base += mesh->mNumVertices;
+        }
+        if (level > 0) {
+            gm->lodFirstIndex.push_back(first);
+            gm->lodNumIndices.push_back((GLsizei) indices.size() - first);
+        }
+    }
+    glGenBuffers(1, &gm->ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gm->ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+    int floatsPerVertex = (gm->hasTexCoords ? 2 : 0) + (gm->hasColors ? 4 : 0);
+    gm->staticStride = floatsPerVertex * sizeof(float);
+    if (floatsPerVertex > 0) {
+        std::vector<float> interleaved(gm->numVertices * floatsPerVertex);
+        float *dst = interleaved.data();
+        for (int i = 0; i < meshIds.size(); i++) {
+            const aiMesh *mesh = scene->mMeshes[meshIds[i]];
+            for (int v = 0; v < mesh->mNumVertices; v++) {
+                if (gm->hasTexCoords) {
+                    *dst++ = mesh->mTextureCoords[0][v].x;
+                    *dst++ = mesh->mTextureCoords[0][v].y;
+                }
+                if (gm->hasColors) {
+                    const aiColor4D &c = mesh->mColors[0][v];
+                    *dst++ = c.r; *dst++ = c.g; *dst++ = c.b; *dst++ = c.a;
+                }
+            }
+        }
+        glGenBuffers(1, &gm->staticVbo);
+        glBindBuffer(GL_ARRAY_BUFFER, gm->staticVbo);
+        glBufferData(GL_ARRAY_BUFFER, interleaved.size() * sizeof(float), interleaved.data(), GL_STATIC_DRAW);
+    }
+
+    glGenBuffers(1, &gm->streamVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, gm->streamVbo);
+    glBufferData(GL_ARRAY_BUFFER, 2 * gm->numVertices * sizeof(aiVector3D), NULL, GL_STREAM_DRAW);
+
+    if (vertexArraysSupported()) {
+        glGenVertexArrays(1, &gm->vao);
+        glBindVertexArray(gm->vao);
+        bindMeshArrays(*gm, false);
+        glGenVertexArrays(1, &gm->shadowVao);
+        glBindVertexArray(gm->shadowVao);
+        bindMeshArrays(*gm, true);
+        glBindVertexArray(0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+// ----------------------------------------------------------------------------
+// Streams the current (skinned) positions and normals of the meshes, as far
+// as the given level of detail uses them
+void updateGpuMesh(const aiScene *scene, const GpuMesh &gm, int level = 0) {
+    GLsizeiptr normalsOffset = gm.numVertices * sizeof(aiVector3D);
+    const int *counts = &gm.lodMeshVertices[gpuMeshLevel(gm, level) * gm.meshIds.size()];
+    glBindBuffer(GL_ARRAY_BUFFER, gm.streamVbo);
+    glBufferData(GL_ARRAY_BUFFER, 2 * normalsOffset, NULL, GL_STREAM_DRAW);   // Orphan last frame's storage
+    GLintptr offset = 0;
+    for (int i = 0; i < gm.meshIds.size(); i++) {
+        const aiMesh *mesh = scene->mMeshes[gm.meshIds[i]];
+        GLsizeiptr bytes = counts[i] * sizeof(aiVector3D);
+        glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, mesh->mVertices);
+        if (gm.hasNormals) glBufferSubData(GL_ARRAY_BUFFER, normalsOffset + offset, bytes, mesh->mNormals);
+        offset += mesh->mNumVertices * sizeof(aiVector3D);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// ----------------------------------------------------------------------------
+// Streams positions and normals from per-mesh arrays (indexed by scene mesh
+// id) instead of the scene's own meshes
+void updateGpuMesh(const aiScene *scene, const GpuMesh &gm, aiVector3D *const *vertices,
+                   aiVector3D *const *normals, int level = 0) {
+    GLsizeiptr normalsOffset = gm.numVertices * sizeof(aiVector3D);
+    const int *counts = &gm.lodMeshVertices[gpuMeshLevel(gm, level) * gm.meshIds.size()];
+    glBindBuffer(GL_ARRAY_BUFFER, gm.streamVbo);
+    glBufferData(GL_ARRAY_BUFFER, 2 * normalsOffset, NULL, GL_STREAM_DRAW);
+    GLintptr offset = 0;
+    for (int i = 0; i < gm.meshIds.size(); i++) {
+        int meshId = gm.meshIds[i];
+        GLsizeiptr bytes = counts[i] * sizeof(aiVector3D);
+        glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, vertices[meshId]);
+        if (gm.hasNormals) glBufferSubData(GL_ARRAY_BUFFER, normalsOffset + offset, bytes, normals[meshId]);
+        offset += scene->mMeshes[meshId]->mNumVertices * sizeof(aiVector3D);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// ----------------------------------------------------------------------------
+// Creates another instance of a mesh: its own stream buffer and vertex array
+// objects, sharing the static vertex and index buffers of shared
+void createGpuMeshInstance(GpuMesh *gm, const GpuMesh &shared) {
+    *gm = shared;
+    glGenBuffers(1, &gm->streamVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, gm->streamVbo);
+    glBufferData(GL_ARRAY_BUFFER, 2 * gm->numVertices * sizeof(aiVector3D), NULL, GL_STREAM_DRAW);
+    gm->vao = gm->shadowVao = 0;
+    if (vertexArraysSupported()) {
+        glGenVertexArrays(1, &gm->vao);
+        glBindVertexArray(gm->vao);
+        bindMeshArrays(*gm, false);
+        glGenVertexArrays(1, &gm->shadowVao);
+        glBindVertexArray(gm->shadowVao);
+        bindMeshArrays(*gm, true);
+        glBindVertexArray(0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+// ----------------------------------------------------------------------------
+// Releases what createGpuMeshInstance created
+void releaseGpuMeshInstance(GpuMesh *gm) {
+    if (gm->vao != 0) {
+        glDeleteVertexArrays(1, &gm->vao);
+        glDeleteVertexArrays(1, &gm->shadowVao);
+    }
+    glDeleteBuffers(1, &gm->streamVbo);
+    gm->vao = gm->shadowVao = gm->streamVbo = 0;
+}
+
+// ----------------------------------------------------------------------------
+void drawGpuMesh(const GpuMesh &gm, bool isShadow, int level = 0) {
+    level = gpuMeshLevel(gm, level);
+    GLsizei count = gm.lodNumIndices[level];
+    const GLvoid *first = (const GLvoid *) (gm.lodFirstIndex[level] * sizeof(GLuint));
+    GLuint vao = isShadow ? gm.shadowVao : gm.vao;
+    if (vao != 0) {
+        glBindVertexArray(vao);
+        glDrawElements(gm.mode, count, GL_UNSIGNED_INT, first);
+        glBindVertexArray(0);
+        return;
+    }
+
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+    bindMeshArrays(gm, isShadow);
+    glDrawElements(gm.mode, count, GL_UNSIGNED_INT, first);
+    glPopClientAttrib();
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+#endif
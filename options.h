@@ -0,0 +1,132 @@
+// ----------------------------------------------------------------------------
+// Command line options shared by the viewers
+//
+// GLUT removes its own options (e.g. -display) in glutInit, so parseOptions
+// is called afterwards and only sees the viewer's options. Headless runs
+// never call glutInit, which would need a display; headlessRequested checks
+// for them beforehand.
+//-----------------------------------------------------------------------------
+
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+struct ViewerOptions {
+    int numThreads = 0;   // Skinning threads including the main thread, 0 = one per hardware thread
+    double bakeRate = 0;  // Samples per animation tick to bake the clip at, 0 = sample keys directly
+    bool compress = false;  // Sample the animation from a compressed copy of its keys
+    bool useCache = true;   // Load models from their binary scene cache when it is up to date
+    int headlessFrames = 0;  // Frames to render offscreen without a window, 0 = interactive
+    int width = 600;
+    int height = 600;
+    std::string frameDir;    // Directory to write headless frames to, empty = no frames
+    std::string timingsFile = "headless_timings.csv";
+    bool unthrottled = false;  // Render as fast as possible instead of at the display refresh rate
+    bool stats = false;      // Collect per-stage frame times from the start (otherwise only while the HUD is shown)
+    int crowdSize = 0;       // Instances of the model to draw as a crowd, 0 = a single model
+    bool cpuSkinning = false;  // Skin the crowd on the CPU even if vertex shader skinning is available
+    int skinCacheMB = 0;     // Budget of the crowd's skinning result cache, 0 = no cache
+    int crowdPhases = 0;     // Time offsets the crowd's instances are drawn from, 0 = any offset and speed
+    bool lod = false;        // Build levels of detail and draw each character at the one its size on screen needs
+    bool culling = true;     // Skip skinning and drawing characters whose animated bound is out of view
+    std::string clipDir;     // Directory of the clip library, empty = the viewer's model directory
+    int clipCapMB = 64;      // Clip data kept paged in, besides the clips playing
+};
+
+// ----------------------------------------------------------------------------
+void printUsage(const char *program) {
+    std::cout << "Usage: " << program << " [options]" << std::endl
+              << "  --threads N    Number of skinning threads (default: one per hardware thread)" << std::endl
+              << "  --bake N       Bake the animation at load time, N samples per tick (default: off)" << std::endl
+              << "  --compress     Keep the animation in compressed form and decode it while sampling" << std::endl
+              << "  --no-cache     Always import models with assimp, without reading or writing the scene cache" << std::endl
+              << "  --unthrottled  Don't wait for the display refresh between frames" << std::endl
+              << "  --headless N   Render N frames offscreen as fast as possible, without a window" << std::endl
+              << "  --size WxH     Headless frame size (default: 600x600)" << std::endl
+              << "  --frames DIR   Write every headless frame to DIR as a PPM image" << std::endl
+              << "  --timings FILE Headless per-frame timings CSV (default: headless_timings.csv)" << std::endl
+              << "  --stats        Collect per-stage frame times from the start ('p' or the end of a headless run" << std::endl
+              << "                 writes them to frame_stats.csv)" << std::endl
+              << "  --crowd N      Draw N instances of the model, each with its own clip, time offset and place" << std::endl
+              << "                 ('+' and '-' double and halve N)" << std::endl
+              << "  --cpu-skinning Skin the crowd on the CPU instead of in the vertex shader" << std::endl
+              << "  --skin-cache MB Share CPU skinning results between crowd instances at the same clip time," << std::endl
+              << "                 using at most MB megabytes (default: off)" << std::endl
+              << "  --crowd-phases K Play the crowd in step, from K evenly spaced time offsets" << std::endl
+              << "  --lod          Build levels of detail of the meshes at load time and skin and draw each" << std::endl
+              << "                 character at the level its projected size needs" << std::endl
+              << "  --no-culling   Skin and draw every character, even those out of view" << std::endl
+              << "  --clips DIR    Play the clips of DIR as the walk ('[' and ']' step through them; Dwarf)" << std::endl
+              << "  --clip-cap MB  Keep at most MB megabytes of library clips paged in (default: 64)" << std::endl;
+}
+
+// ----------------------------------------------------------------------------
+bool headlessRequested(int argc, char **argv) {
+    for (int i = 1; i < argc; i++)
+        if (!strcmp(argv[i], "--headless")) return true;
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+ViewerOptions parseOptions(int argc, char **argv) {
+    ViewerOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            options.numThreads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--bake") && i + 1 < argc) {
+            options.bakeRate = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--compress")) {
+            options.compress = true;
+        } else if (!strcmp(argv[i], "--no-cache")) {
+            options.useCache = false;
+        } else if (!strcmp(argv[i], "--unthrottled")) {
+            options.unthrottled = true;
+        } else if (!strcmp(argv[i], "--headless")) {
+            // headlessRequested already chose the offscreen path, so a
+            // missing or non-positive frame count cannot fall back to a window
+            options.headlessFrames = i + 1 < argc ? atoi(argv[++i]) : 0;
+            if (options.headlessFrames <= 0) {
+                printUsage(argv[0]);
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "--size") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2) {
+                printUsage(argv[0]);
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            options.frameDir = argv[++i];
+        } else if (!strcmp(argv[i], "--timings") && i + 1 < argc) {
+            options.timingsFile = argv[++i];
+        } else if (!strcmp(argv[i], "--stats")) {
+            options.stats = true;
+        } else if (!strcmp(argv[i], "--crowd") && i + 1 < argc) {
+            options.crowdSize = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--cpu-skinning")) {
+            options.cpuSkinning = true;
+        } else if (!strcmp(argv[i], "--skin-cache") && i + 1 < argc) {
+            options.skinCacheMB = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--crowd-phases") && i + 1 < argc) {
+            options.crowdPhases = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--lod")) {
+            options.lod = true;
+        } else if (!strcmp(argv[i], "--no-culling")) {
+            options.culling = false;
+        } else if (!strcmp(argv[i], "--clips") && i + 1 < argc) {
+            options.clipDir = argv[++i];
+        } else if (!strcmp(argv[i], "--clip-cap") && i + 1 < argc) {
+            options.clipCapMB = atoi(argv[++i]);
+        } else {
+            printUsage(argv[0]);
+            exit(strcmp(argv[i], "--help") == 0 ? 0 : 1);
+        }
+    }
+    return options;
+}
+
+#endif
@@ -0,0 +1,243 @@
+// ----------------------------------------------------------------------------
+// Material-sorted render queue
+//
+// Materials are resolved once at load into a flat table (texture id and
+// diffuse colour), so drawing needs no map lookups or aiGetMaterialColor
+// calls. The meshes of the scene graph are grouped into batches of meshes
+// that share a node, material and vertex format; each batch has one set of
+// buffers and one draw call. Batches are sorted by texture and then material,
+// so texture binds, texture enables and colour changes happen only when the
+// state actually differs from the previous batch. Batches carry the levels of
+// detail of their meshes, if any were built.
+//
+// Batches stay per node rather than merging meshes of different nodes with
+// the node transformations baked into the vertices: skinned vertices are
+// rewritten in mesh space every frame (on the CPU, or in the skinning
+// shader), and the bounds and crowd code apply each batch's node
+// transformation after skinning. The global transformation of a node that
+// no animation channel moves is taken once, when the queue is built.
+//-----------------------------------------------------------------------------
+
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <GL/glew.h>
+#include <assimp/cimport.h>
+#include <assimp/scene.h>
+#include "mesh_renderer.h"
+
+struct MaterialEntry {
+    GLuint texId = 0;          // 0 if the material has no diffuse texture
+    aiColor4D diffuse;         // Model colour, or the default colour if the material has none
+};
+
+struct DrawBatch {
+    const aiNode *node;        // Node whose transformation applies to every mesh of the batch
+    bool animated;             // A channel of the scene's animations moves the node or one of its ancestors
+    aiMatrix4x4 transform;     // Global transformation of node when the queue was built
+    int materialId;
+    bool textured;             // Material has a texture and the meshes have texture coordinates
+    GpuMesh gpu;
+};
+
+struct RenderQueue {
+    std::vector<MaterialEntry> materials;
+    std::vector<DrawBatch> batches;   // Sorted by texture, then material
+    aiColor4D shadowColor = aiColor4D(0.0f, 0.0f, 0.0f, 1.0f);   // Colour of the planar shadow
+};
+
+// ----------------------------------------------------------------------------
+// Accumulated transformation from the root node
+aiMatrix4x4 nodeGlobalTransform(const aiNode *nd) {
+    aiMatrix4x4 m = nd->mTransformation;
+    for (const aiNode *p = nd->mParent; p != NULL; p = p->mParent)
+        m = p->mTransformation * m;
+    return m;
+}
+
+// ----------------------------------------------------------------------------
+// Global transformation of a batch's node in the current pose
+aiMatrix4x4 batchTransform(const DrawBatch &batch) {
+    return batch.animated ? nodeGlobalTransform(batch.node) : batch.transform;
+}
+
+// ----------------------------------------------------------------------------
+void buildMaterialTable(std::vector<MaterialEntry> *materials, const aiScene *scene,
+                        const std::map<int, int> &texIdMap, const float *defaultCol) {
+    materials->resize(scene->mNumMaterials);
+    for (int m = 0; m < scene->mNumMaterials; m++) {
+        MaterialEntry &entry = (*materials)[m];
+        std::map<int, int>::const_iterator tex = texIdMap.find(m);
+        entry.texId = tex != texIdMap.end() ? tex->second : 0;
+        if (AI_SUCCESS == aiGetMaterialColor(scene->mMaterials[m], AI_MATKEY_COLOR_DIFFUSE, &entry.diffuse))
+            entry.diffuse.a = 1.0;
+        else
+            entry.diffuse = aiColor4D(defaultCol[0], defaultCol[1], defaultCol[2], defaultCol[3]);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// A mesh reference in the scene graph, with the state it is drawn with
+struct DrawItem {
+    int meshId;
+    const aiNode *node;
+    int materialId;
+    GLuint texId;
+    GLenum mode;
+    bool hasTexCoords, hasColors, hasNormals;
+};
+
+// ----------------------------------------------------------------------------
+// Items that compare equal here can share a batch
+bool sameBatch(const DrawItem &a, const DrawItem &b) {
+    return a.texId == b.texId && a.materialId == b.materialId && a.node == b.node && a.mode == b.mode
+           && a.hasTexCoords == b.hasTexCoords && a.hasColors == b.hasColors && a.hasNormals == b.hasNormals;
+}
+
+// ----------------------------------------------------------------------------
+bool drawOrder(const DrawItem &a, const DrawItem &b) {
+    if (a.texId != b.texId) return a.texId < b.texId;
+    if (a.materialId != b.materialId) return a.materialId < b.materialId;
+    if (a.node != b.node) return a.node < b.node;
+    if (a.mode != b.mode) return a.mode < b.mode;
+    if (a.hasTexCoords != b.hasTexCoords) return a.hasTexCoords < b.hasTexCoords;
+    if (a.hasColors != b.hasColors) return a.hasColors < b.hasColors;
+    if (a.hasNormals != b.hasNormals) return a.hasNormals < b.hasNormals;
+    return a.meshId < b.meshId;
+}
+
+// ----------------------------------------------------------------------------
+void collectDrawItems(const aiScene *scene, const aiNode *nd, const std::vector<MaterialEntry> &materials,
+                      std::vector<DrawItem> *items) {
+    for (int n = 0; n < nd->mNumMeshes; n++) {
+        const aiMesh *mesh = scene->mMeshes[nd->mMeshes[n]];
+        DrawItem item;
+        item.meshId = nd->mMeshes[n];
+        item.node = nd;
+        item.materialId = mesh->mMaterialIndex;
+        item.hasTexCoords = mesh->HasTextureCoords(0);
+        item.texId = item.hasTexCoords ? materials[item.materialId].texId : 0;
+        item.mode = meshDrawMode(mesh);
+        item.hasColors = mesh->HasVertexColors(0);
+        item.hasNormals = mesh->HasNormals();
+        items->push_back(item);
+    }
+    for (int i = 0; i < nd->mNumChildren; i++)
+        collectDrawItems(scene, nd->mChildren[i], materials, items);
+}
+
+// ----------------------------------------------------------------------------
+// Whether a channel of one of the scene's animations targets the node or
+// one of its ancestors
+bool nodeAnimated(const aiScene *scene, const aiNode *nd) {
+    for (; nd != NULL; nd = nd->mParent)
+        for (int a = 0; a < scene->mNumAnimations; a++)
+            for (int c = 0; c < scene->mAnimations[a]->mNumChannels; c++)
+                if (scene->mAnimations[a]->mChannels[c]->mNodeName == nd->mName) return true;
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+// Builds the material table and the sorted batches. Needs a GL context and
+// the textures of texIdMap to be loaded.
+void buildRenderQueue(RenderQueue *queue, const aiScene *scene, const std::map<int, int> &texIdMap,
+                      const float *defaultCol, const std::vector<MeshLod> &lods = std::vector<MeshLod>()) {
+    buildMaterialTable(&queue->materials, scene, texIdMap, defaultCol);
+
+    std::vector<DrawItem> items;
+    collectDrawItems(scene, scene->mRootNode, queue->materials, &items);
+    std::sort(items.begin(), items.end(), drawOrder);
+
+    queue->batches.clear();
+    for (int first = 0, last; first < items.size(); first = last) {
+        std::vector<int> meshIds;
+        for (last = first; last < items.size() && sameBatch(items[first], items[last]); last++)
+            meshIds.push_back(items[last].meshId);
+
+        DrawBatch batch;
+        batch.node = items[first].node;
+        batch.animated = nodeAnimated(scene, batch.node);
+        batch.transform = nodeGlobalTransform(batch.node);
+        batch.materialId = items[first].materialId;
+        batch.textured = items[first].texId != 0;
+        queue->batches.push_back(batch);
+        buildGpuMesh(&queue->batches.back().gpu, scene, meshIds, lods);
+    }
+}
+
+// ----------------------------------------------------------------------------
+void updateRenderQueue(const aiScene *scene, const RenderQueue &queue, int level = 0) {
+    for (int b = 0; b < queue.batches.size(); b++)
+        updateGpuMesh(scene, queue.batches[b].gpu, level);
+}
+
+// ----------------------------------------------------------------------------
+// GL state set by the previous batch, so that drawing a batch changes only
+// what differs
+struct MaterialState {
+    bool texturing = false;
+    GLuint boundTex = 0;
+    int currentMaterial = -1;
+};
+
+// ----------------------------------------------------------------------------
+void beginMaterialState(MaterialState *state, const RenderQueue &queue, bool isShadow) {
+    *state = MaterialState();
+    glDisable(GL_TEXTURE_2D);
+    if (isShadow) glColor4fv(&queue.shadowColor.r);
+}
+
+// ----------------------------------------------------------------------------
+// Sets the texture and colour of a batch. The shadow pass keeps the shadow
+// colour.
+void applyBatchMaterial(MaterialState *state, const RenderQueue &queue, const DrawBatch &batch, bool isShadow,
+                        const float *overrideCol) {
+    if (isShadow) return;
+    if (batch.textured != state->texturing) {
+        state->texturing = batch.textured;
+        if (state->texturing) glEnable(GL_TEXTURE_2D);
+        else glDisable(GL_TEXTURE_2D);
+    }
+    if (state->texturing && queue.materials[batch.materialId].texId != state->boundTex) {
+        state->boundTex = queue.materials[batch.materialId].texId;
+        glBindTexture(GL_TEXTURE_2D, state->boundTex);
+    }
+    if (batch.materialId != state->currentMaterial) {
+        state->currentMaterial = batch.materialId;
+        glColor4fv(overrideCol != NULL ? overrideCol : &queue.materials[batch.materialId].diffuse.r);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Call after drawing a batch's mesh
+void endBatchMaterial(MaterialState *state, const DrawBatch &batch, bool isShadow) {
+    if (!isShadow && batch.gpu.hasColors) state->currentMaterial = -1;   // Vertex colours leave the current colour undefined
+}
+
+// ----------------------------------------------------------------------------
+// Draws every batch at the given level of detail. The shadow pass draws
+// positions only, in the queue's shadow colour. overrideCol, if not NULL, replaces the colour of
+// every material.
+void drawRenderQueue(const RenderQueue &queue, bool isShadow, const float *overrideCol, int level = 0) {
+    MaterialState state;
+    beginMaterialState(&state, queue, isShadow);
+    for (int b = 0; b < queue.batches.size(); b++) {
+        const DrawBatch &batch = queue.batches[b];
+        applyBatchMaterial(&state, queue, batch, isShadow, overrideCol);
+
+        aiMatrix4x4 m = batchTransform(batch);
+        aiTransposeMatrix4(&m);   //Convert to column-major order
+        glPushMatrix();
+        glMultMatrixf((float *) &m);
+        drawGpuMesh(batch.gpu, isShadow, level);
+        glPopMatrix();
+
+        endBatchMaterial(&state, batch, isShadow);
+    }
+    glDisable(GL_TEXTURE_2D);
+}
+
+#endif
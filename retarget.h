@@ -0,0 +1,183 @@
+// ----------------------------------------------------------------------------
+// Animation retargeting
+//
+// Plays a clip made for one skeleton (the source) on another (the target).
+// Target joints are matched to source joints once per clip, by name: the
+// retarget map pairs each target joint with one or more source names
+// (aliases, tried in order), and can be read from a config file. Each match
+// is compiled with two correction rotations derived from both bind poses,
+// which carry the source joint's rotation relative to its bind pose over to
+// the target joint's bind pose, so skeletons whose joints rest in different
+// orientations still move alike. The bind rotations are captured once per
+// skeleton, while its nodes still hold them, so tables can also be built for
+// clips loaded later. Retargeting a frame is then one pass over a flat table
+// of channel indices, with no name lookups.
+//
+// Config file lines are "target = source [alias ...]"; "correction none"
+// copies rotations as they are, without bind pose correction. Everything
+// after a '#' is a comment.
+//-----------------------------------------------------------------------------
+
+#ifndef RETARGET_H
+#define RETARGET_H
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <assimp/scene.h>
+#include "skeleton.h"
+#include "anim_sampler.h"
+
+struct RetargetPair {
+    std::string target;
+    std::vector<std::string> sources;   // Source joint names, in order of preference
+};
+
+struct RetargetMap {
+    std::vector<RetargetPair> pairs;
+    bool bindCorrection = true;
+};
+
+// One target channel driven by a source channel: the target rotation is
+// pre * source rotation * post
+struct RetargetEntry {
+    int targetChannel;
+    int sourceChannel;
+    aiQuaternion pre, post;
+};
+
+struct RetargetTable {
+    std::vector<RetargetEntry> entries;
+};
+
+// Bind rotations of the joints driven by each channel of a clip, so tables
+// can be built after the joints have been posed
+struct RetargetBind {
+    std::vector<aiQuaternion> locals;         // Joint's own bind rotation
+    std::vector<aiQuaternion> parentGlobals;  // Accumulated bind rotation of its parent
+    std::vector<char> hasNode;                // 0 if the channel's node was not found
+};
+
+// ----------------------------------------------------------------------------
+// Reads a retarget map from a config file. Prints the problem and returns
+// false if the file can't be read or has a malformed line.
+bool loadRetargetMap(RetargetMap *map, const std::string &path) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        std::cout << "The retarget map '" << path << "' could not be opened." << std::endl;
+        return false;
+    }
+    *map = RetargetMap();
+    std::string line;
+    for (int lineNo = 1; std::getline(in, line); lineNo++) {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+        std::istringstream words(line);
+        std::string target, word;
+        if (!(words >> target)) continue;
+
+        if (target == "correction" && words >> word && (word == "bind" || word == "none")) {
+            map->bindCorrection = word == "bind";
+            continue;
+        }
+        RetargetPair pair;
+        pair.target = target;
+        if (words >> word && word == "=")
+            while (words >> word) pair.sources.push_back(word);
+        if (pair.sources.empty()) {
+            std::cout << path << ":" << lineNo << ": expected 'target = source [alias ...]'" << std::endl;
+            return false;
+        }
+        map->pairs.push_back(pair);
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+aiQuaternion rotationOf(const aiMatrix4x4 &m) {
+    aiVector3D scaling, position;
+    aiQuaternion rotation;
+    m.Decompose(scaling, rotation, position);
+    return rotation;
+}
+
+// ----------------------------------------------------------------------------
+aiQuaternion inverseRotation(aiQuaternion q) {
+    return q.Conjugate();
+}
+
+// ----------------------------------------------------------------------------
+// Rotation of a node's accumulated transformation from the root (identity
+// for NULL)
+aiQuaternion globalRotation(const aiNode *nd) {
+    aiMatrix4x4 m;
+    for (const aiNode *p = nd; p != NULL; p = p->mParent)
+        m = p->mTransformation * m;
+    return rotationOf(m);
+}
+
+// ----------------------------------------------------------------------------
+// Records the bind rotations of the nodes under root that the channels of
+// anim drive. The nodes must still hold their bind transformations.
+void captureRetargetBind(RetargetBind *bind, const aiAnimation *anim, const aiNode *root) {
+    bind->locals.assign(anim->mNumChannels, aiQuaternion());
+    bind->parentGlobals.assign(anim->mNumChannels, aiQuaternion());
+    bind->hasNode.assign(anim->mNumChannels, 0);
+    for (int i = 0; i < anim->mNumChannels; i++) {
+        const aiNode *node = root->FindNode(anim->mChannels[i]->mNodeName);
+        if (node == NULL) continue;
+        bind->locals[i] = rotationOf(node->mTransformation);
+        bind->parentGlobals[i] = globalRotation(node->mParent);
+        bind->hasNode[i] = 1;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Compiles the map into a table from the channels of source to those of
+// target, given the bind rotations of both. With bind correction, a source
+// rotation is turned into a change of the joint's orientation relative to
+// its bind pose, in world space, and that change is applied to the target
+// joint's bind pose:
+//     target = Pt^-1 Ps source Bs^-1 Ps^-1 Pt Bt
+// where Bs and Bt are the bind rotations of the joints and Ps and Pt the
+// global bind rotations of their parents.
+void buildRetargetTable(RetargetTable *table, const RetargetMap &map, const aiAnimation *source,
+                        const RetargetBind &sourceBind, const aiAnimation *target, const RetargetBind &targetBind) {
+    table->entries.clear();
+    for (int p = 0; p < map.pairs.size(); p++) {
+        const RetargetPair &pair = map.pairs[p];
+        int targetChannel = findChannel(target, pair.target.c_str());
+        int sourceChannel = -1;
+        for (int s = 0; s < pair.sources.size() && sourceChannel < 0; s++)
+            sourceChannel = findChannel(source, pair.sources[s].c_str());
+        if (targetChannel < 0 || sourceChannel < 0) {
+            std::cout << "Retargeting: no " << (targetChannel < 0 ? "target" : "source") << " channel for '"
+                      << pair.target << "'" << std::endl;
+            continue;
+        }
+
+        RetargetEntry entry;
+        entry.targetChannel = targetChannel;
+        entry.sourceChannel = sourceChannel;
+        if (map.bindCorrection && sourceBind.hasNode[sourceChannel] && targetBind.hasNode[targetChannel]) {
+            entry.pre = inverseRotation(targetBind.parentGlobals[targetChannel]) * sourceBind.parentGlobals[sourceChannel];
+            entry.post = inverseRotation(sourceBind.locals[sourceChannel]) * inverseRotation(entry.pre)
+                         * targetBind.locals[targetChannel];
+        }
+        table->entries.push_back(entry);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Sets the rotation of every target channel of the table from the pose of
+// the source channels
+void retargetPose(const RetargetTable &table, const JointPose *source, JointPose *target) {
+    for (int i = 0; i < table.entries.size(); i++) {
+        const RetargetEntry &entry = table.entries[i];
+        target[entry.targetChannel].rotation = entry.pre * source[entry.sourceChannel].rotation * entry.post;
+    }
+}
+
+#endif
@@ -0,0 +1,637 @@
+// ----------------------------------------------------------------------------
+// Binary scene cache
+//
+// Importing the models with aiProcessPreset_TargetRealtime_MaxQuality parses
+// text formats and reruns every post-processing step on each launch. After
+// the first import, importScene writes the post-processed scene to a binary
+// file next to the source (<source>.cache). Later launches map that file and
+// rebuild the aiScene object graph around it: vertex attributes, indices,
+// bone weights and animation keys are used in place from the mapping, so
+// loading does no parsing and copies almost nothing.
+//
+// The cache is rejected, and the source re-imported, when the source file's
+// size or modification time, the post-processing flags, the format version
+// or the in-memory layout of the stored structs differ. Arrays are stored
+// 16-byte aligned. The mapping is private, so skinning can write to mVertices
+// and mNormals without touching the file.
+//
+// Only the parts of a scene the viewers use are cached (meshes, materials,
+// nodes and animations); scenes with embedded textures are not cached.
+// BVH files bypass both assimp and the cache: the streaming loader of
+// bvh_loader.h reads them faster than a cache could be validated and mapped.
+// Scenes from importScene must be released with releaseScene.
+// releaseAnimationKeys drops the raw keys of an animation that has been
+// compressed (or otherwise copied): heap keys are freed, and the pages of
+// cached keys are handed back to the kernel.
+//-----------------------------------------------------------------------------
+
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include <assimp/cimport.h>
+#include <assimp/scene.h>
+#include "bvh_loader.h"
+
+#define SCENE_CACHE_VERSION 1
+#define SCENE_CACHE_ALIGNMENT 16
+
+struct SceneCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;            // Sizes of the structs used in place, see sceneCacheLayout
+    uint32_t postProcessFlags;
+    uint32_t sceneFlags;
+    int64_t sourceTime;         // Modification time and size of the source file
+    int64_t sourceSize;
+    double importMs;            // Duration of the assimp import the cache was written from
+};
+
+// Memory backing a scene loaded from the cache
+struct SceneCacheMapping {
+    char *data;
+    size_t size;
+    bool mapped;                // false if data was read into a heap buffer
+};
+
+std::map<const aiScene*, SceneCacheMapping> cachedScenes;
+std::set<const aiScene*> loadedBvhScenes;   // Built by loadBvhScene, released with delete
+std::mutex cachedScenesMutex;   // Scenes may be imported on several threads
+
+// ----------------------------------------------------------------------------
+uint32_t sceneCacheLayout() {
+    return (uint32_t) sizeof(aiVectorKey) | (uint32_t) sizeof(aiQuatKey) << 8
+           | (uint32_t) sizeof(aiVertexWeight) << 16 | (uint32_t) sizeof(aiColor4D) << 24;
+}
+
+//=============================================================================
+// Writing
+//=============================================================================
+
+void cachePut(std::vector<char> &out, const void *data, size_t size) {
+    out.insert(out.end(), (const char *) data, (const char *) data + size);
+}
+
+void cachePutU32(std::vector<char> &out, uint32_t value) {
+    cachePut(out, &value, sizeof(value));
+}
+
+void cachePutString(std::vector<char> &out, const aiString &str) {
+    uint32_t length = (uint32_t) strlen(str.C_Str());
+    cachePutU32(out, length);
+    cachePut(out, str.C_Str(), length);
+}
+
+// Arrays are aligned so they can be used in place from the mapping
+void cachePutArray(std::vector<char> &out, const void *data, size_t size) {
+    out.resize((out.size() + SCENE_CACHE_ALIGNMENT - 1) / SCENE_CACHE_ALIGNMENT * SCENE_CACHE_ALIGNMENT, 0);
+    cachePut(out, data, size);
+}
+
+// ----------------------------------------------------------------------------
+void cachePutNode(std::vector<char> &out, const aiNode *node) {
+    cachePutString(out, node->mName);
+    cachePut(out, &node->mTransformation, sizeof(aiMatrix4x4));
+    cachePutU32(out, node->mNumMeshes);
+    cachePut(out, node->mMeshes, node->mNumMeshes * sizeof(unsigned int));
+    cachePutU32(out, node->mNumChildren);
+    for (int i = 0; i < node->mNumChildren; i++)
+        cachePutNode(out, node->mChildren[i]);
+}
+
+// ----------------------------------------------------------------------------
+void cachePutMesh(std::vector<char> &out, const aiMesh *mesh) {
+    cachePutString(out, mesh->mName);
+    cachePutU32(out, mesh->mPrimitiveTypes);
+    cachePutU32(out, mesh->mNumVertices);
+    cachePutU32(out, mesh->mNumFaces);
+    cachePutU32(out, mesh->mMaterialIndex);
+
+    // Bit 0-2: normals, tangents, bitangents; bits 3-10: colour sets; bits 11-18: texture coordinate sets
+    uint32_t present = (mesh->mNormals ? 1 : 0) | (mesh->mTangents ? 2 : 0) | (mesh->mBitangents ? 4 : 0);
+    for (int k = 0; k < AI_MAX_NUMBER_OF_COLOR_SETS; k++)
+        if (mesh->mColors[k]) present |= 8u << k;
+    for (int k = 0; k < AI_MAX_NUMBER_OF_TEXTURECOORDS; k++)
+        if (mesh->mTextureCoords[k]) present |= 8u << (AI_MAX_NUMBER_OF_COLOR_SETS + k);
+    cachePutU32(out, present);
+
+    size_t vecBytes = mesh->mNumVertices * sizeof(aiVector3D);
+    cachePutArray(out, mesh->mVertices, vecBytes);
+    if (mesh->mNormals) cachePutArray(out, mesh->mNormals, vecBytes);
+    if (mesh->mTangents) cachePutArray(out, mesh->mTangents, vecBytes);
+    if (mesh->mBitangents) cachePutArray(out, mesh->mBitangents, vecBytes);
+    for (int k = 0; k < AI_MAX_NUMBER_OF_COLOR_SETS; k++)
+        if (mesh->mColors[k]) cachePutArray(out, mesh->mColors[k], mesh->mNumVertices * sizeof(aiColor4D));
+    for (int k = 0; k < AI_MAX_NUMBER_OF_TEXTURECOORDS; k++) {
+        if (!mesh->mTextureCoords[k]) continue;
+        cachePutU32(out, mesh->mNumUVComponents[k]);
+        cachePutArray(out, mesh->mTextureCoords[k], vecBytes);
+    }
+
+    // Faces as a count per face followed by all indices
+    std::vector<uint32_t> counts(mesh->mNumFaces), indices;
+    for (int f = 0; f < mesh->mNumFaces; f++) {
+        counts[f] = mesh->mFaces[f].mNumIndices;
+        indices.insert(indices.end(), mesh->mFaces[f].mIndices, mesh->mFaces[f].mIndices + counts[f]);
+    }
+    cachePutArray(out, counts.data(), counts.size() * sizeof(uint32_t));
+    cachePutU32(out, (uint32_t) indices.size());
+    cachePutArray(out, indices.data(), indices.size() * sizeof(uint32_t));
+
+    cachePutU32(out, mesh->mNumBones);
+    for (int b = 0; b < mesh->mNumBones; b++) {
+        const aiBone *bone = mesh->mBones[b];
+        cachePutString(out, bone->mName);
+        cachePut(out, &bone->mOffsetMatrix, sizeof(aiMatrix4x4));
+        cachePutU32(out, bone->mNumWeights);
+        cachePutArray(out, bone->mWeights, bone->mNumWeights * sizeof(aiVertexWeight));
+    }
+}
+
+// ----------------------------------------------------------------------------
+void cachePutAnimation(std::vector<char> &out, const aiAnimation *anim) {
+    cachePutString(out, anim->mName);
+    cachePut(out, &anim->mDuration, sizeof(double));
+    cachePut(out, &anim->mTicksPerSecond, sizeof(double));
+    cachePutU32(out, anim->mNumChannels);
+    for (int i = 0; i < anim->mNumChannels; i++) {
+        const aiNodeAnim *ch = anim->mChannels[i];
+        cachePutString(out, ch->mNodeName);
+        cachePutU32(out, ch->mPreState);
+        cachePutU32(out, ch->mPostState);
+        cachePutU32(out, ch->mNumPositionKeys);
+        cachePutArray(out, ch->mPositionKeys, ch->mNumPositionKeys * sizeof(aiVectorKey));
+        cachePutU32(out, ch->mNumRotationKeys);
+        cachePutArray(out, ch->mRotationKeys, ch->mNumRotationKeys * sizeof(aiQuatKey));
+        cachePutU32(out, ch->mNumScalingKeys);
+        cachePutArray(out, ch->mScalingKeys, ch->mNumScalingKeys * sizeof(aiVectorKey));
+    }
+}
+
+// ----------------------------------------------------------------------------
+bool writeSceneCache(const aiScene *scene, const std::string &cachePath, const struct stat &source,
+                     unsigned int flags, double importMs) {
+    if (scene->mNumTextures > 0) return false;
+
+    std::vector<char> out;
+    SceneCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "A2SCACHE", 8);
+    header.version = SCENE_CACHE_VERSION;
+    header.layout = sceneCacheLayout();
+    header.postProcessFlags = flags;
+    header.sceneFlags = scene->mFlags;
+    header.sourceTime = (int64_t) source.st_mtime;
+    header.sourceSize = (int64_t) source.st_size;
+    header.importMs = importMs;
+    cachePut(out, &header, sizeof(header));
+
+    cachePutU32(out, scene->mNumMaterials);
+    for (int m = 0; m < scene->mNumMaterials; m++) {
+        const aiMaterial *mtl = scene->mMaterials[m];
+        cachePutU32(out, mtl->mNumProperties);
+        for (int p = 0; p < mtl->mNumProperties; p++) {
+            const aiMaterialProperty *prop = mtl->mProperties[p];
+            cachePutString(out, prop->mKey);
+            cachePutU32(out, prop->mSemantic);
+            cachePutU32(out, prop->mIndex);
+            cachePutU32(out, prop->mType);
+            cachePutU32(out, prop->mDataLength);
+            cachePutArray(out, prop->mData, prop->mDataLength);
+        }
+    }
+
+    cachePutU32(out, scene->mNumMeshes);
+    for (int i = 0; i < scene->mNumMeshes; i++)
+        cachePutMesh(out, scene->mMeshes[i]);
+    cachePutNode(out, scene->mRootNode);
+    cachePutU32(out, scene->mNumAnimations);
+    for (int i = 0; i < scene->mNumAnimations; i++)
+        cachePutAnimation(out, scene->mAnimations[i]);
+
+    // Write to a temporary file first so an interrupted write never leaves a truncated cache
+    std::string tempPath = cachePath + ".tmp";
+    FILE *file = fopen(tempPath.c_str(), "wb");
+    if (file == NULL) return false;
+    bool written = fwrite(out.data(), 1, out.size(), file) == out.size();
+    written = fclose(file) == 0 && written;
+    if (!written || rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+//=============================================================================
+// Reading
+//=============================================================================
+
+// Reads sequentially from the mapped file; any read past the end clears ok
+struct CacheReader {
+    char *data;
+    size_t size;
+    size_t pos;
+    bool ok;
+};
+
+void *cacheGet(CacheReader &in, size_t size) {
+    if (!in.ok || size > in.size - in.pos) {
+        in.ok = false;
+        return NULL;
+    }
+    void *p = in.data + in.pos;
+    in.pos += size;
+    return p;
+}
+
+uint32_t cacheGetU32(CacheReader &in) {
+    uint32_t value = 0;
+    void *p = cacheGet(in, sizeof(value));
+    if (p) memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+aiString cacheGetString(CacheReader &in) {
+    uint32_t length = cacheGetU32(in);
+    const char *chars = (const char *) cacheGet(in, length);
+    aiString str;
+    if (chars) str.Set(std::string(chars, length));
+    return str;
+}
+
+// Returns a pointer into the mapping (NULL for an empty array)
+template <typename T>
+T *cacheGetArray(CacheReader &in, size_t count) {
+    size_t aligned = (in.pos + SCENE_CACHE_ALIGNMENT - 1) / SCENE_CACHE_ALIGNMENT * SCENE_CACHE_ALIGNMENT;
+    if (aligned > in.size) in.ok = false;
+    else in.pos = aligned;
+    T *p = (T *) cacheGet(in, count * sizeof(T));
+    return count > 0 ? p : NULL;
+}
+
+// ----------------------------------------------------------------------------
+aiNode *cacheGetNode(CacheReader &in, aiNode *parent) {
+    aiNode *node = new aiNode();
+    node->mParent = parent;
+    node->mName = cacheGetString(in);
+    void *transform = cacheGet(in, sizeof(aiMatrix4x4));
+    if (transform) memcpy(&node->mTransformation, transform, sizeof(aiMatrix4x4));
+
+    node->mNumMeshes = cacheGetU32(in);
+    unsigned int *meshes = (unsigned int *) cacheGet(in, node->mNumMeshes * sizeof(unsigned int));
+    if (!in.ok) {
+        node->mNumMeshes = 0;
+        return node;
+    }
+    if (node->mNumMeshes > 0) {
+        node->mMeshes = new unsigned int[node->mNumMeshes];
+        memcpy(node->mMeshes, meshes, node->mNumMeshes * sizeof(unsigned int));
+    }
+
+    uint32_t numChildren = cacheGetU32(in);
+    if (numChildren > 0 && in.ok) {
+        node->mChildren = new aiNode*[numChildren];
+        for (; node->mNumChildren < numChildren && in.ok; node->mNumChildren++)
+            node->mChildren[node->mNumChildren] = cacheGetNode(in, node);
+    }
+    return node;
+}
+
+// ----------------------------------------------------------------------------
+aiMesh *cacheGetMesh(CacheReader &in) {
+    aiMesh *mesh = new aiMesh();
+    mesh->mName = cacheGetString(in);
+    mesh->mPrimitiveTypes = cacheGetU32(in);
+    mesh->mNumVertices = cacheGetU32(in);
+    uint32_t numFaces = cacheGetU32(in);
+    mesh->mMaterialIndex = cacheGetU32(in);
+    uint32_t present = cacheGetU32(in);
+
+    size_t n = mesh->mNumVertices;
+    mesh->mVertices = cacheGetArray<aiVector3D>(in, n);
+    if (present & 1) mesh->mNormals = cacheGetArray<aiVector3D>(in, n);
+    if (present & 2) mesh->mTangents = cacheGetArray<aiVector3D>(in, n);
+    if (present & 4) mesh->mBitangents = cacheGetArray<aiVector3D>(in, n);
+    for (int k = 0; k < AI_MAX_NUMBER_OF_COLOR_SETS; k++)
+        if (present & (8u << k)) mesh->mColors[k] = cacheGetArray<aiColor4D>(in, n);
+    for (int k = 0; k < AI_MAX_NUMBER_OF_TEXTURECOORDS; k++) {
+        if (!(present & (8u << (AI_MAX_NUMBER_OF_COLOR_SETS + k)))) continue;
+        mesh->mNumUVComponents[k] = cacheGetU32(in);
+        mesh->mTextureCoords[k] = cacheGetArray<aiVector3D>(in, n);
+    }
+
+    const uint32_t *counts = cacheGetArray<uint32_t>(in, numFaces);
+    uint32_t numIndices = cacheGetU32(in);
+    unsigned int *indices = cacheGetArray<unsigned int>(in, numIndices);
+    if (in.ok && numFaces > 0) {
+        mesh->mFaces = new aiFace[numFaces];
+        mesh->mNumFaces = numFaces;
+        uint32_t next = 0;
+        for (int f = 0; f < numFaces; f++) {
+            if (counts[f] > numIndices - next) {
+                in.ok = false;
+                break;
+            }
+            mesh->mFaces[f].mNumIndices = counts[f];
+            mesh->mFaces[f].mIndices = indices + next;
+            next += counts[f];
+        }
+    }
+
+    uint32_t numBones = cacheGetU32(in);
+    if (numBones > 0 && in.ok) {
+        mesh->mBones = new aiBone*[numBones];
+        for (; mesh->mNumBones < numBones && in.ok; mesh->mNumBones++) {
+            aiBone *bone = new aiBone();
+            mesh->mBones[mesh->mNumBones] = bone;
+            bone->mName = cacheGetString(in);
+            void *offset = cacheGet(in, sizeof(aiMatrix4x4));
+            if (offset) memcpy(&bone->mOffsetMatrix, offset, sizeof(aiMatrix4x4));
+            bone->mNumWeights = cacheGetU32(in);
+            bone->mWeights = cacheGetArray<aiVertexWeight>(in, bone->mNumWeights);
+        }
+    }
+    return mesh;
+}
+
+// ----------------------------------------------------------------------------
+aiAnimation *cacheGetAnimation(CacheReader &in) {
+    aiAnimation *anim = new aiAnimation();
+    anim->mName = cacheGetString(in);
+    void *times = cacheGet(in, 2 * sizeof(double));
+    if (times) {
+        memcpy(&anim->mDuration, times, sizeof(double));
+        memcpy(&anim->mTicksPerSecond, (char *) times + sizeof(double), sizeof(double));
+    }
+
+    uint32_t numChannels = cacheGetU32(in);
+    if (numChannels > 0 && in.ok) {
+        anim->mChannels = new aiNodeAnim*[numChannels];
+        for (; anim->mNumChannels < numChannels && in.ok; anim->mNumChannels++) {
+            aiNodeAnim *ch = new aiNodeAnim();
+            anim->mChannels[anim->mNumChannels] = ch;
+            ch->mNodeName = cacheGetString(in);
+            ch->mPreState = (aiAnimBehaviour) cacheGetU32(in);
+            ch->mPostState = (aiAnimBehaviour) cacheGetU32(in);
+            ch->mNumPositionKeys = cacheGetU32(in);
+            ch->mPositionKeys = cacheGetArray<aiVectorKey>(in, ch->mNumPositionKeys);
+            ch->mNumRotationKeys = cacheGetU32(in);
+            ch->mRotationKeys = cacheGetArray<aiQuatKey>(in, ch->mNumRotationKeys);
+            ch->mNumScalingKeys = cacheGetU32(in);
+            ch->mScalingKeys = cacheGetArray<aiVectorKey>(in, ch->mNumScalingKeys);
+        }
+    }
+    return anim;
+}
+
+// ----------------------------------------------------------------------------
+// Clears every pointer into the cache mapping, so the scene can be deleted
+void detachSceneCache(aiScene *scene) {
+    for (int i = 0; i < scene->mNumMeshes; i++) {
+        aiMesh *mesh = scene->mMeshes[i];
+        mesh->mVertices = mesh->mNormals = mesh->mTangents = mesh->mBitangents = NULL;
+        for (int k = 0; k < AI_MAX_NUMBER_OF_COLOR_SETS; k++) mesh->mColors[k] = NULL;
+        for (int k = 0; k < AI_MAX_NUMBER_OF_TEXTURECOORDS; k++) mesh->mTextureCoords[k] = NULL;
+        for (int f = 0; f < mesh->mNumFaces; f++) mesh->mFaces[f].mIndices = NULL;
+        for (int b = 0; b < mesh->mNumBones; b++) mesh->mBones[b]->mWeights = NULL;
+    }
+    for (int i = 0; i < scene->mNumAnimations; i++) {
+        aiAnimation *anim = scene->mAnimations[i];
+        for (int c = 0; c < anim->mNumChannels; c++) {
+            anim->mChannels[c]->mPositionKeys = anim->mChannels[c]->mScalingKeys = NULL;
+            anim->mChannels[c]->mRotationKeys = NULL;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+void unmapSceneCache(const SceneCacheMapping &mapping) {
+#ifndef _WIN32
+    if (mapping.mapped) {
+        munmap(mapping.data, mapping.size);
+        return;
+    }
+#endif
+    delete[] mapping.data;
+}
+
+// ----------------------------------------------------------------------------
+bool mapSceneCache(const std::string &cachePath, SceneCacheMapping *mapping) {
+#ifndef _WIN32
+    int fd = open(cachePath.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+        data = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    mapping->data = (char *) data;
+    mapping->size = info.st_size;
+    mapping->mapped = true;
+    return true;
+#else
+    FILE *file = fopen(cachePath.c_str(), "rb");
+    if (file == NULL) return false;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    mapping->data = new char[size > 0 ? size : 1];
+    mapping->size = size > 0 ? size : 0;
+    mapping->mapped = false;
+    bool ok = size > 0 && fread(mapping->data, 1, size, file) == (size_t) size;
+    fclose(file);
+    if (!ok) delete[] mapping->data;
+    return ok;
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// Returns the cached scene, or NULL if there is no valid cache for the source
+const aiScene *loadSceneCache(const std::string &cachePath, const struct stat &source, unsigned int flags,
+                              double *importMs) {
+    SceneCacheMapping mapping;
+    if (!mapSceneCache(cachePath, &mapping)) return NULL;
+
+    CacheReader in = {mapping.data, mapping.size, 0, true};
+    const SceneCacheHeader *header = (const SceneCacheHeader *) cacheGet(in, sizeof(SceneCacheHeader));
+    if (header == NULL || memcmp(header->magic, "A2SCACHE", 8) != 0 || header->version != SCENE_CACHE_VERSION
+        || header->layout != sceneCacheLayout() || header->postProcessFlags != flags
+        || header->sourceTime != (int64_t) source.st_mtime || header->sourceSize != (int64_t) source.st_size) {
+        unmapSceneCache(mapping);
+        return NULL;
+    }
+    *importMs = header->importMs;
+
+    aiScene *scene = new aiScene();
+    scene->mFlags = header->sceneFlags;
+
+    uint32_t numMaterials = cacheGetU32(in);
+    if (numMaterials > 0 && in.ok) {
+        scene->mMaterials = new aiMaterial*[numMaterials];
+        for (; scene->mNumMaterials < numMaterials && in.ok; scene->mNumMaterials++) {
+            aiMaterial *mtl = new aiMaterial();
+            scene->mMaterials[scene->mNumMaterials] = mtl;
+            uint32_t numProperties = cacheGetU32(in);
+            for (int p = 0; p < numProperties && in.ok; p++) {
+                aiString key = cacheGetString(in);
+                uint32_t semantic = cacheGetU32(in), index = cacheGetU32(in), type = cacheGetU32(in);
+                uint32_t length = cacheGetU32(in);
+                const char *data = cacheGetArray<char>(in, length);
+                if (in.ok)
+                    mtl->AddBinaryProperty(data, length, key.C_Str(), semantic, index, (aiPropertyTypeInfo) type);
+            }
+        }
+    }
+
+    uint32_t numMeshes = cacheGetU32(in);
+    if (numMeshes > 0 && in.ok) {
+        scene->mMeshes = new aiMesh*[numMeshes];
+        for (; scene->mNumMeshes < numMeshes && in.ok; scene->mNumMeshes++)
+            scene->mMeshes[scene->mNumMeshes] = cacheGetMesh(in);
+    }
+    if (in.ok) scene->mRootNode = cacheGetNode(in, NULL);
+    uint32_t numAnimations = cacheGetU32(in);
+    if (numAnimations > 0 && in.ok) {
+        scene->mAnimations = new aiAnimation*[numAnimations];
+        for (; scene->mNumAnimations < numAnimations && in.ok; scene->mNumAnimations++)
+            scene->mAnimations[scene->mNumAnimations] = cacheGetAnimation(in);
+    }
+
+    if (!in.ok) {
+        std::cout << "Scene cache '" << cachePath << "' is corrupt, ignoring it." << std::endl;
+        detachSceneCache(scene);
+        delete scene;
+        unmapSceneCache(mapping);
+        return NULL;
+    }
+    std::lock_guard<std::mutex> lock(cachedScenesMutex);
+    cachedScenes[scene] = mapping;
+    return scene;
+}
+
+//=============================================================================
+// Loading and releasing scenes
+//=============================================================================
+
+// Imports a scene, from its cache if valid; otherwise with assimp, writing the cache.
+// BVH files are read with loadBvhScene.
+const aiScene *importScene(const char *fileName, unsigned int flags, bool useCache = true) {
+    if (isBvhFile(fileName)) {
+        const aiScene *scene = loadBvhScene(fileName);
+        std::lock_guard<std::mutex> lock(cachedScenesMutex);
+        if (scene != NULL) loadedBvhScenes.insert(scene);
+        return scene;
+    }
+
+    typedef std::chrono::high_resolution_clock Clock;
+    Clock::time_point start = Clock::now();
+    std::string cachePath = std::string(fileName) + ".cache";
+    struct stat source;
+    bool haveSource = stat(fileName, &source) == 0;
+
+    if (useCache && haveSource) {
+        double importMs = 0;
+        const aiScene *scene = loadSceneCache(cachePath, source, flags, &importMs);
+        if (scene != NULL) {
+            double loadMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            std::ostringstream message;
+            message << "Loaded '" << fileName << "' from cache in " << loadMs << " ms (assimp import: "
+                    << importMs << " ms)\n";
+            std::cout << message.str() << std::flush;
+            return scene;
+        }
+    }
+
+    const aiScene *scene = aiImportFile(fileName, flags);
+    double importMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    if (scene == NULL) return NULL;
+    std::ostringstream message;
+    message << "Imported '" << fileName << "' with assimp in " << importMs << " ms\n";
+    if (useCache && haveSource && writeSceneCache(scene, cachePath, source, flags, importMs))
+        message << "Wrote scene cache '" << cachePath << "'\n";
+    std::cout << message.str() << std::flush;
+    return scene;
+}
+
+// ----------------------------------------------------------------------------
+// Shrinks a key array to its first key, freeing the rest. Keys inside a
+// mapping stay where they are and only their pages are released.
+template <typename Key>
+void releaseKeys(Key **keys, unsigned int *numKeys, bool inMapping) {
+    if (*numKeys <= 1) return;
+#ifndef _WIN32
+    if (inMapping) {
+        uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+        uintptr_t begin = ((uintptr_t) (*keys + 1) + page - 1) & ~(page - 1);
+        uintptr_t end = (uintptr_t) (*keys + *numKeys) & ~(page - 1);
+        if (end > begin) madvise((void *) begin, end - begin, MADV_DONTNEED);
+    }
+#endif
+    if (!inMapping) {
+        Key *first = new Key[1];
+        first[0] = (*keys)[0];
+        delete[] *keys;
+        *keys = first;
+    }
+    *numKeys = 1;
+}
+
+// ----------------------------------------------------------------------------
+// Drops all but the first key of every track of one of the scene's
+// animations, for when a compressed or baked copy is sampled instead. The
+// first keys stay, as the bind-like pose some viewers read.
+void releaseAnimationKeys(const aiScene *scene, int animId) {
+    bool inMapping;
+    {
+        std::lock_guard<std::mutex> lock(cachedScenesMutex);
+        inMapping = cachedScenes.count(scene) > 0;
+    }
+    aiAnimation *anim = scene->mAnimations[animId];
+    for (int i = 0; i < anim->mNumChannels; i++) {
+        aiNodeAnim *ch = anim->mChannels[i];
+        releaseKeys(&ch->mPositionKeys, &ch->mNumPositionKeys, inMapping);
+        releaseKeys(&ch->mRotationKeys, &ch->mNumRotationKeys, inMapping);
+        releaseKeys(&ch->mScalingKeys, &ch->mNumScalingKeys, inMapping);
+    }
+}
+
+// ----------------------------------------------------------------------------
+void releaseScene(const aiScene *scene) {
+    SceneCacheMapping mapping;
+    {
+        std::lock_guard<std::mutex> lock(cachedScenesMutex);
+        if (loadedBvhScenes.erase(scene) > 0) {
+            delete scene;
+            return;
+        }
+        std::map<const aiScene*, SceneCacheMapping>::iterator it = cachedScenes.find(scene);
+        if (it == cachedScenes.end()) {
+            aiReleaseImport(scene);
+            return;
+        }
+        mapping = it->second;
+        cachedScenes.erase(it);
+    }
+    detachSceneCache(const_cast<aiScene *>(scene));
+    delete scene;
+    unmapSceneCache(mapping);
+}
+
+#endif
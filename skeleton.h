@@ -0,0 +1,143 @@
+// ----------------------------------------------------------------------------
+// Compiled skeleton
+//
+// The node hierarchy is flattened once at load time into an array of joints
+// sorted so that every parent precedes its children. Animation channels and
+// mesh bones are resolved to joint indices up front, so the per-frame work is
+// a single linear pass over the joints with no name lookups or parent walks.
+//-----------------------------------------------------------------------------
+
+#ifndef SKELETON_H
+#define SKELETON_H
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <assimp/scene.h>
+
+struct Skeleton {
+    std::vector<aiNode*> nodes;          // Joint nodes in topological (parent first) order
+    std::vector<int> parents;            // Index of each joint's parent, -1 for the root
+    std::vector<aiMatrix4x4> globals;    // Model space transform of each joint
+    std::map<std::string, int> jointIds; // Load-time name lookup only
+};
+
+// Bone palette for a single mesh: one entry per aiBone, in mesh bone order.
+// The matrix arrays carry one extra identity entry at index mNumBones, which
+// vertices without any bone influence are bound to. The derived arrays are
+// filled from matrices by prepareSkinPalette (skinning.h) for the active mode.
+struct BonePalette {
+    std::vector<int> boneJoints;         // Joint index of each bone (-1 if unresolved)
+    std::vector<aiMatrix4x4> offsets;    // Copy of each bone's mOffsetMatrix
+    std::vector<aiMatrix4x4> matrices;   // Final skinning matrices (global * offset)
+    std::vector<aiMatrix4x4> normalMatrices;  // Linear blend: inverse transpose of each matrix
+    std::vector<float> packed;           // Linear blend: rows 1-3 of both matrices, for the vector kernels
+    std::vector<float> dualQuats;        // Dual quaternion: rigid part of each matrix, plus its scale
+};
+
+// ----------------------------------------------------------------------------
+void buildSkeleton(Skeleton *skel, aiNode *root) {
+    skel->nodes.clear();
+    skel->parents.clear();
+    skel->jointIds.clear();
+
+    // Depth-first pre-order traversal guarantees parents are visited first
+    std::vector<std::pair<aiNode*, int> > stack;
+    stack.push_back(std::make_pair(root, -1));
+    while (!stack.empty()) {
+        aiNode *node = stack.back().first;
+        int parent = stack.back().second;
+        stack.pop_back();
+
+        int jointId = (int) skel->nodes.size();
+        skel->nodes.push_back(node);
+        skel->parents.push_back(parent);
+        skel->jointIds.insert(std::make_pair(std::string(node->mName.C_Str()), jointId));
+
+        for (int i = (int) node->mNumChildren - 1; i >= 0; i--)
+            stack.push_back(std::make_pair(node->mChildren[i], jointId));
+    }
+    skel->globals.resize(skel->nodes.size());
+}
+
+// ----------------------------------------------------------------------------
+int findJoint(const Skeleton &skel, const aiString &name) {
+    std::map<std::string, int>::const_iterator it = skel.jointIds.find(name.C_Str());
+    return it == skel.jointIds.end() ? -1 : it->second;
+}
+
+// ----------------------------------------------------------------------------
+// Maps each channel of an animation to the joint it drives (-1 if none)
+std::vector<int> mapChannelsToJoints(const Skeleton &skel, const aiAnimation *anim) {
+    std::vector<int> channelJoints(anim->mNumChannels);
+    for (int i = 0; i < anim->mNumChannels; i++)
+        channelJoints[i] = findJoint(skel, anim->mChannels[i]->mNodeName);
+    return channelJoints;
+}
+
+// ----------------------------------------------------------------------------
+// Index of the channel of an animation that drives the named node, -1 if none
+int findChannel(const aiAnimation *anim, const char *nodeName) {
+    for (int i = 0; i < anim->mNumChannels; i++)
+        if (anim->mChannels[i]->mNodeName == aiString(nodeName)) return i;
+    return -1;
+}
+
+// ----------------------------------------------------------------------------
+void buildBonePalette(BonePalette *palette, const Skeleton &skel, const aiMesh *mesh) {
+    palette->boneJoints.resize(mesh->mNumBones);
+    palette->offsets.resize(mesh->mNumBones);
+    palette->matrices.assign(mesh->mNumBones + 1, aiMatrix4x4());
+    for (int boneId = 0; boneId < mesh->mNumBones; boneId++) {
+        aiBone *bone = mesh->mBones[boneId];
+        palette->boneJoints[boneId] = findJoint(skel, bone->mName);
+        palette->offsets[boneId] = bone->mOffsetMatrix;
+        if (palette->boneJoints[boneId] < 0)
+            std::cout << "Bone '" << bone->mName.C_Str() << "' has no matching node in the skeleton." << std::endl;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Single linear pass: parents are always computed before their children
+void updateGlobalTransforms(Skeleton *skel) {
+    int numJoints = (int) skel->nodes.size();
+    for (int j = 0; j < numJoints; j++) {
+        int parent = skel->parents[j];
+        if (parent < 0)
+            skel->globals[j] = skel->nodes[j]->mTransformation;
+        else
+            skel->globals[j] = skel->globals[parent] * skel->nodes[j]->mTransformation;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Same pass for joint transforms held outside the nodes (one skeleton, many poses)
+void computeGlobalTransforms(const Skeleton &skel, const aiMatrix4x4 *locals, aiMatrix4x4 *globals) {
+    int numJoints = (int) skel.nodes.size();
+    for (int j = 0; j < numJoints; j++) {
+        int parent = skel.parents[j];
+        globals[j] = parent < 0 ? locals[j] : globals[parent] * locals[j];
+    }
+}
+
+// ----------------------------------------------------------------------------
+void updateBonePalette(BonePalette *palette, const Skeleton &skel) {
+    for (int boneId = 0; boneId < palette->boneJoints.size(); boneId++) {
+        int jointId = palette->boneJoints[boneId];
+        palette->matrices[boneId] = jointId < 0 ? palette->offsets[boneId]
+                                                : skel.globals[jointId] * palette->offsets[boneId];
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Palette of one pose of a shared skeleton: the bone joints and offsets are
+// read from bind, so palette only needs its matrices (sized like bind's)
+void updateBonePalette(BonePalette *palette, const BonePalette &bind, const aiMatrix4x4 *globals) {
+    for (int boneId = 0; boneId < bind.boneJoints.size(); boneId++) {
+        int jointId = bind.boneJoints[boneId];
+        palette->matrices[boneId] = jointId < 0 ? bind.offsets[boneId] : globals[jointId] * bind.offsets[boneId];
+    }
+}
+
+#endif
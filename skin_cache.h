@@ -0,0 +1,157 @@
+// ----------------------------------------------------------------------------
+// Skinning result cache
+//
+// Characters playing the same clip at the same sample time in the same
+// skinning mode and level of detail produce identical skinned vertices, so
+// one skinned copy (and its stream buffers) can be drawn for all of them.
+// Entries are keyed by (clip, quantised time, mode, level) and hold the
+// output of every mesh of the model. They live in a list kept in least
+// recently used order, and are evicted from its tail when a new entry would
+// exceed the memory budget.
+// Entries used in the current frame are never evicted, since they are still
+// to be drawn; if the budget can't be met without them, the caller skins
+// into its own buffers instead (a bypass).
+// Evicted entries keep their buffers and go to a spare list, and new entries
+// are taken from it, so a cache that has filled its budget (or whose spare
+// list the caller filled up front) recycles skinned copies instead of
+// allocating them. The index is a sorted vector rather than a map, so
+// inserting into it doesn't allocate either.
+//-----------------------------------------------------------------------------
+
+#ifndef SKIN_CACHE_H
+#define SKIN_CACHE_H
+
+#include <algorithm>
+#include <list>
+#include <vector>
+#include <assimp/scene.h>
+#include "mesh_renderer.h"
+#include "bone_bounds.h"
+
+struct SkinCacheKey {
+    int clipId;
+    long long sample;    // Time in units of the cache's step
+    int mode;            // SkinMode
+    int lod;             // Level of detail
+};
+
+bool operator<(const SkinCacheKey &a, const SkinCacheKey &b) {
+    if (a.clipId != b.clipId) return a.clipId < b.clipId;
+    if (a.sample != b.sample) return a.sample < b.sample;
+    if (a.mode != b.mode) return a.mode < b.mode;
+    return a.lod < b.lod;
+}
+
+// Skinned copy of a model, ready to draw
+struct SkinOutput {
+    std::vector<std::vector<aiVector3D> > vertices, normals;   // Skinned output of each mesh
+    std::vector<aiVector3D *> vertexPtrs, normalPtrs;          // Indexed by mesh id, for updateGpuMesh
+    std::vector<GpuMesh> gpuMeshes;    // One per render batch
+    std::vector<aiMatrix4x4> batchTransforms;   // Transformation of each render batch's node
+    BoundingBox bounds;                // Bound of the pose, in the model's space
+};
+
+// ----------------------------------------------------------------------------
+void releaseSkinOutput(SkinOutput *output) {
+    for (int b = 0; b < output->gpuMeshes.size(); b++) releaseGpuMeshInstance(&output->gpuMeshes[b]);
+    *output = SkinOutput();
+}
+
+struct SkinCacheEntry {
+    SkinCacheKey key;
+    size_t bytes = 0;                  // Counted against the budget (CPU and GPU copies)
+    long long lastUsed = -1;           // Frame it was last found or inserted in
+    SkinOutput output;                 // Empty until the caller fills it
+};
+
+typedef std::pair<SkinCacheKey, std::list<SkinCacheEntry>::iterator> SkinCacheSlot;
+
+// ----------------------------------------------------------------------------
+bool skinCacheSlotBefore(const SkinCacheSlot &slot, const SkinCacheKey &key) {
+    return slot.first < key;
+}
+
+struct SkinCache {
+    size_t budgetBytes = 0;            // 0 disables the cache
+    double step = 0.25;                // Time quantum, in ticks
+    size_t usedBytes = 0;
+    long long frame = 0;
+    std::list<SkinCacheEntry> entries; // Most recently used first
+    std::list<SkinCacheEntry> spare;   // Not in use; outputs keep their buffers, for reuse
+    std::vector<SkinCacheSlot> index;  // Sorted by key
+
+    // Counters since the cache was created
+    unsigned long long hits = 0, misses = 0, evictions = 0, bypasses = 0;
+};
+
+// ----------------------------------------------------------------------------
+bool skinCacheEnabled(const SkinCache &cache) {
+    return cache.budgetBytes > 0;
+}
+
+// ----------------------------------------------------------------------------
+// Starts a frame: entries found or inserted from now on are protected from
+// eviction until the next call
+void beginSkinCacheFrame(SkinCache *cache) {
+    cache->frame++;
+}
+
+// ----------------------------------------------------------------------------
+// Returns the entry for key and marks it most recently used, or NULL
+SkinCacheEntry *findSkinCacheEntry(SkinCache *cache, const SkinCacheKey &key) {
+    std::vector<SkinCacheSlot>::iterator it = std::lower_bound(cache->index.begin(), cache->index.end(), key,
+                                                               skinCacheSlotBefore);
+    if (it == cache->index.end() || key < it->first) return NULL;
+    cache->entries.splice(cache->entries.begin(), cache->entries, it->second);
+    it->second->lastUsed = cache->frame;
+    cache->hits++;
+    return &*it->second;
+}
+
+// ----------------------------------------------------------------------------
+// Moves an entry to the spare list, buffers and all
+void evictSkinCacheEntry(SkinCache *cache, std::list<SkinCacheEntry>::iterator it) {
+    cache->usedBytes -= it->bytes;
+    cache->index.erase(std::lower_bound(cache->index.begin(), cache->index.end(), it->key, skinCacheSlotBefore));
+    cache->spare.splice(cache->spare.begin(), cache->entries, it);
+    cache->evictions++;
+}
+
+// ----------------------------------------------------------------------------
+// Adds an entry of the given size for key (which must not be in the cache),
+// evicting least recently used entries to stay within the budget. The entry
+// is a spare one if there is any, whose output still has the buffers (and
+// stale contents) of its last use; otherwise its output is empty. Returns
+// NULL if that would mean evicting an entry used in this frame.
+SkinCacheEntry *insertSkinCacheEntry(SkinCache *cache, const SkinCacheKey &key, size_t bytes) {
+    cache->misses++;
+    while (cache->usedBytes + bytes > cache->budgetBytes && !cache->entries.empty()
+           && cache->entries.back().lastUsed != cache->frame)
+        evictSkinCacheEntry(cache, --cache->entries.end());
+    if (cache->usedBytes + bytes > cache->budgetBytes) {
+        cache->bypasses++;
+        return NULL;
+    }
+
+    if (cache->spare.empty()) cache->entries.push_front(SkinCacheEntry());
+    else cache->entries.splice(cache->entries.begin(), cache->spare, cache->spare.begin());
+    SkinCacheEntry &entry = cache->entries.front();
+    entry.key = key;
+    entry.bytes = bytes;
+    entry.lastUsed = cache->frame;
+    cache->index.insert(std::lower_bound(cache->index.begin(), cache->index.end(), key, skinCacheSlotBefore),
+                        SkinCacheSlot(key, cache->entries.begin()));
+    cache->usedBytes += bytes;
+    return &entry;
+}
+
+// ----------------------------------------------------------------------------
+// Evicts every entry and releases the buffers of all of them
+void clearSkinCache(SkinCache *cache) {
+    while (!cache->entries.empty()) evictSkinCacheEntry(cache, cache->entries.begin());
+    for (std::list<SkinCacheEntry>::iterator it = cache->spare.begin(); it != cache->spare.end(); ++it)
+        releaseSkinOutput(&it->output);
+    cache->spare.clear();
+}
+
+#endif
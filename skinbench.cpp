@@ -0,0 +1,307 @@
+//  ========================================================================
+//  FILE NAME: skinbench.cpp
+//
+//  Standalone benchmark of the per-frame animation hot path: pose
+//  evaluation, node/palette update and skinning, without a GL context.
+//  Each bundled model is loaded the way its viewer loads it and animated
+//  for a number of frames; per-stage latency statistics and skinning
+//  throughput are written as JSON.
+//
+//  Usage: skinbench [--frames N] [--threads N] [--bake N] [--compress]
+//                   [--dual-quat] [--no-cache] [--json FILE]
+//  ========================================================================
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include <assimp/cimport.h>
+#include <assimp/types.h>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include "skeleton.h"
+#include "anim_sampler.h"
+#include "anim_bake.h"
+#include "anim_compress.h"
+#include "skinning.h"
+#include "thread_pool.h"
+#include "scene_cache.h"
+#include "retarget.h"
+
+typedef std::chrono::steady_clock BenchClock;
+
+struct BenchOptions {
+    int numFrames = 5000;
+    int numThreads = 0;
+    double bakeRate = 0;
+    bool compress = false;
+    bool useCache = true;
+    SkinMode skinMode = SKIN_MODE_LINEAR;
+    string jsonFile = "skinbench.json";
+};
+
+// A bundled model, with the animation its viewer plays
+struct BenchModel {
+    const char *name;
+    const char *modelFile;
+    const char *animFile;          // NULL if the animation is in the model file
+    const char *extraAnimFile;     // Second clip evaluated every frame (Dwarf's walk), or NULL
+    const char *retargetFile;      // Retarget map playing the second clip on the model's joints
+    const char *pinnedChannel;     // Channel whose translation is zeroed (Mannequin's root), or NULL
+};
+
+const BenchModel benchModels[] = {
+        {"ArmyPilot", "./models/ArmyPilot/ArmyPilot.x", NULL, NULL, NULL, NULL},
+        {"Mannequin", "./models/Mannequin/mannequin.fbx", "./models/Mannequin/run.fbx", NULL, NULL,
+         "free3dmodel_skeleton"},
+        {"Dwarf", "./models/Dwarf/dwarf.x", NULL, "./models/Dwarf/avatar_walk.bvh", "./models/Dwarf/avatar_walk.retarget",
+         NULL},
+};
+
+// One animation clip, evaluated the way the viewers do (baked, compressed or from keys)
+struct BenchClip {
+    const aiAnimation *anim;
+    AnimSampler sampler;
+    BakedClip baked;
+    CompressedClip compressed;
+    CompressedSampler compressedSampler;
+    vector<JointPose> pose;
+};
+
+struct StageStats {
+    double min, median, p99, mean;   // ms
+};
+
+// ----------------------------------------------------------------------------
+void initBenchClip(BenchClip *clip, const aiAnimation *anim, const BenchOptions &options, ThreadPool &pool) {
+    clip->anim = anim;
+    initAnimSampler(&clip->sampler, anim);
+    clip->pose.resize(anim->mNumChannels);
+    if (options.bakeRate > 0) {
+        bakeClip(&clip->baked, anim, options.bakeRate, pool);
+    } else if (options.compress) {
+        compressClip(&clip->compressed, anim);
+        initCompressedSampler(&clip->compressedSampler, &clip->compressed);
+    }
+}
+
+// ----------------------------------------------------------------------------
+void evaluateBenchClip(BenchClip *clip, int tick) {
+    int animTick = tick % ((int) clip->anim->mDuration + 1);
+    if (clip->baked.numFrames > 0)
+        evaluateBakedPose(clip->baked, animTick, &clip->pose[0]);
+    else if (clip->compressedSampler.clip != NULL)
+        samplePose(&clip->compressedSampler, animTick, &clip->pose[0]);
+    else
+        samplePose(&clip->sampler, animTick, &clip->pose[0]);
+}
+
+// ----------------------------------------------------------------------------
+StageStats stageStats(vector<double> times) {
+    StageStats stats;
+    sort(times.begin(), times.end());
+    double sum = 0;
+    for (int i = 0; i < times.size(); i++) sum += times[i];
+    stats.min = times.front();
+    stats.median = times[times.size() / 2];
+    stats.p99 = times[min(times.size() - 1, (size_t) (0.99 * times.size()))];
+    stats.mean = sum / times.size();
+    return stats;
+}
+
+// ----------------------------------------------------------------------------
+void writeStageJson(ostream &out, const char *name, const StageStats &stats, bool last) {
+    out << "        \"" << name << "\": {\"min_ms\": " << stats.min << ", \"median_ms\": " << stats.median
+        << ", \"p99_ms\": " << stats.p99 << ", \"mean_ms\": " << stats.mean << "}" << (last ? "\n" : ",\n");
+}
+
+// ----------------------------------------------------------------------------
+// Loads and animates one model, appending its JSON object to out
+bool benchmarkModel(const BenchModel &model, const BenchOptions &options, ThreadPool &pool, ostream &out) {
+    const aiScene *scene = importScene(model.modelFile, aiProcessPreset_TargetRealtime_MaxQuality, options.useCache);
+    const aiScene *sceneAnim = model.animFile == NULL ? scene
+            : importScene(model.animFile, aiProcessPreset_TargetRealtime_MaxQuality, options.useCache);
+    const aiScene *sceneExtra = model.extraAnimFile == NULL ? NULL
+            : importScene(model.extraAnimFile, aiProcessPreset_TargetRealtime_MaxQuality, options.useCache);
+    RetargetMap extraMap;
+    if (scene == NULL || sceneAnim == NULL || (model.extraAnimFile != NULL && sceneExtra == NULL)
+        || (model.retargetFile != NULL && !loadRetargetMap(&extraMap, model.retargetFile))) {
+        cout << "Skipping " << model.name << ": the model files could not be loaded." << endl;
+        if (sceneExtra != NULL) releaseScene(sceneExtra);
+        if (sceneAnim != NULL && sceneAnim != scene) releaseScene(sceneAnim);
+        if (scene != NULL) releaseScene(scene);
+        return false;
+    }
+
+    // Same setup as the viewer's loadModel
+    Skeleton skeleton;
+    buildSkeleton(&skeleton, sceneAnim->mRootNode);
+    const aiAnimation *anim = sceneAnim->mAnimations[0];
+    vector<int> channelJoints = mapChannelsToJoints(skeleton, anim);
+    int pinnedChannel = model.pinnedChannel != NULL ? findChannel(anim, model.pinnedChannel) : -1;
+
+    vector<BonePalette> bonePalettes(scene->mNumMeshes);
+    vector<SkinMesh> skinMeshes(scene->mNumMeshes);
+    int numVertices = 0;
+    for (int meshId = 0; meshId < scene->mNumMeshes; meshId++) {
+        buildBonePalette(&bonePalettes[meshId], skeleton, scene->mMeshes[meshId]);
+        buildSkinMesh(&skinMeshes[meshId], scene->mMeshes[meshId]);
+        numVertices += scene->mMeshes[meshId]->mNumVertices;
+    }
+    vector<SkinChunk> skinChunks = buildSkinChunks(skinMeshes);
+
+    BenchClip clip, extraClip;
+    initBenchClip(&clip, anim, options, pool);
+
+    // The second clip drives the model's joints through a retarget table, as
+    // the Dwarf viewer's walk does, with the other channels at their first
+    // key's position
+    RetargetTable extraRetarget;
+    vector<aiVector3D> restPositions(anim->mNumChannels);
+    if (sceneExtra != NULL) {
+        const aiAnimation *extraAnim = sceneExtra->mAnimations[0];
+        initBenchClip(&extraClip, extraAnim, options, pool);
+        RetargetBind modelBind, extraBind;
+        captureRetargetBind(&modelBind, anim, sceneAnim->mRootNode);
+        captureRetargetBind(&extraBind, extraAnim, sceneExtra->mRootNode);
+        buildRetargetTable(&extraRetarget, extraMap, extraAnim, extraBind, anim, modelBind);
+        for (int i = 0; i < anim->mNumChannels; i++)
+            if (anim->mChannels[i]->mNumPositionKeys > 0) restPositions[i] = anim->mChannels[i]->mPositionKeys[0].mValue;
+    }
+
+    // Warm up caches, the pool and the clip cursors
+    int warmup = min(100, options.numFrames);
+    vector<double> poseTimes, nodeTimes, skinTimes, frameTimes;
+    for (int frame = -warmup; frame < options.numFrames; frame++) {
+        int tick = frame + warmup;
+        BenchClock::time_point t0 = BenchClock::now();
+        evaluateBenchClip(&clip, tick);
+        if (sceneExtra != NULL) {
+            evaluateBenchClip(&extraClip, tick);
+            for (int i = 0; i < clip.pose.size(); i++) clip.pose[i].position = restPositions[i];
+            retargetPose(extraRetarget, &extraClip.pose[0], &clip.pose[0]);
+        }
+        if (pinnedChannel >= 0) clip.pose[pinnedChannel].position = aiVector3D(0.0f, 0.0f, 0.0f);
+
+        BenchClock::time_point t1 = BenchClock::now();
+        for (int i = 0; i < clip.pose.size(); i++)
+            if (channelJoints[i] >= 0) skeleton.nodes[channelJoints[i]]->mTransformation = poseMatrix(clip.pose[i]);
+        updateGlobalTransforms(&skeleton);
+        for (int meshId = 0; meshId < scene->mNumMeshes; meshId++)
+            updateBonePalette(&bonePalettes[meshId], skeleton);
+
+        BenchClock::time_point t2 = BenchClock::now();
+        skinMeshesParallel(pool, skinChunks, skinMeshes, bonePalettes, scene, options.skinMode);
+        BenchClock::time_point t3 = BenchClock::now();
+
+        if (frame < 0) continue;
+        poseTimes.push_back(chrono::duration<double, milli>(t1 - t0).count());
+        nodeTimes.push_back(chrono::duration<double, milli>(t2 - t1).count());
+        skinTimes.push_back(chrono::duration<double, milli>(t3 - t2).count());
+        frameTimes.push_back(chrono::duration<double, milli>(t3 - t0).count());
+    }
+
+    double skinSeconds = 0;
+    for (int i = 0; i < skinTimes.size(); i++) skinSeconds += skinTimes[i] / 1000.0;
+    StageStats frameStats = stageStats(frameTimes);
+    cout << model.name << ": " << numVertices << " vertices, " << skeleton.nodes.size() << " joints, median frame "
+         << frameStats.median << " ms, p99 " << frameStats.p99 << " ms" << endl;
+
+    out << "    {\n"
+        << "      \"name\": \"" << model.name << "\",\n"
+        << "      \"vertices\": " << numVertices << ",\n"
+        << "      \"meshes\": " << scene->mNumMeshes << ",\n"
+        << "      \"joints\": " << skeleton.nodes.size() << ",\n"
+        << "      \"channels\": " << anim->mNumChannels << ",\n"
+        << "      \"vertices_per_second\": " << (skinSeconds > 0 ? numVertices * skinTimes.size() / skinSeconds : 0)
+        << ",\n"
+        << "      \"stages\": {\n";
+    writeStageJson(out, "pose", stageStats(poseTimes), false);
+    writeStageJson(out, "nodes", stageStats(nodeTimes), false);
+    writeStageJson(out, "skin", stageStats(skinTimes), false);
+    writeStageJson(out, "frame", frameStats, true);
+    out << "      }\n    }";
+
+    if (sceneExtra != NULL) releaseScene(sceneExtra);
+    if (sceneAnim != scene) releaseScene(sceneAnim);
+    releaseScene(scene);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+void printBenchUsage(const char *program) {
+    cout << "Usage: " << program << " [options]" << endl
+         << "  --frames N     Frames to animate per model (default: 5000)" << endl
+         << "  --threads N    Number of skinning threads (default: one per hardware thread)" << endl
+         << "  --bake N       Bake the animations, N samples per tick (default: off)" << endl
+         << "  --compress     Sample the animations from compressed keys" << endl
+         << "  --dual-quat    Use dual quaternion skinning" << endl
+         << "  --no-cache     Always import models with assimp" << endl
+         << "  --json FILE    Results file (default: skinbench.json)" << endl;
+}
+
+// ----------------------------------------------------------------------------
+BenchOptions parseBenchOptions(int argc, char **argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            options.numFrames = max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            options.numThreads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--bake") && i + 1 < argc) {
+            options.bakeRate = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--compress")) {
+            options.compress = true;
+        } else if (!strcmp(argv[i], "--dual-quat")) {
+            options.skinMode = SKIN_MODE_DUAL_QUAT;
+        } else if (!strcmp(argv[i], "--no-cache")) {
+            options.useCache = false;
+        } else if (!strcmp(argv[i], "--json") && i + 1 < argc) {
+            options.jsonFile = argv[++i];
+        } else {
+            printBenchUsage(argv[0]);
+            exit(strcmp(argv[i], "--help") == 0 ? 0 : 1);
+        }
+    }
+    return options;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options = parseBenchOptions(argc, argv);
+    ThreadPool pool(options.numThreads);
+    const char *sampling = options.bakeRate > 0 ? "baked" : options.compress ? "compressed" : "keys";
+
+    ofstream out(options.jsonFile.c_str());
+    if (!out) {
+        cout << "Could not write " << options.jsonFile << endl;
+        return 1;
+    }
+    out << "{\n"
+        << "  \"frames\": " << options.numFrames << ",\n"
+        << "  \"threads\": " << pool.size() << ",\n"
+        << "  \"kernel\": \"" << skinKernelName(skinKernel) << "\",\n"
+        << "  \"skin_mode\": \"" << skinModeName(options.skinMode) << "\",\n"
+        << "  \"sampling\": \"" << sampling << "\",\n"
+        << "  \"bake_rate\": " << options.bakeRate << ",\n"
+        << "  \"models\": [\n";
+
+    int numModels = 0;
+    for (int m = 0; m < sizeof(benchModels) / sizeof(benchModels[0]); m++) {
+        ostringstream entry;
+        if (!benchmarkModel(benchModels[m], options, pool, entry)) continue;
+        if (numModels++ > 0) out << ",\n";
+        out << entry.str();
+    }
+    out << "\n  ]\n}\n";
+
+    cout << "Results written to " << options.jsonFile << endl;
+    return numModels > 0 ? 0 : 1;
+}
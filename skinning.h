@@ -0,0 +1,263 @@
+// ----------------------------------------------------------------------------
+// Linear blend skinning
+//
+// Bone weights are converted at load time from assimp's per-bone lists into a
+// per-vertex influence table of at most MAX_INFLUENCES (bone, weight) pairs.
+// The table is stored slot-major (structure of arrays): slot k of vertex v is
+// at [k * numVertices + v]. The skinning kernel then gathers the palette
+// entries for each vertex and writes every output vertex exactly once.
+//-----------------------------------------------------------------------------
+
+#ifndef SKINNING_H
+#define SKINNING_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+#include <assimp/scene.h>
+#include "skeleton.h"
+#include "thread_pool.h"
+#include "mesh_lod.h"
+
+#define MAX_INFLUENCES 4
+#define PACKED_BONE_SIZE 24    // Floats per bone in BonePalette::packed
+#define SKIN_CHUNK_SIZE 2048   // Vertices per parallel skinning task
+
+struct SkinMesh {
+    int numVertices;
+    bool hasNormals;
+    std::vector<float> bindPositions;   // x[0..n), y[n..2n), z[2n..3n)
+    std::vector<float> bindNormals;     // Same layout as bindPositions
+    std::vector<int> boneIds;           // MAX_INFLUENCES slots of n entries
+    std::vector<float> weights;         // Same layout as boneIds
+};
+
+// ----------------------------------------------------------------------------
+void buildSkinMesh(SkinMesh *skin, const aiMesh *mesh) {
+    int n = mesh->mNumVertices;
+    skin->numVertices = n;
+    skin->hasNormals = mesh->HasNormals();
+    skin->bindPositions.resize(3 * n);
+    skin->bindNormals.assign(3 * n, 0.0f);
+    for (int v = 0; v < n; v++) {
+        for (int c = 0; c < 3; c++) {
+            skin->bindPositions[c * n + v] = mesh->mVertices[v][c];
+            if (skin->hasNormals) skin->bindNormals[c * n + v] = mesh->mNormals[v][c];
+        }
+    }
+
+    // Collect every influence per vertex, then keep the strongest ones
+    std::vector<std::vector<std::pair<float, int> > > influences(n);
+    for (int boneId = 0; boneId < mesh->mNumBones; boneId++) {
+        aiBone *bone = mesh->mBones[boneId];
+        for (int weightId = 0; weightId < bone->mNumWeights; weightId++) {
+            aiVertexWeight weight = bone->mWeights[weightId];
+            if (weight.mWeight > 0.0f)
+                influences[weight.mVertexId].push_back(std::make_pair(weight.mWeight, boneId));
+        }
+    }
+
+    int truncated = 0;
+    skin->boneIds.assign(MAX_INFLUENCES * n, 0);
+    skin->weights.assign(MAX_INFLUENCES * n, 0.0f);
+    for (int v = 0; v < n; v++) {
+        std::vector<std::pair<float, int> > &vertexInfl = influences[v];
+
+        // Vertices without influences are bound to the identity palette entry
+        if (vertexInfl.empty()) {
+            skin->boneIds[v] = mesh->mNumBones;
+            skin->weights[v] = 1.0f;
+            continue;
+        }
+
+        // Renormalise only when weights had to be dropped, so that meshes
+        // already limited to MAX_INFLUENCES deform exactly as before
+        float scale = 1.0f;
+        if (vertexInfl.size() > MAX_INFLUENCES) {
+            std::sort(vertexInfl.rbegin(), vertexInfl.rend());
+            float total = 0.0f, kept = 0.0f;
+            for (int k = 0; k < vertexInfl.size(); k++) {
+                total += vertexInfl[k].first;
+                if (k < MAX_INFLUENCES) kept += vertexInfl[k].first;
+            }
+            scale = total / kept;
+            vertexInfl.resize(MAX_INFLUENCES);
+            truncated++;
+        }
+
+        for (int k = 0; k < vertexInfl.size(); k++) {
+            skin->boneIds[k * n + v] = vertexInfl[k].second;
+            skin->weights[k * n + v] = vertexInfl[k].first * scale;
+        }
+    }
+
+    if (truncated > 0)
+        std::cout << "Mesh '" << mesh->mName.C_Str() << "': " << truncated << " vertices had more than "
+                  << MAX_INFLUENCES << " bone influences and were renormalised." << std::endl;
+}
+
+// ----------------------------------------------------------------------------
+// Derives the normal matrices and the packed palette used by the linear blend
+// kernels. The packed entry of a bone is the top three rows of its skinning
+// matrix followed by those of its normal matrix, with the fourth column of
+// the normal rows cleared.
+void prepareLinearPalette(BonePalette *palette) {
+    int numEntries = (int) palette->matrices.size();
+    palette->normalMatrices.resize(numEntries);
+    palette->packed.resize(numEntries * PACKED_BONE_SIZE);
+    for (int boneId = 0; boneId < numEntries; boneId++) {
+        aiMatrix4x4 &normalMatrix = palette->normalMatrices[boneId];
+        normalMatrix = palette->matrices[boneId];
+        normalMatrix.Inverse().Transpose();
+
+        float *dst = &palette->packed[boneId * PACKED_BONE_SIZE];
+        memcpy(dst, &palette->matrices[boneId].a1, 12 * sizeof(float));
+        memcpy(dst + 12, &normalMatrix.a1, 12 * sizeof(float));
+        dst[15] = dst[19] = dst[23] = 0.0f;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Skins vertices [begin, end) of a mesh. Each output vertex gathers its blend
+// matrices from the palette and is written exactly once.
+void skinVerticesScalar(const SkinMesh &skin, const BonePalette &palette, aiVector3D *outVertices,
+                  aiVector3D *outNormals, int begin, int end) {
+    int n = skin.numVertices;
+    const float *px = &skin.bindPositions[0], *py = px + n, *pz = py + n;
+    const float *nx = &skin.bindNormals[0], *ny = nx + n, *nz = ny + n;
+    const aiMatrix4x4 *matrices = &palette.matrices[0];
+    const aiMatrix4x4 *normalMatrices = &palette.normalMatrices[0];
+
+    for (int v = begin; v < end; v++) {
+        float m[12] = {0}, nm[9] = {0};
+
+        for (int k = 0; k < MAX_INFLUENCES; k++) {
+            float w = skin.weights[k * n + v];
+            if (w == 0.0f) continue;
+            int boneId = skin.boneIds[k * n + v];
+            const float *b = &matrices[boneId].a1;
+            for (int i = 0; i < 12; i++) m[i] += w * b[i];
+            const aiMatrix4x4 &bn = normalMatrices[boneId];
+            nm[0] += w * bn.a1; nm[1] += w * bn.a2; nm[2] += w * bn.a3;
+            nm[3] += w * bn.b1; nm[4] += w * bn.b2; nm[5] += w * bn.b3;
+            nm[6] += w * bn.c1; nm[7] += w * bn.c2; nm[8] += w * bn.c3;
+        }
+
+        float x = px[v], y = py[v], z = pz[v];
+        outVertices[v].x = m[0] * x + m[1] * y + m[2] * z + m[3];
+        outVertices[v].y = m[4] * x + m[5] * y + m[6] * z + m[7];
+        outVertices[v].z = m[8] * x + m[9] * y + m[10] * z + m[11];
+
+        if (skin.hasNormals) {
+            x = nx[v]; y = ny[v]; z = nz[v];
+            outNormals[v].x = nm[0] * x + nm[1] * y + nm[2] * z;
+            outNormals[v].y = nm[3] * x + nm[4] * y + nm[5] * z;
+            outNormals[v].z = nm[6] * x + nm[7] * y + nm[8] * z;
+        }
+    }
+}
+
+#include "skinning_simd.h"
+#include "skinning_dq.h"
+
+enum SkinMode {
+    SKIN_MODE_LINEAR,      // Linear blend of 4x4 matrices
+    SKIN_MODE_DUAL_QUAT    // Blend of unit dual quaternions
+};
+
+const char *skinModeName(SkinMode mode) {
+    return mode == SKIN_MODE_DUAL_QUAT ? "dual quaternion" : "linear blend";
+}
+
+// ----------------------------------------------------------------------------
+// Derives whatever the kernels of the given mode read from palette->matrices
+void prepareSkinPalette(BonePalette *palette, SkinMode mode) {
+    if (mode == SKIN_MODE_DUAL_QUAT)
+        prepareDualQuatPalette(palette);
+    else
+        prepareLinearPalette(palette);
+}
+
+// A range of vertices in one mesh, the unit of work for parallel skinning
+struct SkinChunk {
+    int meshId;
+    int begin;
+    int end;
+};
+
+// ----------------------------------------------------------------------------
+// Chunks covering the vertices a level of detail uses (every vertex if lods
+// is empty)
+std::vector<SkinChunk> buildSkinChunks(const std::vector<SkinMesh> &skinMeshes,
+                                       const std::vector<MeshLod> &lods = std::vector<MeshLod>(), int level = 0) {
+    std::vector<SkinChunk> chunks;
+    for (int meshId = 0; meshId < skinMeshes.size(); meshId++) {
+        int numVertices = lods.empty() ? skinMeshes[meshId].numVertices : lods[meshId].numVertices[level];
+        for (int begin = 0; begin < numVertices; begin += SKIN_CHUNK_SIZE) {
+            SkinChunk chunk = {meshId, begin, std::min(begin + SKIN_CHUNK_SIZE, numVertices)};
+            chunks.push_back(chunk);
+        }
+    }
+    return chunks;
+}
+
+// ----------------------------------------------------------------------------
+// Chunks of every level of detail of lods, or of the whole meshes only if
+// lods is empty
+std::vector<std::vector<SkinChunk> > buildLodSkinChunks(const std::vector<SkinMesh> &skinMeshes,
+                                                         const std::vector<MeshLod> &lods) {
+    std::vector<std::vector<SkinChunk> > levelChunks(lods.empty() ? 1 : LOD_LEVELS);
+    for (int level = 0; level < levelChunks.size(); level++)
+        levelChunks[level] = buildSkinChunks(skinMeshes, lods, level);
+    return levelChunks;
+}
+
+// ----------------------------------------------------------------------------
+// Skins every mesh of the scene, spreading the chunks across the pool. The
+// palette matrices must already be up to date; the mode specific data is
+// derived here, one mesh per task. Returns once all chunks are done.
+void skinMeshesParallel(ThreadPool &pool, const std::vector<SkinChunk> &chunks,
+                        const std::vector<SkinMesh> &skinMeshes, std::vector<BonePalette> &palettes,
+                        const aiScene *scene, SkinMode mode) {
+    pool.parallelFor((int) palettes.size(), [&](int meshId) {
+        prepareSkinPalette(&palettes[meshId], mode);
+    });
+    pool.parallelFor((int) chunks.size(), [&](int i) {
+        const SkinChunk &chunk = chunks[i];
+        aiMesh *mesh = scene->mMeshes[chunk.meshId];
+        if (mode == SKIN_MODE_DUAL_QUAT)
+            skinVerticesDualQuat(skinMeshes[chunk.meshId], palettes[chunk.meshId], mesh->mVertices,
+                                 mesh->mNormals, chunk.begin, chunk.end);
+        else
+            skinVertices(skinMeshes[chunk.meshId], palettes[chunk.meshId], mesh->mVertices, mesh->mNormals,
+                         chunk.begin, chunk.end);
+    });
+}
+
+// ----------------------------------------------------------------------------
+// Times palette preparation plus skinning of the current pose in each mode
+// and prints the average per frame. Leaves the meshes skinned in 'restore'.
+void benchmarkSkinModes(ThreadPool &pool, const std::vector<SkinChunk> &chunks,
+                        const std::vector<SkinMesh> &skinMeshes, std::vector<BonePalette> &palettes,
+                        const aiScene *scene, SkinMode restore, int numFrames = 200) {
+    SkinMode modes[2] = {SKIN_MODE_LINEAR, SKIN_MODE_DUAL_QUAT};
+    double times[2];
+    for (int m = 0; m < 2; m++) {
+        skinMeshesParallel(pool, chunks, skinMeshes, palettes, scene, modes[m]);   // Warm up
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < numFrames; frame++)
+            skinMeshesParallel(pool, chunks, skinMeshes, palettes, scene, modes[m]);
+        times[m] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+                   / numFrames;
+    }
+    skinMeshesParallel(pool, chunks, skinMeshes, palettes, scene, restore);
+
+    std::cout << "Skinning benchmark (" << numFrames << " frames, " << pool.size() << " thread(s), "
+              << skinKernelName(skinKernel) << "):" << std::endl;
+    for (int m = 0; m < 2; m++)
+        std::cout << "    " << skinModeName(modes[m]) << ": " << times[m] << " ms/frame" << std::endl;
+    std::cout << "    dual quaternion / linear blend = " << times[1] / times[0] << std::endl;
+}
+
+#endif
@@ -0,0 +1,287 @@
+// ----------------------------------------------------------------------------
+// Dual quaternion skinning
+//
+// Each skinning matrix is converted to a unit dual quaternion (rotation and
+// translation) plus a uniform scale factor. Vertices blend 8 + 1 floats per
+// influence instead of two 4x4 matrices, and since a rigid transform rotates
+// normals exactly, the per-bone matrix inverse for normals is not needed.
+//
+// Bones are assumed to scale uniformly (non-uniform scale is averaged). The
+// scale is blended linearly and applied before the rigid transform, which is
+// exact when all influences of a vertex share the same scale, as is the case
+// for a scale on the root node.
+//
+// As with the linear blend path, SSE4.1 and AVX2 kernels are selected at
+// runtime through skinKernel. Unlike a matrix, a dual quaternion fits in
+// eight floats, so these kernels do vectorise across vertices (4 or 8 per
+// iteration): the dual quaternions of each influence slot are loaded one
+// vertex per register and transposed, after which normalisation and the
+// transform are plain structure-of-arrays arithmetic.
+//-----------------------------------------------------------------------------
+
+#ifndef SKINNING_DQ_H
+#define SKINNING_DQ_H
+
+#include <cmath>
+
+#define DUAL_QUAT_SIZE 9   // Real part (w, x, y, z), dual part (w, x, y, z), scale
+
+// ----------------------------------------------------------------------------
+void prepareDualQuatPalette(BonePalette *palette) {
+    int numEntries = (int) palette->matrices.size();
+    palette->dualQuats.resize(numEntries * DUAL_QUAT_SIZE);
+    for (int boneId = 0; boneId < numEntries; boneId++) {
+        const aiMatrix4x4 &m = palette->matrices[boneId];
+
+        // Split off the scale, leaving the rotation
+        float scale = (aiVector3D(m.a1, m.b1, m.c1).Length() + aiVector3D(m.a2, m.b2, m.c2).Length()
+                       + aiVector3D(m.a3, m.b3, m.c3).Length()) / 3.0f;
+        aiMatrix3x3 rotn(m);
+        if (scale > 0.0f) {
+            for (int i = 0; i < 9; i++) (&rotn.a1)[i] /= scale;
+        }
+        aiQuaternion real(rotn);
+        real.Normalize();
+
+        // Dual part = 0.5 * (0, t) * real
+        aiQuaternion dual = aiQuaternion(0.0f, 0.5f * m.a4, 0.5f * m.b4, 0.5f * m.c4) * real;
+
+        float *dst = &palette->dualQuats[boneId * DUAL_QUAT_SIZE];
+        dst[0] = real.w; dst[1] = real.x; dst[2] = real.y; dst[3] = real.z;
+        dst[4] = dual.w; dst[5] = dual.x; dst[6] = dual.y; dst[7] = dual.z;
+        dst[8] = scale;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Skins vertices [begin, end) of a mesh with dual quaternion blending
+void skinVerticesDualQuatScalar(const SkinMesh &skin, const BonePalette &palette, aiVector3D *outVertices,
+                                aiVector3D *outNormals, int begin, int end) {
+    int n = skin.numVertices;
+    const float *px = &skin.bindPositions[0], *py = px + n, *pz = py + n;
+    const float *nx = &skin.bindNormals[0], *ny = nx + n, *nz = ny + n;
+    const float *dualQuats = &palette.dualQuats[0];
+
+    for (int v = begin; v < end; v++) {
+        float b[DUAL_QUAT_SIZE] = {0};
+        const float *first = dualQuats + skin.boneIds[v] * DUAL_QUAT_SIZE;
+
+        for (int k = 0; k < MAX_INFLUENCES; k++) {
+            float w = skin.weights[k * n + v];
+            if (w == 0.0f) continue;
+            const float *dq = dualQuats + skin.boneIds[k * n + v] * DUAL_QUAT_SIZE;
+
+            // Keep all rotations in the same hemisphere as the first influence
+            float scaleWeight = w;
+            if (dq[0] * first[0] + dq[1] * first[1] + dq[2] * first[2] + dq[3] * first[3] < 0.0f) w = -w;
+            for (int i = 0; i < 8; i++) b[i] += w * dq[i];
+            b[8] += scaleWeight * dq[8];
+        }
+
+        // Normalise by the length of the real part
+        float invLen = 1.0f / std::sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2] + b[3] * b[3]);
+        float rw = b[0] * invLen, rx = b[1] * invLen, ry = b[2] * invLen, rz = b[3] * invLen;
+        float dw = b[4] * invLen, dx = b[5] * invLen, dy = b[6] * invLen, dz = b[7] * invLen;
+
+        // Translation = 2 * (rw * d - dw * r + r x d)
+        float tx = 2.0f * (rw * dx - dw * rx + ry * dz - rz * dy);
+        float ty = 2.0f * (rw * dy - dw * ry + rz * dx - rx * dz);
+        float tz = 2.0f * (rw * dz - dw * rz + rx * dy - ry * dx);
+
+        // Rotation: v' = v + 2 r x (r x v + rw v)
+        float x = b[8] * px[v], y = b[8] * py[v], z = b[8] * pz[v];
+        float cx = ry * z - rz * y + rw * x, cy = rz * x - rx * z + rw * y, cz = rx * y - ry * x + rw * z;
+        outVertices[v].x = x + 2.0f * (ry * cz - rz * cy) + tx;
+        outVertices[v].y = y + 2.0f * (rz * cx - rx * cz) + ty;
+        outVertices[v].z = z + 2.0f * (rx * cy - ry * cx) + tz;
+
+        if (skin.hasNormals) {
+            x = nx[v]; y = ny[v]; z = nz[v];
+            cx = ry * z - rz * y + rw * x; cy = rz * x - rx * z + rw * y; cz = rx * y - ry * x + rw * z;
+            outNormals[v].x = x + 2.0f * (ry * cz - rz * cy);
+            outNormals[v].y = y + 2.0f * (rz * cx - rx * cz);
+            outNormals[v].z = z + 2.0f * (rx * cy - ry * cx);
+        }
+    }
+}
+
+#ifdef SKINNING_SIMD
+
+// ----------------------------------------------------------------------------
+// Generates the body shared by the SSE4.1 and AVX2 kernels. After blending,
+// the eight dual quaternion components and the scale of WIDTH vertices are
+// in rw..dz and s; the rest is the scalar kernel's arithmetic, lane-wise.
+#define DUAL_QUAT_TRANSFORM(VEC, SET1, ADD, SUB, MUL, DIV, SQRT, LOAD, STORE, WIDTH)                 \
+    {                                                                                              \
+        VEC two = SET1(2.0f);                                                                      \
+        VEC invLen = DIV(SET1(1.0f), SQRT(ADD(ADD(MUL(rw, rw), MUL(rx, rx)),                        \
+                                              ADD(MUL(ry, ry), MUL(rz, rz)))));                    \
+        rw = MUL(rw, invLen); rx = MUL(rx, invLen); ry = MUL(ry, invLen); rz = MUL(rz, invLen);    \
+        dw = MUL(dw, invLen); dx = MUL(dx, invLen); dy = MUL(dy, invLen); dz = MUL(dz, invLen);    \
+        VEC tx = MUL(two, ADD(SUB(MUL(rw, dx), MUL(dw, rx)), SUB(MUL(ry, dz), MUL(rz, dy))));      \
+        VEC ty = MUL(two, ADD(SUB(MUL(rw, dy), MUL(dw, ry)), SUB(MUL(rz, dx), MUL(rx, dz))));      \
+        VEC tz = MUL(two, ADD(SUB(MUL(rw, dz), MUL(dw, rz)), SUB(MUL(rx, dy), MUL(ry, dx))));      \
+        VEC x = MUL(s, LOAD(px + v)), y = MUL(s, LOAD(py + v)), z = MUL(s, LOAD(pz + v));          \
+        float out[3][WIDTH];                                                                       \
+        for (int pass = 0; pass < 2; pass++) {                                                     \
+            VEC cx = ADD(SUB(MUL(ry, z), MUL(rz, y)), MUL(rw, x));                                 \
+            VEC cy = ADD(SUB(MUL(rz, x), MUL(rx, z)), MUL(rw, y));                                 \
+            VEC cz = ADD(SUB(MUL(rx, y), MUL(ry, x)), MUL(rw, z));                                 \
+            x = ADD(x, MUL(two, SUB(MUL(ry, cz), MUL(rz, cy))));                                   \
+            y = ADD(y, MUL(two, SUB(MUL(rz, cx), MUL(rx, cz))));                                   \
+            z = ADD(z, MUL(two, SUB(MUL(rx, cy), MUL(ry, cx))));                                   \
+            aiVector3D *dst = outVertices;                                                         \
+            if (pass == 0) {                                                                       \
+                x = ADD(x, tx); y = ADD(y, ty); z = ADD(z, tz);                                    \
+            } else {                                                                               \
+                dst = outNormals;                                                                  \
+            }                                                                                      \
+            STORE(out[0], x); STORE(out[1], y); STORE(out[2], z);                                  \
+            for (int j = 0; j < WIDTH; j++) dst[v + j] = aiVector3D(out[0][j], out[1][j], out[2][j]); \
+            if (!skin.hasNormals) break;                                                           \
+            x = LOAD(nx + v); y = LOAD(ny + v); z = LOAD(nz + v);                                  \
+        }                                                                                          \
+    }
+
+// ----------------------------------------------------------------------------
+__attribute__((target("sse4.1")))
+void skinVerticesDualQuatSSE41(const SkinMesh &skin, const BonePalette &palette, aiVector3D *outVertices,
+                               aiVector3D *outNormals, int begin, int end) {
+    int n = skin.numVertices;
+    const float *px = &skin.bindPositions[0], *py = px + n, *pz = py + n;
+    const float *nx = &skin.bindNormals[0], *ny = nx + n, *nz = ny + n;
+    const float *dualQuats = &palette.dualQuats[0];
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+
+    int v = begin;
+    for (; v + 4 <= end; v += 4) {
+        __m128 rw = _mm_setzero_ps(), rx = rw, ry = rw, rz = rw, dw = rw, dx = rw, dy = rw, dz = rw, s = rw;
+        __m128 fw = rw, fx = rw, fy = rw, fz = rw;
+
+        for (int k = 0; k < MAX_INFLUENCES; k++) {
+            __m128 w = _mm_loadu_ps(&skin.weights[k * n + v]);
+            if (_mm_movemask_ps(_mm_cmpneq_ps(w, _mm_setzero_ps())) == 0) continue;
+            const int *ids = &skin.boneIds[k * n + v];
+            const float *q0 = dualQuats + ids[0] * DUAL_QUAT_SIZE, *q1 = dualQuats + ids[1] * DUAL_QUAT_SIZE;
+            const float *q2 = dualQuats + ids[2] * DUAL_QUAT_SIZE, *q3 = dualQuats + ids[3] * DUAL_QUAT_SIZE;
+
+            __m128 cw = _mm_loadu_ps(q0), cx = _mm_loadu_ps(q1), cy = _mm_loadu_ps(q2), cz = _mm_loadu_ps(q3);
+            _MM_TRANSPOSE4_PS(cw, cx, cy, cz);
+            __m128 ew = _mm_loadu_ps(q0 + 4), ex = _mm_loadu_ps(q1 + 4), ey = _mm_loadu_ps(q2 + 4), ez = _mm_loadu_ps(q3 + 4);
+            _MM_TRANSPOSE4_PS(ew, ex, ey, ez);
+            __m128 cs = _mm_setr_ps(q0[8], q1[8], q2[8], q3[8]);
+
+            // Slot 0 is never empty, so it defines the hemisphere for the others
+            if (k == 0) {
+                fw = cw; fx = cx; fy = cy; fz = cz;
+            }
+            __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cw, fw), _mm_mul_ps(cx, fx)),
+                                    _mm_add_ps(_mm_mul_ps(cy, fy), _mm_mul_ps(cz, fz)));
+            __m128 sw = _mm_xor_ps(w, _mm_and_ps(_mm_cmplt_ps(dot, _mm_setzero_ps()), signBit));
+
+            rw = _mm_add_ps(rw, _mm_mul_ps(sw, cw)); rx = _mm_add_ps(rx, _mm_mul_ps(sw, cx));
+            ry = _mm_add_ps(ry, _mm_mul_ps(sw, cy)); rz = _mm_add_ps(rz, _mm_mul_ps(sw, cz));
+            dw = _mm_add_ps(dw, _mm_mul_ps(sw, ew)); dx = _mm_add_ps(dx, _mm_mul_ps(sw, ex));
+            dy = _mm_add_ps(dy, _mm_mul_ps(sw, ey)); dz = _mm_add_ps(dz, _mm_mul_ps(sw, ez));
+            s = _mm_add_ps(s, _mm_mul_ps(w, cs));
+        }
+
+        DUAL_QUAT_TRANSFORM(__m128, _mm_set1_ps, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_div_ps, _mm_sqrt_ps,
+                            _mm_loadu_ps, _mm_storeu_ps, 4)
+    }
+
+    skinVerticesDualQuatScalar(skin, palette, outVertices, outNormals, v, end);
+}
+
+// ----------------------------------------------------------------------------
+// Transposes eight rows of eight floats in place
+__attribute__((target("avx2")))
+inline void transpose8(__m256 *r) {
+    __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]), t1 = _mm256_unpackhi_ps(r[0], r[1]);
+    __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]), t3 = _mm256_unpackhi_ps(r[2], r[3]);
+    __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]), t5 = _mm256_unpackhi_ps(r[4], r[5]);
+    __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]), t7 = _mm256_unpackhi_ps(r[6], r[7]);
+    __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)), u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)), u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0)), u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0)), u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+    r[0] = _mm256_permute2f128_ps(u0, u4, 0x20); r[1] = _mm256_permute2f128_ps(u1, u5, 0x20);
+    r[2] = _mm256_permute2f128_ps(u2, u6, 0x20); r[3] = _mm256_permute2f128_ps(u3, u7, 0x20);
+    r[4] = _mm256_permute2f128_ps(u0, u4, 0x31); r[5] = _mm256_permute2f128_ps(u1, u5, 0x31);
+    r[6] = _mm256_permute2f128_ps(u2, u6, 0x31); r[7] = _mm256_permute2f128_ps(u3, u7, 0x31);
+}
+
+// ----------------------------------------------------------------------------
+__attribute__((target("avx2")))
+void skinVerticesDualQuatAVX2(const SkinMesh &skin, const BonePalette &palette, aiVector3D *outVertices,
+                              aiVector3D *outNormals, int begin, int end) {
+    int n = skin.numVertices;
+    const float *px = &skin.bindPositions[0], *py = px + n, *pz = py + n;
+    const float *nx = &skin.bindNormals[0], *ny = nx + n, *nz = ny + n;
+    const float *dualQuats = &palette.dualQuats[0];
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+
+    int v = begin;
+    for (; v + 8 <= end; v += 8) {
+        __m256 rw = _mm256_setzero_ps(), rx = rw, ry = rw, rz = rw, dw = rw, dx = rw, dy = rw, dz = rw, s = rw;
+        __m256 fw = rw, fx = rw, fy = rw, fz = rw;
+
+        for (int k = 0; k < MAX_INFLUENCES; k++) {
+            __m256 w = _mm256_loadu_ps(&skin.weights[k * n + v]);
+            if (_mm256_movemask_ps(_mm256_cmp_ps(w, _mm256_setzero_ps(), _CMP_NEQ_UQ)) == 0) continue;
+            __m256i offsets = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *) &skin.boneIds[k * n + v]),
+                                                 _mm256_set1_epi32(DUAL_QUAT_SIZE));
+            int lane[8];
+            _mm256_storeu_si256((__m256i *) lane, offsets);
+
+            __m256 c[8];
+            for (int j = 0; j < 8; j++) c[j] = _mm256_loadu_ps(dualQuats + lane[j]);
+            transpose8(c);
+            __m256 cs = _mm256_i32gather_ps(dualQuats + 8, offsets, 4);
+
+            // Slot 0 is never empty, so it defines the hemisphere for the others
+            if (k == 0) {
+                fw = c[0]; fx = c[1]; fy = c[2]; fz = c[3];
+            }
+            __m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[0], fw), _mm256_mul_ps(c[1], fx)),
+                                       _mm256_add_ps(_mm256_mul_ps(c[2], fy), _mm256_mul_ps(c[3], fz)));
+            __m256 sw = _mm256_xor_ps(w, _mm256_and_ps(_mm256_cmp_ps(dot, _mm256_setzero_ps(), _CMP_LT_OQ), signBit));
+
+            rw = _mm256_add_ps(rw, _mm256_mul_ps(sw, c[0])); rx = _mm256_add_ps(rx, _mm256_mul_ps(sw, c[1]));
+            ry = _mm256_add_ps(ry, _mm256_mul_ps(sw, c[2])); rz = _mm256_add_ps(rz, _mm256_mul_ps(sw, c[3]));
+            dw = _mm256_add_ps(dw, _mm256_mul_ps(sw, c[4])); dx = _mm256_add_ps(dx, _mm256_mul_ps(sw, c[5]));
+            dy = _mm256_add_ps(dy, _mm256_mul_ps(sw, c[6])); dz = _mm256_add_ps(dz, _mm256_mul_ps(sw, c[7]));
+            s = _mm256_add_ps(s, _mm256_mul_ps(w, cs));
+        }
+
+        DUAL_QUAT_TRANSFORM(__m256, _mm256_set1_ps, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_div_ps,
+                            _mm256_sqrt_ps, _mm256_loadu_ps, _mm256_storeu_ps, 8)
+    }
+
+    skinVerticesDualQuatScalar(skin, palette, outVertices, outNormals, v, end);
+}
+
+#undef DUAL_QUAT_TRANSFORM
+
+#endif
+
+// ----------------------------------------------------------------------------
+// Skins vertices [begin, end) with the dual quaternion kernel matching skinKernel
+void skinVerticesDualQuat(const SkinMesh &skin, const BonePalette &palette, aiVector3D *outVertices,
+                          aiVector3D *outNormals, int begin, int end) {
+    switch (skinKernel) {
+#ifdef SKINNING_SIMD
+        case SKIN_KERNEL_AVX2:
+            skinVerticesDualQuatAVX2(skin, palette, outVertices, outNormals, begin, end);
+            break;
+        case SKIN_KERNEL_SSE41:
+            skinVerticesDualQuatSSE41(skin, palette, outVertices, outNormals, begin, end);
+            break;
+#endif
+        default:
+            skinVerticesDualQuatScalar(skin, palette, outVertices, outNormals, begin, end);
+            break;
+    }
+}
+
+#endif
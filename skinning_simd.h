@@ -0,0 +1,174 @@
+// ----------------------------------------------------------------------------
+// Vectorised linear blend skinning
+//
+// SSE4.1 and AVX2 versions of skinVerticesScalar, selected at runtime from
+// CPUID. Both read the packed palette (see BonePalette::packed) and blend
+// whole matrix rows per influence: SSE4.1 uses six 4-wide multiply-adds and
+// DPPS for the final transform, AVX2 uses three 8-wide multiply-adds and a
+// horizontal-add reduction that produces position and normal together.
+//
+// Vectorising across vertices instead needs a palette gather per matrix
+// element and lane; that was measured slower than blending rows.
+//
+// Results differ from the scalar kernel only in the summation order of the
+// final dot products, and from the original per-bone 4x4 matrix summation by
+// less than 1e-5 of the model's extent.
+//-----------------------------------------------------------------------------
+
+#ifndef SKINNING_SIMD_H
+#define SKINNING_SIMD_H
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SKINNING_SIMD 1
+#include <immintrin.h>
+#endif
+
+enum SkinKernel {
+    SKIN_KERNEL_SCALAR,
+    SKIN_KERNEL_SSE41,
+    SKIN_KERNEL_AVX2
+};
+
+const char *skinKernelName(SkinKernel kernel) {
+    switch (kernel) {
+        case SKIN_KERNEL_AVX2:
+            return "AVX2";
+        case SKIN_KERNEL_SSE41:
+            return "SSE4.1";
+        default:
+            return "scalar";
+    }
+}
+
+#ifdef SKINNING_SIMD
+
+// ----------------------------------------------------------------------------
+// Stores the low three lanes of a register as a vector. Writing all four
+// lanes is cheaper but spills into the next vertex, so that is only done
+// when the next vertex belongs to the same call and is written afterwards.
+__attribute__((target("sse4.1")))
+inline void storeVector3(aiVector3D *out, __m128 value, bool overlap) {
+    if (overlap) {
+        _mm_storeu_ps(&out->x, value);
+    } else {
+        _mm_store_ss(&out->x, value);
+        out->y = _mm_cvtss_f32(_mm_shuffle_ps(value, value, _MM_SHUFFLE(1, 1, 1, 1)));
+        out->z = _mm_cvtss_f32(_mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 2, 2, 2)));
+    }
+}
+
+// ----------------------------------------------------------------------------
+__attribute__((target("sse4.1")))
+void skinVerticesSSE41(const SkinMesh &skin, const BonePalette &palette, aiVector3D *outVertices,
+                       aiVector3D *outNormals, int begin, int end) {
+    int n = skin.numVertices;
+    const float *px = &skin.bindPositions[0], *py = px + n, *pz = py + n;
+    const float *nx = &skin.bindNormals[0], *ny = nx + n, *nz = ny + n;
+    const float *packed = &palette.packed[0];
+
+    for (int v = begin; v < end; v++) {
+        __m128 r0 = _mm_setzero_ps(), r1 = r0, r2 = r0, n0 = r0, n1 = r0, n2 = r0;
+        for (int k = 0; k < MAX_INFLUENCES; k++) {
+            float weight = skin.weights[k * n + v];
+            if (weight == 0.0f) continue;
+            __m128 w = _mm_set1_ps(weight);
+            const float *b = packed + skin.boneIds[k * n + v] * PACKED_BONE_SIZE;
+            r0 = _mm_add_ps(r0, _mm_mul_ps(w, _mm_loadu_ps(b)));
+            r1 = _mm_add_ps(r1, _mm_mul_ps(w, _mm_loadu_ps(b + 4)));
+            r2 = _mm_add_ps(r2, _mm_mul_ps(w, _mm_loadu_ps(b + 8)));
+            n0 = _mm_add_ps(n0, _mm_mul_ps(w, _mm_loadu_ps(b + 12)));
+            n1 = _mm_add_ps(n1, _mm_mul_ps(w, _mm_loadu_ps(b + 16)));
+            n2 = _mm_add_ps(n2, _mm_mul_ps(w, _mm_loadu_ps(b + 20)));
+        }
+
+        // Row dot products, each deposited into its own output lane
+        bool overlap = v + 1 < end;
+        __m128 p = _mm_setr_ps(px[v], py[v], pz[v], 1.0f);
+        storeVector3(&outVertices[v], _mm_or_ps(_mm_or_ps(_mm_dp_ps(r0, p, 0xF1), _mm_dp_ps(r1, p, 0xF2)),
+                                                _mm_dp_ps(r2, p, 0xF4)), overlap);
+        if (skin.hasNormals) {
+            p = _mm_setr_ps(nx[v], ny[v], nz[v], 0.0f);
+            storeVector3(&outNormals[v], _mm_or_ps(_mm_or_ps(_mm_dp_ps(n0, p, 0x71), _mm_dp_ps(n1, p, 0x72)),
+                                                   _mm_dp_ps(n2, p, 0x74)), overlap);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Each influence is three 8-wide multiply-adds: the packed palette entry
+// holds position rows 0-1, row 2 and normal row 0, then normal rows 1-2
+__attribute__((target("avx2")))
+void skinVerticesAVX2(const SkinMesh &skin, const BonePalette &palette, aiVector3D *outVertices,
+                      aiVector3D *outNormals, int begin, int end) {
+    int n = skin.numVertices;
+    const float *px = &skin.bindPositions[0], *py = px + n, *pz = py + n;
+    const float *nx = &skin.bindNormals[0], *ny = nx + n, *nz = ny + n;
+    const float *packed = &palette.packed[0];
+
+    // Moves (x, z, ny, - | y, nx, nz, -) into (x, y, z, - | nx, ny, nz, -)
+    const __m256i resultOrder = _mm256_setr_epi32(0, 4, 1, 3, 5, 2, 6, 7);
+
+    for (int v = begin; v < end; v++) {
+        __m256 a = _mm256_setzero_ps(), b = a, c = a;
+        for (int k = 0; k < MAX_INFLUENCES; k++) {
+            float weight = skin.weights[k * n + v];
+            if (weight == 0.0f) continue;
+            __m256 w = _mm256_set1_ps(weight);
+            const float *bone = packed + skin.boneIds[k * n + v] * PACKED_BONE_SIZE;
+            a = _mm256_add_ps(a, _mm256_mul_ps(w, _mm256_loadu_ps(bone)));
+            b = _mm256_add_ps(b, _mm256_mul_ps(w, _mm256_loadu_ps(bone + 8)));
+            c = _mm256_add_ps(c, _mm256_mul_ps(w, _mm256_loadu_ps(bone + 16)));
+        }
+
+        __m128 p = _mm_setr_ps(px[v], py[v], pz[v], 1.0f);
+        __m128 q = skin.hasNormals ? _mm_setr_ps(nx[v], ny[v], nz[v], 0.0f) : _mm_setzero_ps();
+        __m256 pp = _mm256_insertf128_ps(_mm256_castps128_ps256(p), p, 1);
+        __m256 pq = _mm256_insertf128_ps(_mm256_castps128_ps256(p), q, 1);
+        __m256 qq = _mm256_insertf128_ps(_mm256_castps128_ps256(q), q, 1);
+
+        // Two rounds of horizontal adds reduce the six row products to dot products
+        __m256 ab = _mm256_hadd_ps(_mm256_mul_ps(a, pp), _mm256_mul_ps(b, pq));
+        __m256 cc = _mm256_mul_ps(c, qq);
+        __m256 dots = _mm256_permutevar8x32_ps(_mm256_hadd_ps(ab, _mm256_hadd_ps(cc, cc)), resultOrder);
+
+        bool overlap = v + 1 < end;
+        storeVector3(&outVertices[v], _mm256_castps256_ps128(dots), overlap);
+        if (skin.hasNormals)
+            storeVector3(&outNormals[v], _mm256_extractf128_ps(dots, 1), overlap);
+    }
+}
+
+#endif
+
+// ----------------------------------------------------------------------------
+SkinKernel detectSkinKernel() {
+#ifdef SKINNING_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SKIN_KERNEL_AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return SKIN_KERNEL_SSE41;
+#endif
+    return SKIN_KERNEL_SCALAR;
+}
+
+SkinKernel skinKernel = detectSkinKernel();   // Best kernel supported by this CPU
+
+// ----------------------------------------------------------------------------
+// Skins vertices [begin, end) with the currently selected kernel
+void skinVertices(const SkinMesh &skin, const BonePalette &palette, aiVector3D *outVertices,
+                  aiVector3D *outNormals, int begin, int end) {
+    switch (skinKernel) {
+#ifdef SKINNING_SIMD
+        case SKIN_KERNEL_AVX2:
+            skinVerticesAVX2(skin, palette, outVertices, outNormals, begin, end);
+            break;
+        case SKIN_KERNEL_SSE41:
+            skinVerticesSSE41(skin, palette, outVertices, outNormals, begin, end);
+            break;
+#endif
+        default:
+            skinVerticesScalar(skin, palette, outVertices, outNormals, begin, end);
+            break;
+    }
+}
+
+#endif
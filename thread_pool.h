@@ -0,0 +1,113 @@
+// ----------------------------------------------------------------------------
+// Persistent worker pool
+//
+// Workers are created once and sleep between jobs. parallelFor hands out
+// task indices from an atomic counter, runs tasks on the calling thread as
+// well, and returns only when every task has finished, so callers can treat
+// it as a synchronous loop. Tasks are passed without std::function, so
+// dispatching a job does not allocate.
+//-----------------------------------------------------------------------------
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    // numThreads counts the calling thread; 0 means one per hardware thread
+    explicit ThreadPool(int numThreads = 0) : generation(0), stopping(false), pending(0) {
+        if (numThreads <= 0) numThreads = (int) std::thread::hardware_concurrency();
+        if (numThreads <= 0) numThreads = 1;
+        for (int i = 1; i < numThreads; i++)
+            workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (int i = 0; i < workers.size(); i++) workers[i].join();
+    }
+
+    int size() const { return (int) workers.size() + 1; }
+
+    // Runs task(i) for every i in [0, numTasks) and waits for completion
+    template <typename Task>
+    void parallelFor(int numTasks, const Task &task) {
+        if (numTasks <= 0) return;
+        if (workers.empty() || numTasks == 1) {
+            for (int i = 0; i < numTasks; i++) task(i);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job.run = &invoke<Task>;
+            job.context = (void *) &task;
+            job.numTasks = numTasks;
+            nextTask.store(0);
+            pending = (int) workers.size();
+            generation++;
+        }
+        wake.notify_all();
+
+        runTasks(job);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0; });
+    }
+
+private:
+    struct Job {
+        void (*run)(void *, int);
+        void *context;
+        int numTasks;
+    };
+
+    template <typename Task>
+    static void invoke(void *context, int index) {
+        (*static_cast<const Task *>(context))(index);
+    }
+
+    void runTasks(const Job &current) {
+        for (int i = nextTask.fetch_add(1); i < current.numTasks; i = nextTask.fetch_add(1))
+            current.run(current.context, i);
+    }
+
+    void workerLoop() {
+        unsigned long seen = 0;
+        while (true) {
+            Job current;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this, seen] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                current = job;
+            }
+
+            runTasks(current);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0) done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    Job job;
+    std::atomic<int> nextTask;
+    unsigned long generation;
+    bool stopping;
+    int pending;
+};
+
+#endif